@@ -1,4 +1,8 @@
 __nowaiting = true	-- If you turn this flag off, cluster.call would block when node name is absent
+-- __compress = 4096	-- Compress the messages larger than 4096 bytes, if the peer node supports it
+-- __connections = 4	-- The number of connections (and sender services) to each node
+-- __heartbeat = 100	-- Ping each node every 1s, a node is down if it doesn't reply in 1s
+-- __backup = { db = "127.0.0.1:2529" }	-- Connect to the backup before db is down, and switch to it when db is down
 
 db = "127.0.0.1:2528"
 db2 = "127.0.0.1:2529"
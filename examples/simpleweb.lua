@@ -59,38 +59,43 @@ skynet.start(function()
 		if interface.init then
 			interface.init()
 		end
-		-- limit request body size to 8192 (you can pass nil to unlimit)
-		local code, url, method, header, body = httpd.read_request(interface.read, 8192)
-		if code then
-			if code ~= 200 then
-				response(id, interface.write, code)
-			else
-				local tmp = {}
-				if header.host then
-					table.insert(tmp, string.format("host: %s", header.host))
-				end
-				local path, query = urllib.parse(url)
-				table.insert(tmp, string.format("path: %s", path))
-				if query then
-					local q = urllib.parse_query(query)
-					for k, v in pairs(q) do
-						table.insert(tmp, string.format("query: %s= %s", k,v))
+		-- keep-alive : rest is the pipelined requests, nil when the connection should be closed
+		local rest = ""
+		repeat
+			-- limit request body size to 8192 (you can pass nil to unlimit)
+			local code, url, method, header, body
+			code, url, method, header, body, rest = httpd.read_request(interface.read, 8192, rest)
+			if code then
+				if code ~= 200 then
+					response(id, interface.write, code)
+				else
+					local tmp = {}
+					if header.host then
+						table.insert(tmp, string.format("host: %s", header.host))
 					end
+					local path, query = urllib.parse(url)
+					table.insert(tmp, string.format("path: %s", path))
+					if query then
+						local q = urllib.parse_query(query)
+						for k, v in pairs(q) do
+							table.insert(tmp, string.format("query: %s= %s", k,v))
+						end
+					end
+					table.insert(tmp, "-----header----")
+					for k,v in pairs(header) do
+						table.insert(tmp, string.format("%s = %s",k,v))
+					end
+					table.insert(tmp, "-----body----\n" .. body)
+					response(id, interface.write, code, table.concat(tmp,"\n"))
 				end
-				table.insert(tmp, "-----header----")
-				for k,v in pairs(header) do
-					table.insert(tmp, string.format("%s = %s",k,v))
-				end
-				table.insert(tmp, "-----body----\n" .. body)
-				response(id, interface.write, code, table.concat(tmp,"\n"))
-			end
-		else
-			if url == sockethelper.socket_error then
-				skynet.error("socket closed")
 			else
-				skynet.error(url)
+				if url == sockethelper.socket_error then
+					skynet.error("socket closed")
+				else
+					skynet.error(url)
+				end
 			end
-		end
+		until not rest
 		socket.close(id)
 		if interface.close then
 			interface.close()
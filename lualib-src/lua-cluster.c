@@ -7,16 +7,19 @@
 #include <unistd.h>
 
 #include "skynet.h"
+#include "packet_header.h"
 
 /*
 	uint32_t/string addr 
 	uint32_t/session session
 	lightuserdata msg
 	uint32_t sz
+	boolean large (optional, the large request in one package)
 
 	return 
 		string request
 		uint32_t next_session
+		table padding (multi parts)
  */
 
 #define TEMP_LENGTH 0x8200
@@ -37,6 +40,26 @@ fill_header(lua_State *L, uint8_t *buf, int sz) {
 	buf[1] = sz & 0xff;
 }
 
+/*
+	The large package (> MULTI_PART) in one piece, when the peer knows the "ext" header (see packet_header.h) :
+		WORD 0
+		DWORD size (big endian)
+	It's negotiated by hello (see clustersender.lua), the old version peer always gets multi parts.
+ */
+static void
+push_large(lua_State *L, const uint8_t *head, size_t headsz, const void *msg, size_t sz) {
+	struct packet_header h;
+	packet_header_init(&h, "ext");
+	uint8_t header[PACKET_HEADER_MAXSIZE];
+	int n = packet_header_write(&h, header, headsz + sz);
+	luaL_Buffer b;
+	char * ptr = luaL_buffinitsize(L, &b, n + headsz + sz);
+	memcpy(ptr, header, n);
+	memcpy(ptr + n, head, headsz);
+	memcpy(ptr + n + headsz, msg, sz);
+	luaL_pushresultsize(&b, n + headsz + sz);
+}
+
 /*
 	The request package : 
 		first WORD is size of the package with big-endian
@@ -79,11 +102,23 @@ fill_header(lua_State *L, uint8_t *buf, int sz) {
 		WORD stringsz + 1
 		BYTE 4
 		STRING tag
+
+	batch of pushes (the peer knows it, negotiated by hello)
+		WORD sz + 1 , or WORD 0 and DWORD sz + 1 (big endian)
+		BYTE 5
+		PADDING pushes(sz) , each is a push package (address is id or string) with "ext" header
  */
 static int
-packreq_number(lua_State *L, int session, void * msg, uint32_t sz, int is_push) {
+packreq_number(lua_State *L, int session, void * msg, uint32_t sz, int is_push, int large) {
 	uint32_t addr = (uint32_t)lua_tointeger(L,1);
 	uint8_t buf[TEMP_LENGTH];
+	if (large && sz >= MULTI_PART) {
+		buf[0] = 0;
+		fill_uint32(buf+1, addr);
+		fill_uint32(buf+5, is_push ? 0 : (uint32_t)session);
+		push_large(L, buf, 9, msg, sz);
+		return 0;
+	}
 	if (sz < MULTI_PART) {
 		fill_header(L, buf, sz+9);
 		buf[2] = 0;
@@ -106,7 +141,7 @@ packreq_number(lua_State *L, int session, void * msg, uint32_t sz, int is_push)
 }
 
 static int
-packreq_string(lua_State *L, int session, void * msg, uint32_t sz, int is_push) {
+packreq_string(lua_State *L, int session, void * msg, uint32_t sz, int is_push, int large) {
 	size_t namelen = 0;
 	const char *name = lua_tolstring(L, 1, &namelen);
 	if (name == NULL || namelen < 1 || namelen > 255) {
@@ -119,6 +154,14 @@ packreq_string(lua_State *L, int session, void * msg, uint32_t sz, int is_push)
 	}
 
 	uint8_t buf[TEMP_LENGTH];
+	if (large && sz >= MULTI_PART) {
+		buf[0] = 0x80;
+		buf[1] = (uint8_t)namelen;
+		memcpy(buf+2, name, namelen);
+		fill_uint32(buf+2+namelen, is_push ? 0 : (uint32_t)session);
+		push_large(L, buf, 6+namelen, msg, sz);
+		return 0;
+	}
 	if (sz < MULTI_PART) {
 		fill_header(L, buf, sz+6+namelen);
 		buf[2] = 0x80;
@@ -180,12 +223,13 @@ packrequest(lua_State *L, int is_push) {
 		skynet_free(msg);
 		return luaL_error(L, "Invalid request session %d", session);
 	}
+	int large = lua_toboolean(L,5);
 	int addr_type = lua_type(L,1);
 	int multipak;
 	if (addr_type == LUA_TNUMBER) {
-		multipak = packreq_number(L, session, msg, sz, is_push);
+		multipak = packreq_number(L, session, msg, sz, is_push, large);
 	} else {
-		multipak = packreq_string(L, session, msg, sz, is_push);
+		multipak = packreq_string(L, session, msg, sz, is_push, large);
 	}
 	uint32_t new_session = (uint32_t)session + 1;
 	if (new_session > INT32_MAX) {
@@ -228,6 +272,19 @@ lpacktrace(lua_State *L) {
 	return 1;
 }
 
+/*
+	string pushes (packed by packpush with large = true)
+	return string batch
+ */
+static int
+lpackbatch(lua_State *L) {
+	size_t sz;
+	const char * pushes = luaL_checklstring(L, 1, &sz);
+	uint8_t type = 5;
+	push_large(L, &type, 1, pushes, sz);
+	return 1;
+}
+
 /*
 	string packed message
 	return 	
@@ -354,6 +411,77 @@ unpackmreq_string(lua_State *L, const uint8_t * buf, int sz, int is_push) {
 	return 6;
 }
 
+// return 0 if the pushes in batch are valid
+static int
+check_batch(const struct packet_header *h, const uint8_t *buf, int sz) {
+	while (sz > 0) {
+		int psz;
+		int n = packet_header_read(h, buf, sz, &psz);
+		if (n <= 0 || psz > sz - n)
+			return 1;
+		const uint8_t * p = buf + n;
+		if (psz >= 9 && p[0] == 0) {
+			if (unpack_uint32(p+5) != 0)
+				return 1;
+		} else if (psz >= 2 && p[0] == 0x80 && psz >= p[1] + 6) {
+			if (unpack_uint32(p+2+p[1]) != 0)
+				return 1;
+		} else {
+			return 1;
+		}
+		buf += n + psz;
+		sz -= n + psz;
+	}
+	return 0;
+}
+
+/*
+	push a table of the pushes in batch :
+		address (id or string), lightuserdata msg, int sz, address, msg, sz, ...
+ */
+static void
+unpack_batch(lua_State *L, const uint8_t *buf, int sz) {
+	struct packet_header h;
+	packet_header_init(&h, "ext");
+	if (check_batch(&h, buf, sz)) {
+		luaL_error(L, "Invalid cluster batch");
+	}
+	lua_newtable(L);
+	int t = lua_gettop(L);
+	int i = 0;
+	while (sz > 0) {
+		int psz;
+		int n = packet_header_read(&h, buf, sz, &psz);
+		const uint8_t * p = buf + n;
+		if (p[0] == 0) {
+			unpackreq_number(L, p, psz);
+		} else {
+			unpackreq_string(L, p, psz);
+		}
+		// address, session(0), msg, sz, nil, true
+		lua_settop(L, t + 4);
+		lua_rawseti(L, t, i+3);
+		lua_rawseti(L, t, i+2);
+		lua_pop(L, 1);
+		lua_rawseti(L, t, i+1);
+		i += 3;
+		buf += n + psz;
+		sz -= n + psz;
+	}
+}
+
+/*
+	string pushes
+	return table (address, msg, sz, ...), see unpack_batch
+ */
+static int
+lunpackbatch(lua_State *L) {
+	size_t sz;
+	const uint8_t * pushes = (const uint8_t *)luaL_checklstring(L, 1, &sz);
+	unpack_batch(L, pushes, (int)sz);
+	return 1;
+}
+
 static int
 lunpackrequest(lua_State *L) {
 	int sz;
@@ -412,6 +540,7 @@ lunpackrequest(lua_State *L) {
 	boolean ok
 	lightuserdata msg
 	int sz
+	boolean large (optional, the large response in one package)
 	return string response
  */
 static int
@@ -436,6 +565,13 @@ lpackresponse(lua_State *L) {
 			sz = MULTI_PART;
 		}
 	} else {
+		if (sz > MULTI_PART && lua_toboolean(L,5)) {
+			uint8_t head[5];
+			fill_uint32(head, session);
+			head[4] = 1;
+			push_large(L, head, 5, msg, sz);
+			return 1;
+		}
 		if (sz > MULTI_PART) {
 			// return 
 			int part = (sz - 1) / MULTI_PART + 1;
@@ -529,6 +665,483 @@ lunpackresponse(lua_State *L) {
 	}
 }
 
+/*
+	The stream decoders keep the multi part messages in C, and return the complete ones only.
+
+	The large request (or response) is reassembled in one buffer, the parts are copied into it directly,
+	so Lua never sees the parts. The buffer grows as the parts arrive, up to the size in the multi begin
+	package, so a begin package alone doesn't allocate the announced size. The size must be in
+	(MULTI_PART, LARGE_MAXSIZE], or the message is invalid.
+ */
+
+#define HASHSIZE 64
+#define LARGE_MAXSIZE 0x40000000
+
+struct partial {
+	struct partial * next;
+	uint32_t session;
+	uint32_t size;
+	uint32_t offset;
+	uint32_t cap;
+	char * buffer;
+	int invalid;
+	// for request only
+	uint32_t addr;
+	int is_push;
+	char * name;	// NULL if addr is id
+	size_t namesz;
+	char * tag;
+	size_t tagsz;
+};
+
+struct partial_set {
+	struct partial * hash[HASHSIZE];
+};
+
+static void
+partial_free(struct partial *p) {
+	skynet_free(p->buffer);
+	skynet_free(p->name);
+	skynet_free(p->tag);
+	skynet_free(p);
+}
+
+static struct partial *
+partial_new(struct partial_set *set, uint32_t session, uint32_t size) {
+	struct partial * p = skynet_malloc(sizeof(*p));
+	memset(p, 0, sizeof(*p));
+	p->session = session;
+	p->size = size;
+	p->invalid = (size <= MULTI_PART || size > LARGE_MAXSIZE);
+	int h = session % HASHSIZE;
+	p->next = set->hash[h];
+	set->hash[h] = p;
+	return p;
+}
+
+static struct partial *
+partial_find(struct partial_set *set, uint32_t session, int remove) {
+	struct partial ** pp = &set->hash[session % HASHSIZE];
+	struct partial * p;
+	while ((p = *pp) != NULL) {
+		if (p->session == session) {
+			if (remove) {
+				*pp = p->next;
+			}
+			return p;
+		}
+		pp = &p->next;
+	}
+	return NULL;
+}
+
+static void
+partial_append(struct partial *p, const void *data, size_t sz) {
+	if (p->invalid)
+		return;
+	if (sz > p->size - p->offset) {
+		skynet_free(p->buffer);
+		p->buffer = NULL;
+		p->invalid = 1;
+		return;
+	}
+	if (sz > p->cap - p->offset) {
+		uint32_t cap = p->cap ? p->cap : MULTI_PART;
+		while (cap - p->offset < sz) {
+			cap *= 2;
+		}
+		if (cap > p->size) {
+			cap = p->size;
+		}
+		p->buffer = skynet_realloc(p->buffer, cap);
+		p->cap = cap;
+	}
+	memcpy(p->buffer + p->offset, data, sz);
+	p->offset += sz;
+}
+
+static void
+partial_clear(struct partial_set *set) {
+	int i;
+	for (i=0;i<HASHSIZE;i++) {
+		struct partial * p = set->hash[i];
+		while (p) {
+			struct partial * next = p->next;
+			partial_free(p);
+			p = next;
+		}
+		set->hash[i] = NULL;
+	}
+}
+
+#define REQUEST_DECODER "CLUSTER_REQUEST_DECODER"
+#define RESPONSE_DECODER "CLUSTER_RESPONSE_DECODER"
+
+struct request_decoder {
+	char * tag;	// trace tag of the next request
+	size_t tagsz;
+	struct partial_set set;
+};
+
+static char *
+copy_string(const uint8_t *str, size_t sz) {
+	char * s = skynet_malloc(sz);
+	memcpy(s, str, sz);
+	return s;
+}
+
+static void
+request_begin(lua_State *L, struct request_decoder *d, const uint8_t *buf, int sz, int is_push) {
+	uint32_t session, size;
+	const uint8_t * name = NULL;
+	size_t namesz = 0;
+	uint32_t addr = 0;
+	if (buf[0] & 0x80) {
+		namesz = sz < 2 ? 0 : buf[1];
+		if (sz < 2 || sz < namesz + 10) {
+			luaL_error(L, "Invalid cluster message (size=%d)", sz);
+		}
+		name = buf + 2;
+		session = unpack_uint32(buf + namesz + 2);
+		size = unpack_uint32(buf + namesz + 6);
+	} else {
+		if (sz != 13) {
+			luaL_error(L, "Invalid cluster message size %d (multi req must be 13)", sz);
+		}
+		addr = unpack_uint32(buf+1);
+		session = unpack_uint32(buf+5);
+		size = unpack_uint32(buf+9);
+	}
+	struct partial * p = partial_find(&d->set, session, 1);
+	if (p) {
+		// the same session again, drop the old one
+		partial_free(p);
+	}
+	p = partial_new(&d->set, session, size);
+	p->addr = addr;
+	p->is_push = is_push;
+	if (name) {
+		p->name = copy_string(name, namesz);
+		p->namesz = namesz;
+	}
+	p->tag = d->tag;
+	p->tagsz = d->tagsz;
+	d->tag = NULL;
+}
+
+static void
+push_tag(lua_State *L, const char *tag, size_t sz) {
+	if (tag) {
+		lua_pushlstring(L, tag, sz);
+	} else {
+		lua_pushnil(L);
+	}
+}
+
+// the end of a large request
+static int
+request_end(lua_State *L, struct request_decoder *d, uint32_t session) {
+	struct partial * p = partial_find(&d->set, session, 1);
+	if (p == NULL) {
+		lua_pushboolean(L, 0);	// no address
+		lua_pushinteger(L, session);
+		return 2;	// msg is nil, invalid
+	}
+	if (p->name) {
+		lua_pushlstring(L, p->name, p->namesz);
+	} else {
+		lua_pushinteger(L, p->addr);
+	}
+	lua_pushinteger(L, session);
+	if (!p->invalid && p->offset == p->size) {
+		// the buffer will send to other service, See clusteragent.lua
+		lua_pushlightuserdata(L, p->buffer);
+		lua_pushinteger(L, p->size);
+		p->buffer = NULL;
+	} else {
+		lua_pushnil(L);
+		lua_pushnil(L);
+	}
+	lua_pushboolean(L, p->is_push);
+	push_tag(L, p->tag, p->tagsz);
+	partial_free(p);
+	return 6;
+}
+
+/*
+	upvalue decoder
+	lightuserdata msg / string
+	int sz
+	return (nothing for trace and the parts of large request)
+		true, table (the pushes of batch, see unpack_batch)
+		or uint32_t or string addr
+		int session
+		lightuserdata msg (nil if the large request is invalid)
+		int sz
+		boolean is_push
+		string tracetag
+ */
+static int
+lrequest_decode(lua_State *L) {
+	struct request_decoder *d = (struct request_decoder *)lua_touserdata(L, lua_upvalueindex(1));
+	int sz;
+	const uint8_t *buf;
+	if (lua_type(L, 1) == LUA_TLIGHTUSERDATA) {
+		buf = (const uint8_t *)lua_touserdata(L, 1);
+		sz = luaL_checkinteger(L, 2);
+	} else {
+		size_t ssz;
+		buf = (const uint8_t *)luaL_checklstring(L, 1, &ssz);
+		sz = (int)ssz;
+	}
+	if (sz == 0)
+		return luaL_error(L, "Invalid req package. size == 0");
+	int n;
+	switch (buf[0]) {
+	case 0:
+		n = unpackreq_number(L, buf, sz);
+		break;
+	case 0x80:
+		n = unpackreq_string(L, buf, sz);
+		break;
+	case 1:
+	case 0x81:
+		request_begin(L, d, buf, sz, 0);
+		return 0;
+	case 0x41:
+	case 0xc1:
+		request_begin(L, d, buf, sz, 1);
+		return 0;
+	case 2:
+	case 3: {
+		if (sz < 5) {
+			return luaL_error(L, "Invalid cluster multi part message");
+		}
+		uint32_t session = unpack_uint32(buf+1);
+		struct partial * p = partial_find(&d->set, session, 0);
+		if (p) {
+			partial_append(p, buf+5, sz-5);
+		}
+		if (buf[0] == 3) {
+			// the last part
+			return request_end(L, d, session);
+		}
+		return 0;
+	}
+	case 4:
+		skynet_free(d->tag);
+		d->tagsz = sz - 1;
+		d->tag = copy_string(buf+1, d->tagsz);
+		return 0;
+	case 5:
+		// pushes don't trace
+		skynet_free(d->tag);
+		d->tag = NULL;
+		lua_pushboolean(L, 1);
+		unpack_batch(L, buf+1, sz-1);
+		return 2;
+	default:
+		return luaL_error(L, "Invalid req package type %d", buf[0]);
+	}
+	if (d->tag == NULL) {
+		// addr, session, msg, sz [, is_push]
+		if (n == 4)
+			return 4;
+		lua_remove(L, -2);	// padding
+		return 5;
+	}
+	if (n == 4) {
+		lua_pushboolean(L, 0);	// not push
+	} else {
+		lua_remove(L, -2);	// padding
+	}
+	push_tag(L, d->tag, d->tagsz);
+	skynet_free(d->tag);
+	d->tag = NULL;
+	return 6;
+}
+
+static int
+lrequest_release(lua_State *L) {
+	struct request_decoder *d = (struct request_decoder *)luaL_checkudata(L, 1, REQUEST_DECODER);
+	skynet_free(d->tag);
+	d->tag = NULL;
+	partial_clear(&d->set);
+	return 0;
+}
+
+static int
+lrequestdecoder(lua_State *L) {
+	struct request_decoder *d = (struct request_decoder *)lua_newuserdatauv(L, sizeof(*d), 0);
+	memset(d, 0, sizeof(*d));
+	if (luaL_newmetatable(L, REQUEST_DECODER)) {
+		lua_pushcfunction(L, lrequest_release);
+		lua_setfield(L, -2, "__gc");
+	}
+	lua_setmetatable(L, -2);
+	lua_pushcclosure(L, lrequest_decode, 1);
+	return 1;
+}
+
+struct response_decoder {
+	struct packet_header header;	// "ext", the large response may be in one package
+	char * data;	// the bytes from socket, [head, tail) is not decoded
+	size_t cap;
+	size_t head;
+	size_t tail;
+	struct partial_set set;
+};
+
+static void
+stream_append(struct response_decoder *d, const char *data, size_t sz) {
+	if (d->head == d->tail) {
+		d->head = d->tail = 0;
+	}
+	if (d->cap - d->tail < sz) {
+		size_t n = d->tail - d->head;
+		if (d->head > 0) {
+			memmove(d->data, d->data + d->head, n);
+			d->head = 0;
+			d->tail = n;
+		}
+		if (d->cap - n < sz) {
+			size_t cap = d->cap ? d->cap : 0x1000;
+			while (cap - n < sz) {
+				cap *= 2;
+			}
+			d->data = skynet_realloc(d->data, cap);
+			d->cap = cap;
+		}
+	}
+	memcpy(d->data + d->tail, data, sz);
+	d->tail += sz;
+}
+
+// return the number of values pushed for a complete response, or 0
+static int
+response_frame(lua_State *L, struct response_decoder *d, const char *buf, size_t sz) {
+	if (sz < 5) {
+		return luaL_error(L, "Invalid cluster response (size=%d)", (int)sz);
+	}
+	uint32_t session = unpack_uint32((const uint8_t *)buf);
+	struct partial * p;
+	switch(buf[4]) {
+	case 0:	// error
+		lua_pushinteger(L, (lua_Integer)session);
+		lua_pushboolean(L, 0);
+		lua_pushlstring(L, buf+5, sz-5);
+		return 3;
+	case 1:	// ok
+		lua_pushinteger(L, (lua_Integer)session);
+		lua_pushboolean(L, 1);
+		lua_pushlstring(L, buf+5, sz-5);
+		return 3;
+	case 2:	// multi begin
+		if (sz != 9) {
+			return luaL_error(L, "Invalid cluster response (size=%d)", (int)sz);
+		}
+		p = partial_find(&d->set, session, 1);
+		if (p) {
+			partial_free(p);
+		}
+		partial_new(&d->set, session, unpack_uint32((const uint8_t *)buf+5));
+		return 0;
+	case 3:	// multi part
+		p = partial_find(&d->set, session, 0);
+		if (p) {
+			partial_append(p, buf+5, sz-5);
+		}
+		return 0;
+	case 4:	// multi end
+		p = partial_find(&d->set, session, 1);
+		lua_pushinteger(L, (lua_Integer)session);
+		if (p == NULL) {
+			lua_pushboolean(L, 1);
+			lua_pushlstring(L, buf+5, sz-5);
+			return 3;
+		}
+		partial_append(p, buf+5, sz-5);
+		if (!p->invalid && p->offset == p->size) {
+			lua_pushboolean(L, 1);
+			lua_pushlstring(L, p->buffer, p->size);
+		} else {
+			lua_pushboolean(L, 0);
+			lua_pushliteral(L, "Invalid large response");
+		}
+		partial_free(p);
+		return 3;
+	default:
+		return luaL_error(L, "Invalid cluster response type %d", buf[4]);
+	}
+}
+
+/*
+	upvalue decoder
+	string data (optional), the bytes read from socket
+	return nil and the size of bytes needed, if there is no complete response
+		or integer session
+		boolean ok
+		string msg
+ */
+static int
+lresponse_decode(lua_State *L) {
+	struct response_decoder *d = (struct response_decoder *)lua_touserdata(L, lua_upvalueindex(1));
+	if (!lua_isnoneornil(L, 1)) {
+		size_t sz;
+		const char * data = luaL_checklstring(L, 1, &sz);
+		stream_append(d, data, sz);
+	}
+	for (;;) {
+		const uint8_t * p = (const uint8_t *)d->data + d->head;
+		int n = (int)(d->tail - d->head);
+		int sz;
+		int hsz = packet_header_read(&d->header, p, n, &sz);
+		if (hsz < 0) {
+			return luaL_error(L, "Invalid cluster response size");
+		}
+		lua_pushnil(L);
+		if (hsz == 0) {
+			// the bytes needed for the length field, 2 or 6
+			lua_pushinteger(L, (n < 2 || (p[0] | p[1])) ? 2 - n : 6 - n);
+			return 2;
+		}
+		if (n - hsz < sz) {
+			// the bytes needed for the next package
+			lua_pushinteger(L, sz - (n - hsz));
+			return 2;
+		}
+		lua_pop(L, 1);
+		d->head += hsz + sz;
+		int r = response_frame(L, d, (const char *)p + hsz, sz);
+		if (r)
+			return r;
+	}
+}
+
+static int
+lresponse_release(lua_State *L) {
+	struct response_decoder *d = (struct response_decoder *)luaL_checkudata(L, 1, RESPONSE_DECODER);
+	skynet_free(d->data);
+	d->data = NULL;
+	d->cap = d->head = d->tail = 0;
+	partial_clear(&d->set);
+	return 0;
+}
+
+static int
+lresponsedecoder(lua_State *L) {
+	struct response_decoder *d = (struct response_decoder *)lua_newuserdatauv(L, sizeof(*d), 0);
+	memset(d, 0, sizeof(*d));
+	packet_header_init(&d->header, "ext");
+	if (luaL_newmetatable(L, RESPONSE_DECODER)) {
+		lua_pushcfunction(L, lresponse_release);
+		lua_setfield(L, -2, "__gc");
+	}
+	lua_setmetatable(L, -2);
+	lua_pushcclosure(L, lresponse_decode, 1);
+	return 1;
+}
+
 /*
 	table
 	pointer
@@ -621,9 +1234,13 @@ luaopen_skynet_cluster_core(lua_State *L) {
 		{ "packrequest", lpackrequest },
 		{ "packpush", lpackpush },
 		{ "packtrace", lpacktrace },
+		{ "packbatch", lpackbatch },
+		{ "unpackbatch", lunpackbatch },
 		{ "unpackrequest", lunpackrequest },
 		{ "packresponse", lpackresponse },
 		{ "unpackresponse", lunpackresponse },
+		{ "requestdecoder", lrequestdecoder },
+		{ "responsedecoder", lresponsedecoder },
 		{ "append", lappend },
 		{ "concat", lconcat },
 		{ "isname", lisname },
@@ -14,6 +14,7 @@
 #define PADDING_MODE_COUNT 2
 
 #define SMALL_CHUNK 256
+#define XOR_BLOCK 256
 
 /* the eight DES S-boxes */
 
@@ -550,6 +551,345 @@ lhashkey(lua_State *L) {
 	return 1;
 }
 
+/*
+	SIMD kernels for hexencode/hexdecode, base64encode/base64decode and xor_str.
+
+	The kernels process the bulk of the text and return the bytes they consumed, the scalar code does the rest
+	(and reports the errors). NULL kernel means no SIMD version. SSE2 is the baseline of x86_64, AVX2 is detected at runtime.
+	SSE2 has no byte shuffle, so base64 only has the AVX2 kernel.
+ */
+
+#define SIMD_NONE 0
+#define SIMD_SSE2 1
+#define SIMD_AVX2 2
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_X86
+#include <immintrin.h>
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+typedef size_t (*hexencode_kernel)(char *dst, const uint8_t *src, size_t sz);
+typedef size_t (*hexdecode_kernel)(uint8_t *dst, const char *src, size_t sz);
+typedef size_t (*b64encode_kernel)(char *dst, const uint8_t *src, size_t sz);
+typedef size_t (*b64decode_kernel)(uint8_t *dst, const uint8_t *src, size_t sz);
+typedef void (*xor_kernel)(char *dst, const char *a, const char *b, size_t sz);
+
+static void
+xor_scalar(char *dst, const char *a, const char *b, size_t sz) {
+	size_t i = 0;
+	for (; i + 8 <= sz; i += 8) {
+		uint64_t x, y;
+		memcpy(&x, a + i, 8);
+		memcpy(&y, b + i, 8);
+		x ^= y;
+		memcpy(dst + i, &x, 8);
+	}
+	for (; i < sz; i++) {
+		dst[i] = a[i] ^ b[i];
+	}
+}
+
+#if defined(SIMD_X86) && defined(__SSE2__)
+
+static inline __m128i
+sse2_hexchar(__m128i n) {
+	__m128i alpha = _mm_cmpgt_epi8(n, _mm_set1_epi8(9));
+	n = _mm_add_epi8(n, _mm_set1_epi8('0'));
+	return _mm_add_epi8(n, _mm_and_si128(alpha, _mm_set1_epi8('a' - '0' - 10)));
+}
+
+static size_t
+sse2_hexencode(char *dst, const uint8_t *src, size_t sz) {
+	const __m128i mask = _mm_set1_epi8(0x0f);
+	size_t i;
+	for (i = 0; i + 16 <= sz; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i hi = sse2_hexchar(_mm_and_si128(_mm_srli_epi16(x, 4), mask));
+		__m128i lo = sse2_hexchar(_mm_and_si128(x, mask));
+		_mm_storeu_si128((__m128i *)(dst + i * 2), _mm_unpacklo_epi8(hi, lo));
+		_mm_storeu_si128((__m128i *)(dst + i * 2 + 16), _mm_unpackhi_epi8(hi, lo));
+	}
+	return i;
+}
+
+// 16 hex chars to 8 bytes (in 16bit lanes), *valid is the mask of valid chars
+static inline __m128i
+sse2_hexvalue(__m128i c, __m128i *valid) {
+	__m128i digit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), c));
+	__m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('a' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('f' + 1), c));
+	__m128i v = _mm_or_si128(
+		_mm_and_si128(digit, _mm_sub_epi8(c, _mm_set1_epi8('0'))),
+		_mm_and_si128(alpha, _mm_sub_epi8(c, _mm_set1_epi8('a' - 10))));
+	*valid = _mm_or_si128(digit, alpha);
+	// the first char of a pair is the high nibble
+	return _mm_or_si128(_mm_slli_epi16(_mm_and_si128(v, _mm_set1_epi16(0xff)), 4), _mm_srli_epi16(v, 8));
+}
+
+static size_t
+sse2_hexdecode(uint8_t *dst, const char *src, size_t sz) {
+	size_t i;
+	for (i = 0; i + 32 <= sz; i += 32) {
+		__m128i v0, v1;
+		__m128i w0 = sse2_hexvalue(_mm_loadu_si128((const __m128i *)(src + i)), &v0);
+		__m128i w1 = sse2_hexvalue(_mm_loadu_si128((const __m128i *)(src + i + 16)), &v1);
+		if (_mm_movemask_epi8(_mm_and_si128(v0, v1)) != 0xffff)
+			break;
+		_mm_storeu_si128((__m128i *)(dst + i / 2), _mm_packus_epi16(w0, w1));
+	}
+	return i;
+}
+
+static void
+sse2_xor(char *dst, const char *a, const char *b, size_t sz) {
+	size_t i;
+	for (i = 0; i + 16 <= sz; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+		__m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(x, y));
+	}
+	xor_scalar(dst + i, a + i, b + i, sz - i);
+}
+
+#endif
+
+#if defined(SIMD_X86)
+
+TARGET_AVX2 static inline __m256i
+avx2_hexchar(__m256i n) {
+	__m256i alpha = _mm256_cmpgt_epi8(n, _mm256_set1_epi8(9));
+	n = _mm256_add_epi8(n, _mm256_set1_epi8('0'));
+	return _mm256_add_epi8(n, _mm256_and_si256(alpha, _mm256_set1_epi8('a' - '0' - 10)));
+}
+
+TARGET_AVX2 static size_t
+avx2_hexencode(char *dst, const uint8_t *src, size_t sz) {
+	const __m256i mask = _mm256_set1_epi8(0x0f);
+	size_t i;
+	for (i = 0; i + 32 <= sz; i += 32) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)(src + i));
+		__m256i hi = avx2_hexchar(_mm256_and_si256(_mm256_srli_epi16(x, 4), mask));
+		__m256i lo = avx2_hexchar(_mm256_and_si256(x, mask));
+		// unpack works in 128bit lanes
+		__m256i a = _mm256_unpacklo_epi8(hi, lo);
+		__m256i b = _mm256_unpackhi_epi8(hi, lo);
+		_mm256_storeu_si256((__m256i *)(dst + i * 2), _mm256_permute2x128_si256(a, b, 0x20));
+		_mm256_storeu_si256((__m256i *)(dst + i * 2 + 32), _mm256_permute2x128_si256(a, b, 0x31));
+	}
+	return i;
+}
+
+TARGET_AVX2 static inline __m256i
+avx2_hexvalue(__m256i c, __m256i *valid) {
+	__m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), c));
+	__m256i alpha = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('a' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('f' + 1), c));
+	__m256i v = _mm256_or_si256(
+		_mm256_and_si256(digit, _mm256_sub_epi8(c, _mm256_set1_epi8('0'))),
+		_mm256_and_si256(alpha, _mm256_sub_epi8(c, _mm256_set1_epi8('a' - 10))));
+	*valid = _mm256_or_si256(digit, alpha);
+	return _mm256_or_si256(_mm256_slli_epi16(_mm256_and_si256(v, _mm256_set1_epi16(0xff)), 4), _mm256_srli_epi16(v, 8));
+}
+
+TARGET_AVX2 static size_t
+avx2_hexdecode(uint8_t *dst, const char *src, size_t sz) {
+	size_t i;
+	for (i = 0; i + 64 <= sz; i += 64) {
+		__m256i v0, v1;
+		__m256i w0 = avx2_hexvalue(_mm256_loadu_si256((const __m256i *)(src + i)), &v0);
+		__m256i w1 = avx2_hexvalue(_mm256_loadu_si256((const __m256i *)(src + i + 32)), &v1);
+		if (_mm256_movemask_epi8(_mm256_and_si256(v0, v1)) != -1)
+			break;
+		// pack works in 128bit lanes
+		__m256i r = _mm256_permute4x64_epi64(_mm256_packus_epi16(w0, w1), 0xd8);
+		_mm256_storeu_si256((__m256i *)(dst + i / 2), r);
+	}
+	return i;
+}
+
+/*
+	base64 with AVX2, see Wojciech Muła and Daniel Lemire, "Faster Base64 Encoding and Decoding Using AVX2 Instructions"
+ */
+
+TARGET_AVX2 static size_t
+avx2_b64encode(char *dst, const uint8_t *src, size_t sz) {
+	const __m256i shuf = _mm256_setr_epi8(
+		1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+		1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+	const __m256i shift_lut = _mm256_setr_epi8(
+		'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		'0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+		'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		'0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+	size_t i;
+	char * out = dst;
+	// 24 bytes per round, 12 bytes in each lane ; each lane loads 16 bytes
+	for (i = 0; i + 28 <= sz; i += 24) {
+		__m256i in = _mm256_inserti128_si256(
+			_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(src + i))),
+			_mm_loadu_si128((const __m128i *)(src + i + 12)), 1);
+		in = _mm256_shuffle_epi8(in, shuf);
+		// split 3 bytes into 4 6-bit indices
+		__m256i t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+		__m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+		__m256i t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+		__m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+		__m256i indices = _mm256_or_si256(t1, t3);
+		// indices to ascii
+		__m256i r = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+		__m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+		r = _mm256_or_si256(r, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+		r = _mm256_add_epi8(_mm256_shuffle_epi8(shift_lut, r), indices);
+		_mm256_storeu_si256((__m256i *)out, r);
+		out += 32;
+	}
+	return i;
+}
+
+// only the base64 alphabet (without '=') ; returns at the first block with other chars, the scalar code handles it.
+TARGET_AVX2 static size_t
+avx2_b64decode(uint8_t *dst, const uint8_t *src, size_t sz) {
+	const __m256i lut_lo = _mm256_setr_epi8(
+		0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+		0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+	const __m256i lut_hi = _mm256_setr_epi8(
+		0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+		0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+	const __m256i lut_roll = _mm256_setr_epi8(
+		0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+		0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m256i pack_shuf = _mm256_setr_epi8(
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+	const __m256i mask = _mm256_set1_epi8(0x0f);
+	size_t i;
+	uint8_t * out = dst;
+	// 32 chars to 24 bytes per round, the store writes 32 bytes, so keep 8 bytes in the output buffer
+	for (i = 0; i + 48 <= sz; i += 32) {
+		__m256i in = _mm256_loadu_si256((const __m256i *)(src + i));
+		__m256i hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(in, 4), mask);
+		__m256i lo_nibbles = _mm256_and_si256(in, mask);
+		__m256i lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+		__m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+		if (!_mm256_testz_si256(lo, hi))
+			break;
+		__m256i eq_2f = _mm256_cmpeq_epi8(in, _mm256_set1_epi8(0x2f));
+		__m256i roll = _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(eq_2f, hi_nibbles));
+		__m256i v = _mm256_add_epi8(in, roll);
+		// merge 4 6-bit values into 3 bytes
+		v = _mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140));
+		v = _mm256_madd_epi16(v, _mm256_set1_epi32(0x00011000));
+		v = _mm256_shuffle_epi8(v, pack_shuf);
+		v = _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, -1, -1));
+		_mm256_storeu_si256((__m256i *)out, v);
+		out += 24;
+	}
+	return i;
+}
+
+TARGET_AVX2 static void
+avx2_xor(char *dst, const char *a, const char *b, size_t sz) {
+	size_t i;
+	for (i = 0; i + 32 <= sz; i += 32) {
+		__m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+		__m256i y = _mm256_loadu_si256((const __m256i *)(b + i));
+		_mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(x, y));
+	}
+	// the compiler doesn't clear the upper state before the tail call, and the SSE code after it would be slow
+	_mm256_zeroupper();
+	xor_scalar(dst + i, a + i, b + i, sz - i);
+}
+
+#endif
+
+struct simd_kernels {
+	hexencode_kernel hexencode;
+	hexdecode_kernel hexdecode;
+	b64encode_kernel b64encode;
+	b64decode_kernel b64decode;
+	xor_kernel xor;
+};
+
+// indexed by level, read only
+static const struct simd_kernels SIMD_KERNELS[] = {
+	{ NULL, NULL, NULL, NULL, xor_scalar },
+#if defined(SIMD_X86) && defined(__SSE2__)
+	{ sse2_hexencode, sse2_hexdecode, NULL, NULL, sse2_xor },
+#else
+	{ NULL, NULL, NULL, NULL, xor_scalar },
+#endif
+#if defined(SIMD_X86)
+	{ avx2_hexencode, avx2_hexdecode, avx2_b64encode, avx2_b64decode, avx2_xor },
+#else
+	{ NULL, NULL, NULL, NULL, xor_scalar },
+#endif
+};
+
+// the best level the cpu supports, set once when the module is loaded
+static int SIMD_LEVEL = SIMD_NONE;
+
+static int
+simd_supported(void) {
+#if defined(SIMD_X86)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return SIMD_AVX2;
+#endif
+#if defined(SIMD_X86) && defined(__SSE2__)
+	return SIMD_SSE2;
+#else
+	return SIMD_NONE;
+#endif
+}
+
+// the functions using the kernels keep the level in upvalue 1
+static inline const struct simd_kernels *
+simd_kernels(lua_State *L) {
+	return &SIMD_KERNELS[lua_tointeger(L, lua_upvalueindex(1))];
+}
+
+static const char * SIMD_NAME[] = { "none", "sse2", "avx2" };
+
+static int ltohex(lua_State *L);
+static int lfromhex(lua_State *L);
+static int lb64encode(lua_State *L);
+static int lb64decode(lua_State *L);
+static int lxor_str(lua_State *L);
+
+// set the functions using the kernels of level into the table on the top
+static void
+simd_setfuncs(lua_State *L, int level) {
+	luaL_Reg l[] = {
+		{ "hexencode", ltohex },
+		{ "hexdecode", lfromhex },
+		{ "base64encode", lb64encode },
+		{ "base64decode", lb64decode },
+		{ "xor_str", lxor_str },
+		{ NULL, NULL },
+	};
+	lua_pushinteger(L, level);
+	luaL_setfuncs(L, l, 1);
+}
+
+/*
+	string level (optional) : "none", "sse2" or "avx2", it can't be higher than the cpu supports
+	return the level, and a table of hexencode/hexdecode/base64encode/base64decode/xor_str using it if level is given.
+	The functions of the module always use the best level.
+ */
+static int
+lsimd(lua_State *L) {
+	if (lua_isnoneornil(L, 1)) {
+		lua_pushstring(L, SIMD_NAME[SIMD_LEVEL]);
+		return 1;
+	}
+	int level = luaL_checkoption(L, 1, NULL, SIMD_NAME);
+	if (level > SIMD_LEVEL)
+		level = SIMD_LEVEL;
+	lua_pushstring(L, SIMD_NAME[level]);
+	lua_createtable(L, 0, 5);
+	simd_setfuncs(L, level);
+	return 2;
+}
+
 static int
 ltohex(lua_State *L) {
 	static char hex[] = "0123456789abcdef";
@@ -560,8 +900,9 @@ ltohex(lua_State *L) {
 	if (sz > SMALL_CHUNK/2) {
 		buffer = (char*)lua_newuserdatauv(L, sz * 2, 0);
 	}
-	int i;
-	for (i=0;i<sz;i++) {
+	hexencode_kernel kernel = simd_kernels(L)->hexencode;
+	int i = kernel ? (int)kernel(buffer, text, sz) : 0;
+	for (;i<sz;i++) {
 		buffer[i*2] = hex[text[i] >> 4];
 		buffer[i*2+1] = hex[text[i] & 0xf];
 	}
@@ -583,12 +924,13 @@ lfromhex(lua_State *L) {
 	if (sz > SMALL_CHUNK*2) {
 		buffer = (char*)lua_newuserdatauv(L, sz / 2, 0);
 	}
-	int i;
-	for (i=0;i<sz;i+=2) {
+	hexdecode_kernel kernel = simd_kernels(L)->hexdecode;
+	int i = kernel ? (int)kernel((uint8_t *)buffer, text, sz) : 0;
+	for (;i<sz;i+=2) {
 		uint8_t hi,low;
 		HEX(hi, text[i]);
 		HEX(low, text[i+1]);
-		if (hi > 16 || low > 16) {
+		if (hi > 15 || low > 15) {
 			return luaL_error(L, "Invalid hex text", text);
 		}
 		buffer[i/2] = hi<<4 | low;
@@ -901,8 +1243,10 @@ lb64encode(lua_State *L) {
 		buffer = (char*)lua_newuserdatauv(L, encode_sz, 0);
 	}
 	int i,j;
-	j=0;
-	for (i=0;i<(int)sz-2;i+=3) {
+	b64encode_kernel kernel = simd_kernels(L)->b64encode;
+	i = kernel ? (int)kernel(buffer, text, sz) : 0;
+	j = i / 3 * 4;
+	for (;i<(int)sz-2;i+=3) {
 		uint32_t v = text[i] << 16 | text[i+1] << 8 | text[i+2];
 		buffer[j] = encoding[v >> 18];
 		buffer[j+1] = encoding[(v >> 12) & 0x3f];
@@ -956,8 +1300,10 @@ lb64decode(lua_State *L) {
 		buffer = (char*)lua_newuserdatauv(L, decode_sz, 0);
 	}
 	int i,j;
-	int output = 0;
-	for (i=0;i<sz;) {
+	b64decode_kernel kernel = simd_kernels(L)->b64decode;
+	i = kernel ? (int)kernel((uint8_t *)buffer, text, sz) : 0;
+	int output = i / 4 * 3;
+	for (;i<sz;) {
 		int padding = 0;
 		int c[4];
 		for (j=0;j<4;) {
@@ -1021,9 +1367,23 @@ lxor_str(lua_State *L) {
 	}
 	luaL_Buffer b;
 	char * buffer = luaL_buffinitsize(L, &b, len1);
-	int i;
-	for (i=0;i<len1;i++) {
-		buffer[i] = s1[i] ^ s2[i % len2];
+	// repeat the short key to XOR_BLOCK bytes at least, and xor s1 block by block
+	char tmp[XOR_BLOCK * 2];
+	const char * key = s2;
+	size_t keysz = len2;
+	if (len2 < XOR_BLOCK && len1 > len2) {
+		keysz = 0;
+		while (keysz < XOR_BLOCK) {
+			memcpy(tmp + keysz, s2, len2);
+			keysz += len2;
+		}
+		key = tmp;
+	}
+	xor_kernel xor = simd_kernels(L)->xor;
+	size_t i;
+	for (i=0;i<len1;i+=keysz) {
+		size_t n = len1 - i < keysz ? len1 - i : keysz;
+		xor(buffer + i, s1 + i, key, n);
 	}
 	luaL_addsize(&b, len1);
 	luaL_pushresult(&b);
@@ -1043,28 +1403,26 @@ luaopen_skynet_crypt(lua_State *L) {
 		// Don't need call srandom more than once.
 		init = 1 ;
 		srandom((random() << 8) ^ (time(NULL) << 16) ^ getpid());
+		SIMD_LEVEL = simd_supported();
 	}
 	luaL_Reg l[] = {
 		{ "hashkey", lhashkey },
 		{ "randomkey", lrandomkey },
 		{ "desencode", ldesencode },
 		{ "desdecode", ldesdecode },
-		{ "hexencode", ltohex },
-		{ "hexdecode", lfromhex },
 		{ "hmac64", lhmac64 },
 		{ "hmac64_md5", lhmac64_md5 },
 		{ "dhexchange", ldhexchange },
 		{ "dhsecret", ldhsecret },
-		{ "base64encode", lb64encode },
-		{ "base64decode", lb64decode },
 		{ "sha1", lsha1 },
 		{ "hmac_sha1", lhmac_sha1 },
 		{ "hmac_hash", lhmac_hash },
-		{ "xor_str", lxor_str },
+		{ "simd", lsimd },
 		{ "padding", NULL },
 		{ NULL, NULL },
 	};
 	luaL_newlib(L,l);
+	simd_setfuncs(L, SIMD_LEVEL);
 
 	padding_mode_table(L);
 	lua_setfield(L, -2, "padding");
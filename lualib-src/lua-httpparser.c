@@ -0,0 +1,358 @@
+#define LUA_LIB
+
+#include <lua.h>
+#include <lauxlib.h>
+
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+
+/*
+	HTTP/1.1 message head parser for lualib/http/internal.lua
+
+	It parses the head in the receive buffer (a lua string) in place, the header lines are never split
+	into lua strings, only the field names (lower case) and values are pushed into the header table.
+
+	All the functions return nil when the buffer is not complete, and false when the message is invalid.
+ */
+
+#define MAX_CHUNKSIZE_LINE 128
+
+// find "\r\n\r\n" from p, return the pointer after it
+static const char *
+find_head_end(const char *p, const char *end) {
+	while (end - p >= 4) {
+		const char * cr = memchr(p, '\r', end - p - 3);
+		if (cr == NULL)
+			return NULL;
+		if (cr[1] == '\n' && cr[2] == '\r' && cr[3] == '\n')
+			return cr + 4;
+		p = cr + 1;
+	}
+	return NULL;
+}
+
+static const char *
+find_line_end(const char *p, const char *end) {
+	for (;;) {
+		const char * cr = memchr(p, '\r', end - p);
+		if (cr == NULL || cr + 1 >= end)
+			return NULL;
+		if (cr[1] == '\n')
+			return cr;
+		p = cr + 1;
+	}
+}
+
+static void
+push_lower(lua_State *L, const char *name, size_t sz) {
+	luaL_Buffer b;
+	char * dst = luaL_buffinitsize(L, &b, sz);
+	size_t i;
+	for (i=0;i<sz;i++) {
+		dst[i] = tolower((unsigned char)name[i]);
+	}
+	luaL_pushresultsize(&b, sz);
+}
+
+// header table is at index 'header', and the last name is at the top of stack ; return 0 when invalid
+static int
+append_line(lua_State *L, int header, const char *line, size_t sz) {
+	if (lua_isnil(L, -1)) {
+		return 0;
+	}
+	lua_pushvalue(L, -1);
+	if (lua_rawget(L, header) != LUA_TSTRING) {
+		lua_pop(L, 1);
+		return 0;
+	}
+	lua_pushlstring(L, line, sz);
+	lua_concat(L, 2);
+	lua_pushvalue(L, -2);
+	lua_insert(L, -2);
+	lua_rawset(L, header);
+	return 1;
+}
+
+static void
+set_field(lua_State *L, int header, const char *value, size_t sz) {
+	// name is at the top
+	lua_pushvalue(L, -1);
+	int t = lua_rawget(L, header);
+	if (t == LUA_TNIL) {
+		lua_pop(L, 1);
+		lua_pushvalue(L, -1);
+		lua_pushlstring(L, value, sz);
+		lua_rawset(L, header);
+	} else if (t == LUA_TTABLE) {
+		lua_pushlstring(L, value, sz);
+		lua_rawseti(L, -2, lua_rawlen(L, -2) + 1);
+		lua_pop(L, 1);
+	} else {
+		lua_createtable(L, 2, 0);
+		lua_insert(L, -2);
+		lua_rawseti(L, -2, 1);
+		lua_pushlstring(L, value, sz);
+		lua_rawseti(L, -2, 2);
+		lua_pushvalue(L, -2);
+		lua_insert(L, -2);
+		lua_rawset(L, header);
+	}
+}
+
+/*
+	Parse the header lines in [p, end), each line ends with \r\n.
+	The field name is case insensitive (lower case in the table), and a line begins with tab appends to the last field.
+	return 0 when invalid
+ */
+static int
+parse_fields(lua_State *L, int header, const char *p, const char *end) {
+	lua_pushnil(L);	// last name
+	while (p < end) {
+		const char * eol = find_line_end(p, end);
+		if (eol == NULL)
+			return 0;
+		if (*p == '\t') {
+			if (!append_line(L, header, p + 1, eol - p - 1))
+				return 0;
+		} else {
+			const char * colon = memchr(p, ':', eol - p);
+			if (colon == NULL || colon == p)
+				return 0;
+			const char * value = colon + 1;
+			while (value < eol && isspace((unsigned char)*value)) {
+				++value;
+			}
+			lua_pop(L, 1);
+			push_lower(L, p, colon - p);
+			set_field(L, header, value, eol - value);
+		}
+		p = eol + 2;
+	}
+	lua_pop(L, 1);
+	return 1;
+}
+
+static const char *
+check_buffer(lua_State *L, size_t *sz) {
+	const char * buffer = luaL_checklstring(L, 1, sz);
+	luaL_checktype(L, 2, LUA_TTABLE);
+	return buffer;
+}
+
+// the search of head end begins at 'from' (1-based, optional), the caller knows there is no \r\n\r\n before it
+static const char *
+head_end(lua_State *L, const char *buffer, size_t sz, int index) {
+	lua_Integer from = luaL_optinteger(L, index, 1);
+	if (from < 1)
+		from = 1;
+	if ((size_t)from > sz)
+		return NULL;
+	return find_head_end(buffer + from - 1, buffer + sz);
+}
+
+static int
+push_version(lua_State *L, const char *v, const char *end) {
+	size_t sz = end - v;
+	char tmp[16];
+	if (sz == 0 || sz >= sizeof(tmp))
+		return 0;
+	size_t i;
+	for (i=0;i<sz;i++) {
+		if (!isdigit((unsigned char)v[i]) && v[i] != '.')
+			return 0;
+	}
+	memcpy(tmp, v, sz);
+	tmp[sz] = '\0';
+	return lua_stringtonumber(L, tmp) != 0;
+}
+
+static int
+invalid(lua_State *L) {
+	lua_pushboolean(L, 0);
+	return 1;
+}
+
+/*
+	string buffer
+	table header
+	integer from (optional)
+
+	return method, url, version (number), offset of body
+ */
+static int
+lrequest(lua_State *L) {
+	size_t sz;
+	const char * buffer = check_buffer(L, &sz);
+	const char * body = head_end(L, buffer, sz, 3);
+	if (body == NULL) {
+		return 0;
+	}
+	const char * eol = find_line_end(buffer, body);
+	// METHOD SP URL SP HTTP/x.y
+	const char * p = buffer;
+	while (p < eol && isalpha((unsigned char)*p)) {
+		++p;
+	}
+	if (p == buffer || p == eol || !isspace((unsigned char)*p))
+		return invalid(L);
+	const char * method_end = p;
+	while (p < eol && isspace((unsigned char)*p)) {
+		++p;
+	}
+	const char * url = p;
+	// search the last "HTTP/"
+	const char * ver = eol;
+	while (ver > url + 5 && !(ver[-5] == 'H' && memcmp(ver-5, "HTTP/", 5) == 0)) {
+		--ver;
+	}
+	if (ver <= url + 5 || !isspace((unsigned char)ver[-6]))
+		return invalid(L);
+	const char * url_end = ver - 6;
+	while (url_end > url && isspace((unsigned char)url_end[-1])) {
+		--url_end;
+	}
+	lua_settop(L, 2);
+	lua_pushlstring(L, buffer, method_end - buffer);
+	lua_pushlstring(L, url, url_end - url);
+	if (!push_version(L, ver, eol))
+		return invalid(L);
+	if (!parse_fields(L, 2, eol + 2, body - 2))
+		return invalid(L);
+	lua_pushinteger(L, body - buffer + 1);
+	return 4;
+}
+
+/*
+	string buffer
+	table header
+	integer from (optional)
+
+	return code, info, offset of body
+ */
+static int
+lresponse(lua_State *L) {
+	size_t sz;
+	const char * buffer = check_buffer(L, &sz);
+	const char * body = head_end(L, buffer, sz, 3);
+	if (body == NULL) {
+		return 0;
+	}
+	const char * eol = find_line_end(buffer, body);
+	// HTTP/x.y SP code SP info
+	if (eol - buffer < 5 || memcmp(buffer, "HTTP/", 5) != 0)
+		return invalid(L);
+	const char * p = buffer + 5;
+	while (p < eol && (isdigit((unsigned char)*p) || *p == '.')) {
+		++p;
+	}
+	if (p == eol || !isspace((unsigned char)*p))
+		return invalid(L);
+	while (p < eol && isspace((unsigned char)*p)) {
+		++p;
+	}
+	int code = 0;
+	const char * c = p;
+	while (p < eol && isdigit((unsigned char)*p)) {
+		code = code * 10 + (*p - '0');
+		++p;
+	}
+	if (p == c || p - c > 3)
+		return invalid(L);
+	while (p < eol && isspace((unsigned char)*p)) {
+		++p;
+	}
+	lua_settop(L, 2);
+	lua_pushinteger(L, code);
+	lua_pushlstring(L, p, eol - p);
+	if (!parse_fields(L, 2, eol + 2, body - 2))
+		return invalid(L);
+	lua_pushinteger(L, body - buffer + 1);
+	return 3;
+}
+
+/*
+	string buffer
+	table header
+	integer offset (the header lines begins at offset)
+
+	return offset after the empty line
+ */
+static int
+lheader(lua_State *L) {
+	size_t sz;
+	const char * buffer = check_buffer(L, &sz);
+	lua_Integer offset = luaL_optinteger(L, 3, 1);
+	if (offset < 1 || (size_t)offset > sz + 1)
+		return luaL_error(L, "Invalid offset %d", (int)offset);
+	const char * p = buffer + offset - 1;
+	const char * end = buffer + sz;
+	const char * body;
+	if (end - p >= 2 && p[0] == '\r' && p[1] == '\n') {
+		body = p + 2;
+	} else {
+		body = find_head_end(p, end);
+		if (body == NULL)
+			return 0;
+		lua_settop(L, 2);
+		if (!parse_fields(L, 2, p, body - 2))
+			return invalid(L);
+	}
+	lua_pushinteger(L, body - buffer + 1);
+	return 1;
+}
+
+/*
+	string buffer
+	integer offset
+
+	return size of chunk, offset of chunk data
+ */
+static int
+lchunksize(lua_State *L) {
+	size_t sz;
+	const char * buffer = luaL_checklstring(L, 1, &sz);
+	lua_Integer offset = luaL_optinteger(L, 2, 1);
+	if (offset < 1 || (size_t)offset > sz + 1)
+		return luaL_error(L, "Invalid offset %d", (int)offset);
+	const char * p = buffer + offset - 1;
+	const char * end = buffer + sz;
+	const char * eol = find_line_end(p, end);
+	if (eol == NULL) {
+		if (end - p > MAX_CHUNKSIZE_LINE) {
+			// pervent the attacker send very long stream without \r\n
+			return invalid(L);
+		}
+		return 0;
+	}
+	lua_Integer size = 0;
+	const char * s = p;
+	while (s < eol && isxdigit((unsigned char)*s)) {
+		int c = tolower((unsigned char)*s);
+		size = size * 16 + (isdigit(c) ? c - '0' : c - 'a' + 10);
+		if (size > 0x7fffffff)
+			return invalid(L);
+		++s;
+	}
+	// ignore chunk extensions
+	if (s == p || (s < eol && *s != ';' && !isspace((unsigned char)*s)))
+		return invalid(L);
+	lua_pushinteger(L, size);
+	lua_pushinteger(L, eol + 2 - buffer + 1);
+	return 2;
+}
+
+LUAMOD_API int
+luaopen_skynet_httpparser(lua_State *L) {
+	luaL_checkversion(L);
+	luaL_Reg l[] = {
+		{ "request", lrequest },
+		{ "response", lresponse },
+		{ "header", lheader },
+		{ "chunksize", lchunksize },
+		{ NULL, NULL },
+	};
+	luaL_newlib(L,l);
+
+	return 1;
+}
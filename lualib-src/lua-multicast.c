@@ -137,6 +137,83 @@ mc_remote(lua_State *L) {
 	return 2;
 }
 
+static void
+release_package(struct mc_package *pack, int n) {
+	if (ATOM_FSUB(&pack->reference, n) == n) {
+		skynet_free(pack->data);
+		skynet_free(pack);
+	}
+}
+
+/*
+	lightuserdata struct mc_package **
+	integer source
+	integer channel
+	table group (the keys are the local subscribers, optional)
+	table remote (the array of multicastd in remote nodes, optional)
+
+	Publish the package to the local subscribers and the remote nodes in one call.
+	The local subscribers share the package (by reference), and each remote node gets a copy of data,
+	the last one takes the data if there is no local subscriber.
+ */
+static int
+mc_publish(lua_State *L) {
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
+	struct mc_package ** ptr = lua_touserdata(L, 1);
+	uint32_t source = (uint32_t)luaL_checkinteger(L, 2);
+	int channel = (int)luaL_checkinteger(L, 3);
+	int group = lua_istable(L, 4);
+	int remote = lua_istable(L, 5) ? (int)lua_rawlen(L, 5) : 0;
+	struct mc_package * pack = *ptr;
+	skynet_free(ptr);
+	int n = 0;
+	if (group) {
+		lua_pushnil(L);
+		while (lua_next(L, 4) != 0) {
+			lua_pop(L, 1);
+			++n;
+		}
+	}
+	int i;
+	for (i=1;i<=remote;i++) {
+		lua_rawgeti(L, 5, i);
+		uint32_t node = (uint32_t)lua_tointeger(L, -1);
+		lua_pop(L, 1);
+		void * data;
+		if (i == remote && n == 0) {
+			data = pack->data;
+			pack->data = NULL;
+		} else {
+			data = skynet_malloc(pack->size);
+			memcpy(data, pack->data, pack->size);
+		}
+		skynet_send(ctx, source, node, PTYPE_MULTICAST | PTYPE_TAG_DONTCOPY, channel, data, pack->size);
+	}
+	if (n == 0) {
+		skynet_free(pack->data);
+		skynet_free(pack);
+		return 0;
+	}
+	ATOM_STORE(&pack->reference, n);
+	int failed = 0;
+	lua_pushnil(L);
+	while (lua_next(L, 4) != 0) {
+		lua_pop(L, 1);
+		uint32_t handle = (uint32_t)lua_tointeger(L, -1);
+		// the message is a pointer to the package
+		struct mc_package ** msg = skynet_malloc(sizeof(*msg));
+		*msg = pack;
+		if (skynet_send(ctx, source, handle, PTYPE_MULTICAST | PTYPE_TAG_DONTCOPY, channel, msg, sizeof(*msg)) < 0) {
+			// the subscriber is dead
+			++failed;
+		}
+	}
+	if (failed) {
+		release_package(pack, failed);
+	}
+	return 0;
+}
+
 static int
 mc_nextid(lua_State *L) {
 	uint32_t id = (uint32_t)luaL_checkinteger(L, 1);
@@ -161,5 +238,14 @@ luaopen_skynet_multicast_core(lua_State *L) {
 	};
 	luaL_checkversion(L);
 	luaL_newlib(L,l);
+
+	lua_getfield(L, LUA_REGISTRYINDEX, "skynet_context");
+	struct skynet_context *ctx = lua_touserdata(L,-1);
+	if (ctx == NULL) {
+		return luaL_error(L, "Init skynet context first");
+	}
+	lua_pushcclosure(L, mc_publish, 1);
+	lua_setfield(L, -2, "publish");
+
 	return 1;
 }
@@ -3,6 +3,8 @@
 #include "skynet_malloc.h"
 
 #include "skynet_socket.h"
+#include "packet_header.h"
+#include "atomic.h"
 
 #include <lua.h>
 #include <lauxlib.h>
@@ -26,29 +28,68 @@
 
 /*
 	Each package is uint16 + data , uint16 (serialized in big-endian) is the number of bytes comprising the data .
+	The queue can use another length field (4 bytes, little-endian, varint, with a fixed header), see packet_header.h
+
+	A queue in slice mode doesn't copy the packages lie in one socket message, the package is a slice of
+	the socket message buffer, and the buffer is shared by a reference count. Each package is delivered
+	with its slice, call netpack.release(slice) (or netpack.tostring(msg, sz, slice)) instead of free msg.
  */
 
+struct slice {
+	ATOM_INT ref;
+	void * buffer;
+};
+
 struct netpack {
 	int id;
 	int size;
 	void * buffer;
+	struct slice * slice;
 };
 
 struct uncomplete {
 	struct netpack pack;
 	struct uncomplete * next;
-	int read;
-	int header;
+	int read;	// -1 : length field is not complete, -2 : invalid length, drop all
+	int header_sz;
+	uint8_t header[PACKET_HEADER_MAXSIZE];
 };
 
 struct queue {
 	int cap;
 	int head;
 	int tail;
+	int slice;
+	struct packet_header header;
 	struct uncomplete * hash[HASHSIZE];
 	struct netpack queue[QUEUESIZE];
 };
 
+static struct slice *
+new_slice(void * buffer) {
+	struct slice * s = skynet_malloc(sizeof(*s));
+	ATOM_INIT(&s->ref, 1);
+	s->buffer = buffer;
+	return s;
+}
+
+static inline void
+release_slice(struct slice * s) {
+	if (ATOM_FDEC(&s->ref) == 1) {
+		skynet_free(s->buffer);
+		skynet_free(s);
+	}
+}
+
+static inline void
+free_package(void * buffer, struct slice * s) {
+	if (s) {
+		release_slice(s);
+	} else {
+		skynet_free(buffer);
+	}
+}
+
 static void
 clear_list(struct uncomplete * uc) {
 	while (uc) {
@@ -75,7 +116,7 @@ lclear(lua_State *L) {
 	}
 	for (i=q->head;i<q->tail;i++) {
 		struct netpack *np = &q->queue[i % q->cap];
-		skynet_free(np->buffer);
+		free_package(np->buffer, np->slice);
 	}
 	q->head = q->tail = 0;
 
@@ -114,18 +155,26 @@ find_uncomplete(struct queue *q, int fd) {
 	return NULL;
 }
 
+static struct queue *
+new_queue(lua_State *L) {
+	struct queue *q = lua_newuserdatauv(L, sizeof(struct queue), 0);
+	q->cap = QUEUESIZE;
+	q->head = 0;
+	q->tail = 0;
+	q->slice = 0;
+	packet_header_default(&q->header);
+	int i;
+	for (i=0;i<HASHSIZE;i++) {
+		q->hash[i] = NULL;
+	}
+	return q;
+}
+
 static struct queue *
 get_queue(lua_State *L) {
 	struct queue *q = lua_touserdata(L,1);
 	if (q == NULL) {
-		q = lua_newuserdatauv(L, sizeof(struct queue), 0);
-		q->cap = QUEUESIZE;
-		q->head = 0;
-		q->tail = 0;
-		int i;
-		for (i=0;i<HASHSIZE;i++) {
-			q->hash[i] = NULL;
-		}
+		q = new_queue(L);
 		lua_replace(L, 1);
 	}
 	return q;
@@ -137,6 +186,8 @@ expand_queue(lua_State *L, struct queue *q) {
 	nq->cap = q->cap + QUEUESIZE;
 	nq->head = 0;
 	nq->tail = q->cap;
+	nq->slice = q->slice;
+	nq->header = q->header;
 	memcpy(nq->hash, q->hash, sizeof(nq->hash));
 	memset(q->hash, 0, sizeof(q->hash));
 	int i;
@@ -148,9 +199,19 @@ expand_queue(lua_State *L, struct queue *q) {
 	lua_replace(L,1);
 }
 
+/*
+	slice is the socket message buffer when the queue is in slice mode, or NULL.
+	When clone, buffer is a part of the socket message, it should be copied or sliced.
+ */
 static void
-push_data(lua_State *L, int fd, void *buffer, int size, int clone) {
-	if (clone) {
+push_data(lua_State *L, int fd, void *buffer, int size, int clone, struct slice *slice) {
+	if (slice) {
+		if (clone) {
+			ATOM_FINC(&slice->ref);
+		} else {
+			slice = new_slice(buffer);
+		}
+	} else if (clone) {
 		void * tmp = skynet_malloc(size);
 		memcpy(tmp, buffer, size);
 		buffer = tmp;
@@ -162,6 +223,7 @@ push_data(lua_State *L, int fd, void *buffer, int size, int clone) {
 	np->id = fd;
 	np->buffer = buffer;
 	np->size = size;
+	np->slice = slice;
 	if (q->head == q->tail) {
 		expand_queue(L, q);
 	}
@@ -180,38 +242,51 @@ save_uncomplete(lua_State *L, int fd) {
 	return uc;
 }
 
-static inline int
-read_size(uint8_t * buffer) {
-	int r = (int)buffer[0] << 8 | (int)buffer[1];
-	return r;
+static void
+save_header(lua_State *L, int fd, uint8_t *buffer, int size) {
+	struct uncomplete * uc = save_uncomplete(L, fd);
+	uc->read = -1;
+	uc->header_sz = size;
+	memcpy(uc->header, buffer, size);
 }
 
 static void
-push_more(lua_State *L, int fd, uint8_t *buffer, int size) {
-	if (size == 1) {
-		struct uncomplete * uc = save_uncomplete(L, fd);
-		uc->read = -1;
-		uc->header = *buffer;
-		return;
-	}
-	int pack_size = read_size(buffer);
-	buffer += 2;
-	size -= 2;
-
-	if (size < pack_size) {
-		struct uncomplete * uc = save_uncomplete(L, fd);
-		uc->read = size;
-		uc->pack.size = pack_size;
-		uc->pack.buffer = skynet_malloc(pack_size);
-		memcpy(uc->pack.buffer, buffer, size);
-		return;
-	}
-	push_data(L, fd, buffer, pack_size, 1);
+save_pack(lua_State *L, int fd, uint8_t *buffer, int size, int pack_size) {
+	struct uncomplete * uc = save_uncomplete(L, fd);
+	uc->read = size;
+	uc->pack.size = pack_size;
+	uc->pack.buffer = skynet_malloc(pack_size);
+	memcpy(uc->pack.buffer, buffer, size);
+}
 
-	buffer += pack_size;
-	size -= pack_size;
-	if (size > 0) {
-		push_more(L, fd, buffer, size);
+// return 0 when succ, -1 when the length field is invalid
+static int
+push_more(lua_State *L, const struct packet_header *h, int fd, uint8_t *buffer, int size, struct slice *slice) {
+	for (;;) {
+		int pack_size;
+		int n = packet_header_read(h, buffer, size, &pack_size);
+		if (n <= 0) {
+			if (n == 0) {
+				save_header(L, fd, buffer, size);
+				return 0;
+			}
+			struct uncomplete * uc = save_uncomplete(L, fd);
+			uc->read = -2;
+			return -1;
+		}
+		buffer += n;
+		size -= n;
+
+		if (size < pack_size) {
+			save_pack(L, fd, buffer, size, pack_size);
+			return 0;
+		}
+		push_data(L, fd, buffer, pack_size, 1, slice);
+
+		buffer += pack_size;
+		size -= pack_size;
+		if (size == 0)
+			return 0;
 	}
 }
 
@@ -226,18 +301,69 @@ close_uncomplete(lua_State *L, int fd) {
 }
 
 static int
-filter_data_(lua_State *L, int fd, uint8_t * buffer, int size) {
+invalid_header(lua_State *L, int fd) {
+	lua_pushvalue(L, lua_upvalueindex(TYPE_ERROR));
+	lua_pushinteger(L, fd);
+	lua_pushliteral(L, "Invalid package size");
+	return 4;
+}
+
+static int
+push_package(lua_State *L, int fd, void *buffer, int size, struct slice *slice) {
+	lua_pushvalue(L, lua_upvalueindex(TYPE_DATA));
+	lua_pushinteger(L, fd);
+	lua_pushlightuserdata(L, buffer);
+	lua_pushinteger(L, size);
+	if (slice) {
+		lua_pushlightuserdata(L, slice);
+		return 6;
+	}
+	return 5;
+}
+
+static int
+filter_data_(lua_State *L, int fd, uint8_t * buffer, int size, struct slice *slice) {
 	struct queue *q = lua_touserdata(L,1);
+	struct packet_header h;
+	if (q) {
+		h = q->header;
+	} else {
+		packet_header_default(&h);
+	}
 	struct uncomplete * uc = find_uncomplete(q, fd);
 	if (uc) {
 		// fill uncomplete
 		if (uc->read < 0) {
+			if (uc->read == -2) {
+				// drop all the data after an invalid length field
+				int hash = hash_fd(fd);
+				uc->next = q->hash[hash];
+				q->hash[hash] = uc;
+				return 1;
+			}
 			// read size
 			assert(uc->read == -1);
-			int pack_size = *buffer;
-			pack_size |= uc->header << 8 ;
-			++buffer;
-			--size;
+			uint8_t header[PACKET_HEADER_MAXSIZE];
+			int hsz = uc->header_sz;
+			int n = size < PACKET_HEADER_MAXSIZE - hsz ? size : PACKET_HEADER_MAXSIZE - hsz;
+			memcpy(header, uc->header, hsz);
+			memcpy(header + hsz, buffer, n);
+			int pack_size;
+			int r = packet_header_read(&h, header, hsz + n, &pack_size);
+			if (r <= 0) {
+				int hash = hash_fd(fd);
+				uc->next = q->hash[hash];
+				q->hash[hash] = uc;
+				if (r == 0) {
+					memcpy(uc->header + hsz, buffer, n);
+					uc->header_sz += n;
+					return 1;
+				}
+				uc->read = -2;
+				return invalid_header(L, fd);
+			}
+			buffer += r - hsz;
+			size -= r - hsz;
 			uc->pack.size = pack_size;
 			uc->pack.buffer = skynet_malloc(pack_size);
 			uc->read = 0;
@@ -246,62 +372,63 @@ filter_data_(lua_State *L, int fd, uint8_t * buffer, int size) {
 		if (size < need) {
 			memcpy(uc->pack.buffer + uc->read, buffer, size);
 			uc->read += size;
-			int h = hash_fd(fd);
-			uc->next = q->hash[h];
-			q->hash[h] = uc;
+			int hash = hash_fd(fd);
+			uc->next = q->hash[hash];
+			q->hash[hash] = uc;
 			return 1;
 		}
 		memcpy(uc->pack.buffer + uc->read, buffer, need);
 		buffer += need;
 		size -= need;
 		if (size == 0) {
-			lua_pushvalue(L, lua_upvalueindex(TYPE_DATA));
-			lua_pushinteger(L, fd);
-			lua_pushlightuserdata(L, uc->pack.buffer);
-			lua_pushinteger(L, uc->pack.size);
+			int r = push_package(L, fd, uc->pack.buffer, uc->pack.size, slice ? new_slice(uc->pack.buffer) : NULL);
 			skynet_free(uc);
-			return 5;
+			return r;
 		}
 		// more data
-		push_data(L, fd, uc->pack.buffer, uc->pack.size, 0);
+		push_data(L, fd, uc->pack.buffer, uc->pack.size, 0, slice);
 		skynet_free(uc);
-		push_more(L, fd, buffer, size);
+		if (push_more(L, &h, fd, buffer, size, slice)) {
+			return invalid_header(L, fd);
+		}
 		lua_pushvalue(L, lua_upvalueindex(TYPE_MORE));
 		return 2;
 	} else {
-		if (size == 1) {
+		int pack_size;
+		int n = packet_header_read(&h, buffer, size, &pack_size);
+		if (n <= 0) {
+			if (n == 0) {
+				save_header(L, fd, buffer, size);
+				return 1;
+			}
 			struct uncomplete * uc = save_uncomplete(L, fd);
-			uc->read = -1;
-			uc->header = *buffer;
-			return 1;
+			uc->read = -2;
+			return invalid_header(L, fd);
 		}
-		int pack_size = read_size(buffer);
-		buffer+=2;
-		size-=2;
+		buffer += n;
+		size -= n;
 
 		if (size < pack_size) {
-			struct uncomplete * uc = save_uncomplete(L, fd);
-			uc->read = size;
-			uc->pack.size = pack_size;
-			uc->pack.buffer = skynet_malloc(pack_size);
-			memcpy(uc->pack.buffer, buffer, size);
+			save_pack(L, fd, buffer, size, pack_size);
 			return 1;
 		}
 		if (size == pack_size) {
 			// just one package
-			lua_pushvalue(L, lua_upvalueindex(TYPE_DATA));
-			lua_pushinteger(L, fd);
+			if (slice) {
+				ATOM_FINC(&slice->ref);
+				return push_package(L, fd, buffer, size, slice);
+			}
 			void * result = skynet_malloc(pack_size);
 			memcpy(result, buffer, size);
-			lua_pushlightuserdata(L, result);
-			lua_pushinteger(L, size);
-			return 5;
+			return push_package(L, fd, result, size, NULL);
 		}
 		// more data
-		push_data(L, fd, buffer, pack_size, 1);
+		push_data(L, fd, buffer, pack_size, 1, slice);
 		buffer += pack_size;
 		size -= pack_size;
-		push_more(L, fd, buffer, size);
+		if (push_more(L, &h, fd, buffer, size, slice)) {
+			return invalid_header(L, fd);
+		}
 		lua_pushvalue(L, lua_upvalueindex(TYPE_MORE));
 		return 2;
 	}
@@ -309,7 +436,15 @@ filter_data_(lua_State *L, int fd, uint8_t * buffer, int size) {
 
 static inline int
 filter_data(lua_State *L, int fd, uint8_t * buffer, int size) {
-	int ret = filter_data_(L, fd, buffer, size);
+	struct queue *q = lua_touserdata(L,1);
+	if (q && q->slice) {
+		// the packages in buffer share it, release the reference of filter at last
+		struct slice * s = new_slice(buffer);
+		int ret = filter_data_(L, fd, buffer, size, s);
+		release_slice(s);
+		return ret;
+	}
+	int ret = filter_data_(L, fd, buffer, size, NULL);
 	// buffer is the data of socket message, it malloc at socket_server.c : function forward_message .
 	// it should be free before return,
 	skynet_free(buffer);
@@ -396,6 +531,7 @@ lfilter(lua_State *L) {
 		integer fd
 		lightuserdata msg
 		integer size
+		lightuserdata slice (slice mode only)
  */
 static int
 lpop(lua_State *L) {
@@ -409,6 +545,10 @@ lpop(lua_State *L) {
 	lua_pushinteger(L, np->id);
 	lua_pushlightuserdata(L, np->buffer);
 	lua_pushinteger(L, np->size);
+	if (np->slice) {
+		lua_pushlightuserdata(L, np->slice);
+		return 4;
+	}
 
 	return 3;
 }
@@ -431,51 +571,128 @@ tolstring(lua_State *L, size_t *sz, int index) {
 	return ptr;
 }
 
-static inline void
-write_size(uint8_t * buffer, int len) {
-	buffer[0] = (len >> 8) & 0xff;
-	buffer[1] = len & 0xff;
-}
-
 static int
-lpack(lua_State *L) {
+pack_(lua_State *L, const struct packet_header *h) {
 	size_t len;
 	const char * ptr = tolstring(L, &len, 1);
-	if (len >= 0x10000) {
+	uint8_t header[PACKET_HEADER_MAXSIZE];
+	int n = packet_header_write(h, header, len);
+	if (n < 0) {
 		return luaL_error(L, "Invalid size (too long) of data : %d", (int)len);
 	}
 
-	uint8_t * buffer = skynet_malloc(len + 2);
-	write_size(buffer, len);
-	memcpy(buffer+2, ptr, len);
+	uint8_t * buffer = skynet_malloc(len + n);
+	memcpy(buffer, header, n);
+	memcpy(buffer+n, ptr, len);
 
 	lua_pushlightuserdata(L, buffer);
-	lua_pushinteger(L, len + 2);
+	lua_pushinteger(L, len + n);
 
 	return 2;
 }
 
+static int
+lpack(lua_State *L) {
+	struct packet_header h;
+	packet_header_default(&h);
+	return pack_(L, &h);
+}
+
+static void
+check_header(lua_State *L, int index, struct packet_header *h) {
+	const char * format = luaL_optstring(L, index, NULL);
+	if (packet_header_init(h, format)) {
+		luaL_error(L, "Invalid package header format %s", format);
+	}
+	lua_Integer limit = luaL_optinteger(L, index+1, 0);
+	if (limit > 0 && limit < h->limit) {
+		h->limit = (int)limit;
+	}
+}
+
+static int
+lpackformat(lua_State *L) {
+	struct packet_header *h = lua_touserdata(L, lua_upvalueindex(1));
+	return pack_(L, h);
+}
+
+/*
+	string format
+	return function pack(msg|ptr, sz)
+ */
+static int
+lpacker(lua_State *L) {
+	struct packet_header tmp;
+	check_header(L, 1, &tmp);
+	struct packet_header *h = lua_newuserdatauv(L, sizeof(*h), 0);
+	*h = tmp;
+	lua_pushcclosure(L, lpackformat, 1);
+	return 1;
+}
+
+/*
+	string format
+	integer limit (max value of length field, optional)
+	boolean slice (optional)
+	return userdata queue
+ */
+static int
+lqueue(lua_State *L) {
+	struct packet_header h;
+	check_header(L, 1, &h);
+	int slice = lua_toboolean(L, 3);
+	struct queue *q = new_queue(L);
+	q->header = h;
+	q->slice = slice;
+	return 1;
+}
+
+/*
+	lightuserdata msg
+	integer size
+	lightuserdata slice (optional)
+ */
 static int
 ltostring(lua_State *L) {
 	void * ptr = lua_touserdata(L, 1);
 	int size = luaL_checkinteger(L, 2);
+	struct slice * s = lua_touserdata(L, 3);
 	if (ptr == NULL) {
 		lua_pushliteral(L, "");
 	} else {
 		lua_pushlstring(L, (const char *)ptr, size);
-		skynet_free(ptr);
+		free_package(ptr, s);
 	}
 	return 1;
 }
 
+static int
+lrelease(lua_State *L) {
+	luaL_checktype(L, 1, LUA_TLIGHTUSERDATA);
+	release_slice(lua_touserdata(L, 1));
+	return 0;
+}
+
+static int
+lretain(lua_State *L) {
+	luaL_checktype(L, 1, LUA_TLIGHTUSERDATA);
+	struct slice * s = lua_touserdata(L, 1);
+	ATOM_FINC(&s->ref);
+	return 0;
+}
+
 LUAMOD_API int
 luaopen_skynet_netpack(lua_State *L) {
 	luaL_checkversion(L);
 	luaL_Reg l[] = {
 		{ "pop", lpop },
 		{ "pack", lpack },
+		{ "packer", lpacker },
+		{ "queue", lqueue },
 		{ "clear", lclear },
 		{ "tostring", ltostring },
+		{ "release", lrelease },
+		{ "retain", lretain },
 		{ NULL, NULL },
 	};
 	luaL_newlib(L,l);
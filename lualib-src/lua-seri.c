@@ -5,13 +5,15 @@
 #define LUA_LIB
 
 #include "skynet_malloc.h"
+#include "lz4block.h"
+#include "lua-seri.h"
 
 #include <lua.h>
 #include <lauxlib.h>
 #include <stdlib.h>
 #include <stdint.h>
-#include <assert.h>
 #include <string.h>
+#include <limits.h>
 
 #define TYPE_NIL 0
 #define TYPE_BOOLEAN 1
@@ -30,82 +32,223 @@
 // hibits 0~31 : len
 #define TYPE_LONG_STRING 5
 #define TYPE_TABLE 6
+#define TYPE_STRING_REF 7
+// hibits 0~30 : index-1 , 31 : index follows as an integer
+
+/*
+	Message header : a message may begin with a TYPE_STRING_REF byte (it can't be a reference there),
+	the hibits are HEADER_VERSION1 | flags. A message without header is version 0 (no flags).
+	skynet.pack writes version 0, the header is written only by the features need it (packhint, packintern,
+	compress), so the older version reads the messages of skynet.pack.
+
+	HEADER_HASHSIZE : each table has a byte after the array size, the size of the hash part (see wb_hashsize).
+	HEADER_INTERN : each short string (2 <= len < MAX_COOKIE) gets an index (from 1) in the order of appearance,
+		and a string seen before is written as a TYPE_STRING_REF of its index.
+	HEADER_COMPRESS : (luaseri_compress) DWORD size of the message, and the message compressed in LZ4 block format.
+		The message has its own header, and it can't be compressed again.
+ */
+#define HEADER_VERSION1 16
+#define HEADER_HASHSIZE 1
+#define HEADER_INTERN 2
+#define HEADER_COMPRESS 4
+#define HEADER_FLAGS (HEADER_HASHSIZE | HEADER_INTERN | HEADER_COMPRESS)
+
+#define COMPRESS_THRESHOLD 4096
+#define COMPRESS_HEADER 5
+
+#define INTERN_MINLEN 2
+#define MAX_HASHSIZE 30
 
 #define MAX_COOKIE 32
 #define COMBINE_TYPE(t,v) ((t) | (v) << 3)
 
-#define BLOCK_SIZE 128
+#define STACK_SIZE 256
 #define MAX_DEPTH 32
+#define INTERN_STACK 64
+
+// the strings are anchored in the table at INTERN_ANCHOR while packing, so the address of a collected one can't be reused
+#define INTERN_ANCHOR 1
+
+struct string_ref {
+	const char * str;	// lua short strings are interned by lua, so the pointer is the key
+	int index;
+};
 
-struct block {
-	struct block * next;
-	char buffer[BLOCK_SIZE];
+struct intern {
+	struct string_ref * slot;
+	int cap;
+	int n;
+	struct string_ref stack[INTERN_STACK];
 };
 
+// a contiguous buffer, it begins on stack and grows in heap.
 struct write_block {
-	struct block * head;
-	struct block * current;
+	char * buffer;
 	int len;
-	int ptr;
+	int cap;
+	int hashsize;	// write the hash size hints
+	struct intern * intern;	// NULL when not in intern mode
+	char stack[STACK_SIZE];
 };
 
 struct read_block {
 	char * buffer;
 	int len;
 	int ptr;
+	int strings;	// strings indexed in intern mode, -1 when not in intern mode
+	int hashsize;	// the tables have the hash size hints
 };
 
-inline static struct block *
-blk_alloc(void) {
-	struct block *b = skynet_malloc(sizeof(struct block));
-	b->next = NULL;
-	return b;
+static void
+wb_grow(struct write_block *b, int sz) {
+	size_t cap = b->cap;
+	while (cap < (size_t)b->len + sz) {
+		cap *= 2;
+	}
+	if (cap > INT_MAX) {
+		cap = INT_MAX;
+	}
+	if (b->buffer == b->stack) {
+		b->buffer = skynet_malloc(cap);
+		memcpy(b->buffer, b->stack, b->len);
+	} else {
+		b->buffer = skynet_realloc(b->buffer, cap);
+	}
+	b->cap = (int)cap;
 }
 
 inline static void
 wb_push(struct write_block *b, const void *buf, int sz) {
-	const char * buffer = buf;
-	if (b->ptr == BLOCK_SIZE) {
-_again:
-		b->current = b->current->next = blk_alloc();
-		b->ptr = 0;
-	}
-	if (b->ptr <= BLOCK_SIZE - sz) {
-		memcpy(b->current->buffer + b->ptr, buffer, sz);
-		b->ptr+=sz;
-		b->len+=sz;
-	} else {
-		int copy = BLOCK_SIZE - b->ptr;
-		memcpy(b->current->buffer + b->ptr, buffer, copy);
-		buffer += copy;
-		b->len += copy;
-		sz -= copy;
-		goto _again;
+	if (b->len > b->cap - sz) {
+		wb_grow(b, sz);
 	}
+	memcpy(b->buffer + b->len, buf, sz);
+	b->len += sz;
 }
 
 static void
-wb_init(struct write_block *wb , struct block *b) {
-	wb->head = b;
-	assert(b->next == NULL);
+wb_init(struct write_block *wb) {
+	wb->buffer = wb->stack;
 	wb->len = 0;
-	wb->current = wb->head;
-	wb->ptr = 0;
+	wb->cap = STACK_SIZE;
+	wb->hashsize = 0;
+	wb->intern = NULL;
+}
+
+static void
+wb_header(struct write_block *wb, int flags) {
+	if (flags & HEADER_HASHSIZE) {
+		wb->hashsize = 1;
+	}
+	uint8_t n = COMBINE_TYPE(TYPE_STRING_REF, HEADER_VERSION1 | flags);
+	wb_push(wb, &n, 1);
+}
+
+// reserve a byte for the hash size of the table, return the offset or -1
+static inline int
+wb_reserve_hashsize(struct write_block *wb) {
+	if (!wb->hashsize)
+		return -1;
+	int offset = wb->len;
+	uint8_t n = 0;
+	wb_push(wb, &n, 1);
+	return offset;
+}
+
+/*
+	The hint is 0 for an empty hash part, or 1 + ceil(log2(n)), lua allocates the hash part in power of 2.
+ */
+static inline void
+wb_hashsize(struct write_block *wb, int offset, int n) {
+	if (offset < 0)
+		return;
+	uint8_t hint = 0;
+	if (n > 0) {
+		hint = 1;
+		while (hint < MAX_HASHSIZE && (1 << (hint - 1)) < n) {
+			++hint;
+		}
+	}
+	wb->buffer[offset] = hint;
+}
+
+static void
+intern_init(struct intern *in) {
+	in->slot = in->stack;
+	in->cap = INTERN_STACK;
+	in->n = 0;
+	memset(in->stack, 0, sizeof(in->stack));
+}
+
+static void
+intern_free(struct intern *in) {
+	if (in->slot != in->stack) {
+		skynet_free(in->slot);
+	}
+	in->slot = in->stack;
+}
+
+static inline uint32_t
+intern_hash(const char *str) {
+	uintptr_t h = (uintptr_t)str;
+	return (uint32_t)((h >> 3) ^ (h >> 17)) * 2654435761u;
+}
+
+static void
+intern_insert(struct string_ref *slot, int cap, const char *str, int index) {
+	uint32_t i = intern_hash(str) & (cap - 1);
+	while (slot[i].str) {
+		i = (i + 1) & (cap - 1);
+	}
+	slot[i].str = str;
+	slot[i].index = index;
+}
+
+/*
+	return the index of str if it's in the table, or add str and return 0.
+ */
+static int
+intern_string(struct intern *in, const char *str) {
+	uint32_t i = intern_hash(str) & (in->cap - 1);
+	while (in->slot[i].str) {
+		if (in->slot[i].str == str)
+			return in->slot[i].index;
+		i = (i + 1) & (in->cap - 1);
+	}
+	++in->n;
+	if (in->n * 2 > in->cap) {
+		// rehash, keep the load factor under 1/2
+		int cap = in->cap * 2;
+		struct string_ref * slot = skynet_malloc(cap * sizeof(*slot));
+		memset(slot, 0, cap * sizeof(*slot));
+		int j;
+		for (j=0;j<in->cap;j++) {
+			if (in->slot[j].str) {
+				intern_insert(slot, cap, in->slot[j].str, in->slot[j].index);
+			}
+		}
+		intern_free(in);
+		in->slot = slot;
+		in->cap = cap;
+		intern_insert(slot, cap, str, in->n);
+	} else {
+		in->slot[i].str = str;
+		in->slot[i].index = in->n;
+	}
+	return 0;
 }
 
 static void
 wb_free(struct write_block *wb) {
-	struct block *blk = wb->head;
-	blk = blk->next;	// the first block is on stack
-	while (blk) {
-		struct block * next = blk->next;
-		skynet_free(blk);
-		blk = next;
-	}
-	wb->head = NULL;
-	wb->current = NULL;
-	wb->ptr = 0;
+	if (wb->buffer != wb->stack) {
+		skynet_free(wb->buffer);
+	}
+	wb->buffer = wb->stack;
 	wb->len = 0;
+	wb->cap = STACK_SIZE;
+	if (wb->intern) {
+		intern_free(wb->intern);
+	}
 }
 
 static void
@@ -113,6 +256,8 @@ rball_init(struct read_block * rb, char * buffer, int size) {
 	rb->buffer = buffer;
 	rb->len = size;
 	rb->ptr = 0;
+	rb->strings = -1;
+	rb->hashsize = 0;
 }
 
 static const void *
@@ -187,8 +332,25 @@ wb_pointer(struct write_block *wb, void *v) {
 	wb_push(wb, &v, sizeof(v));
 }
 
-static inline void
+// return 1 if str is added to the intern table
+static inline int
 wb_string(struct write_block *wb, const char *str, int len) {
+	int added = 0;
+	if (wb->intern && len >= INTERN_MINLEN && len < MAX_COOKIE) {
+		int index = intern_string(wb->intern, str);
+		if (index > 0) {
+			if (index < MAX_COOKIE) {
+				uint8_t n = COMBINE_TYPE(TYPE_STRING_REF, index - 1);
+				wb_push(wb, &n, 1);
+			} else {
+				uint8_t n = COMBINE_TYPE(TYPE_STRING_REF, MAX_COOKIE-1);
+				wb_push(wb, &n, 1);
+				wb_integer(wb, index);
+			}
+			return 0;
+		}
+		added = 1;
+	}
 	if (len < MAX_COOKIE) {
 		uint8_t n = COMBINE_TYPE(TYPE_SHORT_STRING, len);
 		wb_push(wb, &n, 1);
@@ -210,12 +372,13 @@ wb_string(struct write_block *wb, const char *str, int len) {
 		}
 		wb_push(wb, str, len);
 	}
+	return added;
 }
 
 static void pack_one(lua_State *L, struct write_block *b, int index, int depth);
 
 static int
-wb_table_array(lua_State *L, struct write_block * wb, int index, int depth) {
+wb_table_array(lua_State *L, struct write_block * wb, int index, int depth, int *hashsize) {
 	int array_size = lua_rawlen(L,index);
 	if (array_size >= MAX_COOKIE-1) {
 		uint8_t n = COMBINE_TYPE(TYPE_TABLE, MAX_COOKIE-1);
@@ -225,6 +388,7 @@ wb_table_array(lua_State *L, struct write_block * wb, int index, int depth) {
 		uint8_t n = COMBINE_TYPE(TYPE_TABLE, array_size);
 		wb_push(wb, &n, 1);
 	}
+	*hashsize = wb_reserve_hashsize(wb);
 
 	int i;
 	for (i=1;i<=array_size;i++) {
@@ -237,7 +401,8 @@ wb_table_array(lua_State *L, struct write_block * wb, int index, int depth) {
 }
 
 static void
-wb_table_hash(lua_State *L, struct write_block * wb, int index, int depth, int array_size) {
+wb_table_hash(lua_State *L, struct write_block * wb, int index, int depth, int array_size, int hashsize) {
+	int n = 0;
 	lua_pushnil(L);
 	while (lua_next(L, index) != 0) {
 		if (lua_type(L,-2) == LUA_TNUMBER) {
@@ -252,14 +417,18 @@ wb_table_hash(lua_State *L, struct write_block * wb, int index, int depth, int a
 		pack_one(L,wb,-2,depth);
 		pack_one(L,wb,-1,depth);
 		lua_pop(L, 1);
+		++n;
 	}
 	wb_nil(wb);
+	wb_hashsize(wb, hashsize, n);
 }
 
 static int
 wb_table_metapairs(lua_State *L, struct write_block *wb, int index, int depth) {
 	uint8_t n = COMBINE_TYPE(TYPE_TABLE, 0);
 	wb_push(wb, &n, 1);
+	int hashsize = wb_reserve_hashsize(wb);
+	int count = 0;
 	lua_pushvalue(L, index);
 	if (lua_pcall(L, 1, 3,0) != LUA_OK)
 		return 1;
@@ -277,8 +446,10 @@ wb_table_metapairs(lua_State *L, struct write_block *wb, int index, int depth) {
 		pack_one(L, wb, -2, depth);
 		pack_one(L, wb, -1, depth);
 		lua_pop(L, 1);
+		++count;
 	}
 	wb_nil(wb);
+	wb_hashsize(wb, hashsize, count);
 	return 0;
 }
 
@@ -294,8 +465,9 @@ wb_table(lua_State *L, struct write_block *wb, int index, int depth) {
 	if (luaL_getmetafield(L, index, "__pairs") != LUA_TNIL) {
 		return wb_table_metapairs(L, wb, index, depth);
 	} else {
-		int array_size = wb_table_array(L, wb, index, depth);
-		wb_table_hash(L, wb, index, depth, array_size);
+		int hashsize;
+		int array_size = wb_table_array(L, wb, index, depth, &hashsize);
+		wb_table_hash(L, wb, index, depth, array_size, hashsize);
 		return 0;
 	}
 }
@@ -327,7 +499,11 @@ pack_one(lua_State *L, struct write_block *b, int index, int depth) {
 	case LUA_TSTRING: {
 		size_t sz = 0;
 		const char *str = lua_tolstring(L,index,&sz);
-		wb_string(b, str, (int)sz);
+		if (wb_string(b, str, (int)sz)) {
+			// the iterator of __pairs may return a string which is collected after it's packed
+			lua_pushvalue(L, index);
+			lua_rawseti(L, INTERN_ANCHOR, b->intern->n);
+		}
 		break;
 	}
 	case LUA_TLIGHTUSERDATA:
@@ -441,23 +617,43 @@ get_buffer(lua_State *L, struct read_block *rb, int len) {
 
 static void unpack_one(lua_State *L, struct read_block *rb);
 
+// an integer after the type byte (array size, string index)
+static lua_Integer
+get_index(lua_State *L, struct read_block *rb) {
+	uint8_t type;
+	const uint8_t * t = (const uint8_t *)rb_read(rb, sizeof(type));
+	if (t==NULL) {
+		invalid_stream(L,rb);
+	}
+	type = *t;
+	int cookie = type >> 3;
+	if ((type & 7) != TYPE_NUMBER || cookie == TYPE_NUMBER_REAL) {
+		invalid_stream(L,rb);
+	}
+	return get_integer(L,rb,cookie);
+}
+
 static void
 unpack_table(lua_State *L, struct read_block *rb, int array_size) {
 	if (array_size == MAX_COOKIE-1) {
-		uint8_t type;
-		const uint8_t * t = (const uint8_t *)rb_read(rb, sizeof(type));
-		if (t==NULL) {
+		array_size = get_index(L,rb);
+	}
+	int hashsize = 0;
+	if (rb->hashsize) {
+		const uint8_t * h = (const uint8_t *)rb_read(rb, 1);
+		if (h == NULL || *h > MAX_HASHSIZE) {
 			invalid_stream(L,rb);
 		}
-		type = *t;
-		int cookie = type >> 3;
-		if ((type & 7) != TYPE_NUMBER || cookie == TYPE_NUMBER_REAL) {
-			invalid_stream(L,rb);
+		if (*h > 0) {
+			hashsize = 1 << (*h - 1);
+			// it's a hint, don't trust it more than the rest of the stream
+			if (hashsize > rb->len / 2) {
+				hashsize = rb->len / 2;
+			}
 		}
-		array_size = get_integer(L,rb,cookie);
 	}
 	luaL_checkstack(L,LUA_MINSTACK,NULL);
-	lua_createtable(L,array_size,0);
+	lua_createtable(L,array_size,hashsize);
 	int i;
 	for (i=1;i<=array_size;i++) {
 		unpack_one(L,rb);
@@ -495,7 +691,25 @@ push_value(lua_State *L, struct read_block *rb, int type, int cookie) {
 		break;
 	case TYPE_SHORT_STRING:
 		get_buffer(L,rb,cookie);
+		if (rb->strings >= 0 && cookie >= INTERN_MINLEN) {
+			// the strings table is at index 2, see luaseri_unpack
+			lua_pushvalue(L, -1);
+			lua_rawseti(L, 2, ++rb->strings);
+		}
+		break;
+	case TYPE_STRING_REF: {
+		lua_Integer index;
+		if (cookie == MAX_COOKIE-1) {
+			index = get_index(L, rb);
+		} else {
+			index = cookie + 1;
+		}
+		if (index < 1 || index > rb->strings) {
+			invalid_stream(L,rb);
+		}
+		lua_rawgeti(L, 2, index);
 		break;
+	}
 	case TYPE_LONG_STRING: {
 		if (cookie == 2) {
 			const void * plen = rb_read(rb, 2);
@@ -542,24 +756,46 @@ unpack_one(lua_State *L, struct read_block *rb) {
 }
 
 static void
-seri(lua_State *L, struct block *b, int len) {
-	uint8_t * buffer = skynet_malloc(len);
-	uint8_t * ptr = buffer;
-	int sz = len;
-	while(len>0) {
-		if (len >= BLOCK_SIZE) {
-			memcpy(ptr, b->buffer, BLOCK_SIZE);
-			ptr += BLOCK_SIZE;
-			len -= BLOCK_SIZE;
-			b = b->next;
-		} else {
-			memcpy(ptr, b->buffer, len);
-			break;
-		}
+seri(lua_State *L, struct write_block *wb) {
+	uint8_t * buffer;
+	if (wb->buffer == wb->stack) {
+		buffer = skynet_malloc(wb->len);
+		memcpy(buffer, wb->stack, wb->len);
+	} else {
+		// move the heap buffer out, no copy
+		buffer = (uint8_t *)wb->buffer;
+		wb->buffer = wb->stack;
+		wb->cap = STACK_SIZE;
 	}
-	
 	lua_pushlightuserdata(L, buffer);
+	lua_pushinteger(L, wb->len);
+	wb->len = 0;
+}
+
+static int
+unpack_compressed(lua_State *L, const uint8_t *buffer, int len) {
+	if (len < COMPRESS_HEADER) {
+		return luaL_error(L, "Invalid compressed stream %d", len);
+	}
+	uint32_t sz = buffer[1] | buffer[2] << 8 | buffer[3] << 16 | (uint32_t)buffer[4] << 24;
+	// LZ4 can't compress more than 255:1
+	if (sz == 0 || (uint64_t)sz > (uint64_t)(len - COMPRESS_HEADER) * 255 + 16) {
+		return luaL_error(L, "Invalid compressed stream size %d", (int)sz);
+	}
+	void * data = lua_newuserdatauv(L, sz, 0);
+	if (lz4block_decompress(buffer + COMPRESS_HEADER, len - COMPRESS_HEADER, data, sz) != (int)sz) {
+		return luaL_error(L, "Invalid compressed stream");
+	}
+	uint8_t header = *(uint8_t *)data;
+	if ((header & 7) == TYPE_STRING_REF && ((header >> 3) & HEADER_COMPRESS)) {
+		return luaL_error(L, "Invalid compressed stream (compressed twice)");
+	}
+	int top = lua_gettop(L);
+	lua_pushcfunction(L, luaseri_unpack);
+	lua_pushvalue(L, -2);
 	lua_pushinteger(L, sz);
+	lua_call(L, 2, LUA_MULTRET);
+	return lua_gettop(L) - top;
 }
 
 int
@@ -584,10 +820,31 @@ luaseri_unpack(lua_State *L) {
 		return luaL_error(L, "deserialize null pointer");
 	}
 
-	lua_settop(L,1);
+	// index 2 is the strings table in intern mode
+	lua_settop(L,2);
 	struct read_block rb;
 	rball_init(&rb, buffer, len);
 
+	uint8_t header = ((uint8_t *)buffer)[0];
+	if ((header & 7) == TYPE_STRING_REF) {
+		int flags = header >> 3;
+		if (!(flags & HEADER_VERSION1) || (flags & ~(HEADER_VERSION1 | HEADER_FLAGS))) {
+			return luaL_error(L, "Unsupported serialize header %d", flags);
+		}
+		if (flags & HEADER_COMPRESS) {
+			return unpack_compressed(L, buffer, len);
+		}
+		rb_read(&rb, 1);
+		if (flags & HEADER_HASHSIZE) {
+			rb.hashsize = 1;
+		}
+		if (flags & HEADER_INTERN) {
+			rb.strings = 0;
+			lua_newtable(L);
+			lua_replace(L, 2);
+		}
+	}
+
 	int i;
 	for (i=0;;i++) {
 		if (i%8==7) {
@@ -603,20 +860,101 @@ luaseri_unpack(lua_State *L) {
 
 	// Need not free buffer
 
-	return lua_gettop(L) - 1;
+	return lua_gettop(L) - 2;
 }
 
+// version 0 message (without header), the nodes of the older version can read it
 LUAMOD_API int
 luaseri_pack(lua_State *L) {
-	struct block temp;
-	temp.next = NULL;
 	struct write_block wb;
-	wb_init(&wb, &temp);
+	wb_init(&wb);
+	pack_from(L,&wb,0);
+	seri(L, &wb);
+
+	return 2;
+}
+
+// pack with the hash size hints, the large dictionaries don't rehash while unpacking
+LUAMOD_API int
+luaseri_pack_hint(lua_State *L) {
+	struct write_block wb;
+	wb_init(&wb);
+	wb_header(&wb, HEADER_HASHSIZE);
 	pack_from(L,&wb,0);
-	assert(wb.head == &temp);
-	seri(L, &temp, wb.len);
+	seri(L, &wb);
 
-	wb_free(&wb);
+	return 2;
+}
+
+// pack with string references, for the messages of many records with the same keys
+LUAMOD_API int
+luaseri_pack_intern(lua_State *L) {
+	struct write_block wb;
+	wb_init(&wb);
+	struct intern in;
+	intern_init(&in);
+	wb.intern = &in;
+	wb_header(&wb, HEADER_HASHSIZE | HEADER_INTERN);
+	lua_newtable(L);
+	lua_insert(L, INTERN_ANCHOR);
+	pack_from(L,&wb,INTERN_ANCHOR);
+	intern_free(&in);
+	seri(L, &wb);
+
+	return 2;
+}
 
+/*
+	lightuserdata msg / string msg
+	integer sz (when msg is lightuserdata)
+	integer threshold (optional)
+
+	Compress the message when it's larger than threshold.
+	return the compressed message (lightuserdata and size, or string), or nothing when it's not compressed.
+	The msg is not freed.
+ */
+int
+luaseri_compress(lua_State *L) {
+	const uint8_t * msg;
+	size_t sz;
+	int idx;
+	int isstring = lua_type(L, 1) == LUA_TSTRING;
+	if (isstring) {
+		msg = (const uint8_t *)lua_tolstring(L, 1, &sz);
+		idx = 2;
+	} else {
+		msg = (const uint8_t *)lua_touserdata(L, 1);
+		sz = (size_t)luaL_checkinteger(L, 2);
+		idx = 3;
+	}
+	lua_Integer threshold = luaL_optinteger(L, idx, COMPRESS_THRESHOLD);
+	if (msg == NULL || sz == 0 || (lua_Integer)sz < threshold || sz > 0x7fffffff) {
+		return 0;
+	}
+	if ((msg[0] & 7) == TYPE_STRING_REF && ((msg[0] >> 3) & HEADER_COMPRESS)) {
+		// compressed already
+		return 0;
+	}
+	// it's not worth if it can't save 1/16 at least
+	size_t cap = sz - sz / 16;
+	uint8_t * buffer = skynet_malloc(COMPRESS_HEADER + cap);
+	size_t csz = lz4block_compress(msg, sz, buffer + COMPRESS_HEADER, cap);
+	if (csz == 0) {
+		skynet_free(buffer);
+		return 0;
+	}
+	buffer[0] = COMBINE_TYPE(TYPE_STRING_REF, HEADER_VERSION1 | HEADER_COMPRESS);
+	buffer[1] = sz & 0xff;
+	buffer[2] = (sz >> 8) & 0xff;
+	buffer[3] = (sz >> 16) & 0xff;
+	buffer[4] = (sz >> 24) & 0xff;
+	csz += COMPRESS_HEADER;
+	if (isstring) {
+		lua_pushlstring(L, (const char *)buffer, csz);
+		skynet_free(buffer);
+		return 1;
+	}
+	lua_pushlightuserdata(L, buffer);
+	lua_pushinteger(L, csz);
 	return 2;
 }
@@ -4,6 +4,9 @@
 #include <lua.h>
 
 int luaseri_pack(lua_State *L);
+int luaseri_pack_hint(lua_State *L);
+int luaseri_pack_intern(lua_State *L);
 int luaseri_unpack(lua_State *L);
+int luaseri_compress(lua_State *L);
 
 #endif
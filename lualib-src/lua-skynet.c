@@ -89,6 +89,14 @@ _cb(struct skynet_context * context, void * ud, int type, int session, uint32_t
 
 static int
 forward_cb(struct skynet_context * context, void * ud, int type, int session, uint32_t source, const void * msg, size_t sz) {
+	if (skynet_isshared(context)) {
+		// the broadcast message is shared by others, forward a copy
+		void * copy = skynet_malloc(sz + 1);
+		memcpy(copy, msg, sz);
+		((char *)copy)[sz] = '\0';
+		_cb(context, ud, type, session, source, copy, sz);
+		return 0;
+	}
 	_cb(context, ud, type, session, source, msg, sz);
 	// don't delete msg in forward mode.
 	return 1;
@@ -334,6 +342,88 @@ lredirect(lua_State *L) {
 	return send_message(L, source, 3);
 }
 
+#define BROADCAST_STACK 256
+
+/*
+	table addresses (uint32 address or string local name)
+	integer type
+	string message
+	 lightuserdata message_ptr
+	 integer len
+
+	return the number of services sent to
+ */
+// the message (lightuserdata) is freed before raising an error, it's owned by lbroadcast
+static int
+broadcast_error(lua_State *L, void *msg, const char *err) {
+	if (msg) {
+		skynet_free(msg);
+	}
+	return luaL_error(L, "%s", err);
+}
+
+static int
+lbroadcast(lua_State *L) {
+	struct skynet_context * context = lua_touserdata(L, lua_upvalueindex(1));
+	void * msg;
+	size_t sz;
+	void * owned = NULL;
+	int tag = 0;
+	switch (lua_type(L, 3)) {
+	case LUA_TSTRING:
+		msg = (void *)lua_tolstring(L, 3, &sz);
+		if (sz == 0)
+			msg = NULL;
+		break;
+	case LUA_TLIGHTUSERDATA:
+		msg = owned = lua_touserdata(L, 3);
+		if (!lua_isinteger(L, 4))
+			return broadcast_error(L, owned, "invalid message size");
+		sz = (size_t)lua_tointeger(L, 4);
+		tag = PTYPE_TAG_DONTCOPY;
+		break;
+	default:
+		return luaL_error(L, "invalid param %s", lua_typename(L, lua_type(L,3)));
+	}
+	if (lua_type(L, 1) != LUA_TTABLE)
+		return broadcast_error(L, owned, "addresses must be a table");
+	if (!lua_isinteger(L, 2))
+		return broadcast_error(L, owned, "invalid message type");
+	int type = (int)lua_tointeger(L, 2);
+	int n = (int)lua_rawlen(L, 1);
+	uint32_t tmp[BROADCAST_STACK];
+	uint32_t * handles = tmp;
+	if (n > BROADCAST_STACK) {
+		handles = (uint32_t *)lua_newuserdatauv(L, n * sizeof(uint32_t), 0);
+		lua_replace(L, 2);	// keep it in stack, type is read already
+	}
+	int i;
+	for (i=0;i<n;i++) {
+		uint32_t handle;
+		switch (lua_rawgeti(L, 1, i+1)) {
+		case LUA_TNUMBER:
+			handle = (uint32_t)lua_tointeger(L, -1);
+			break;
+		case LUA_TSTRING:
+			// .name or :address, the global names are not supported
+			handle = skynet_queryname(context, lua_tostring(L, -1));
+			break;
+		default:
+			return broadcast_error(L, owned, "dest address must be a string or number");
+		}
+		lua_pop(L, 1);
+		handles[i] = handle;
+	}
+	int ret = skynet_broadcast(context, 0, handles, n, type | tag, msg, sz);
+	if (ret == -2) {
+		// package is too large
+		lua_pushboolean(L, 0);
+		return 1;
+	}
+	lua_pushinteger(L, ret);
+	return 1;
+}
+
 static int
 lerror(lua_State *L) {
 	struct skynet_context * context = lua_touserdata(L, lua_upvalueindex(1));
@@ -500,6 +590,7 @@ luaopen_skynet_core(lua_State *L) {
 		{ "send" , lsend },
 		{ "genid", lgenid },
 		{ "redirect", lredirect },
+		{ "broadcast", lbroadcast },
 		{ "command" , lcommand },
 		{ "intcommand", lintcommand },
 		{ "addresscommand", laddresscommand },
@@ -514,7 +605,10 @@ luaopen_skynet_core(lua_State *L) {
 	luaL_Reg l2[] = {
 		{ "tostring", ltostring },
 		{ "pack", luaseri_pack },
+		{ "packhint", luaseri_pack_hint },
+		{ "packintern", luaseri_pack_intern },
 		{ "unpack", luaseri_unpack },
+		{ "compress", luaseri_compress },
 		{ "packstring", lpackstring },
 		{ "trash" , ltrash },
 		{ "now", lnow },
@@ -13,6 +13,10 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <netinet/in.h>
@@ -487,8 +491,14 @@ llisten(lua_State *L) {
 	const char * host = luaL_checkstring(L,1);
 	int port = luaL_checkinteger(L,2);
 	int backlog = luaL_optinteger(L,3,BACKLOG);
+	int reuseport = lua_toboolean(L,4);
 	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
-	int id = skynet_socket_listen(ctx, host,port,backlog);
+	int id;
+	if (reuseport) {
+		id = skynet_socket_listen_reuseport(ctx, host,port,backlog);
+	} else {
+		id = skynet_socket_listen(ctx, host,port,backlog);
+	}
 	if (id < 0) {
 		return luaL_error(L, "Listen error");
 	}
@@ -602,6 +612,63 @@ lsendlow(lua_State *L) {
 	return 1;
 }
 
+/*
+	string filename / file (opened by io.open, the socket sends from a dup of its fd)
+	integer offset (default 0)
+	integer sz (default the rest of file)
+
+	return true, sz / false, errmsg
+ */
+static int
+lsendfile(lua_State *L) {
+	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
+	int id = luaL_checkinteger(L, 1);
+	lua_Integer offset = luaL_optinteger(L, 3, 0);
+	int fd;
+	luaL_Stream *stream = (luaL_Stream *)luaL_testudata(L, 2, LUA_FILEHANDLE);
+	if (stream) {
+		if (stream->closef == NULL)
+			return luaL_error(L, "attempt to use a closed file");
+		// the socket server closes the fd, the file can be closed after sendfile
+		fd = dup(fileno(stream->f));
+	} else {
+		fd = open(luaL_checkstring(L, 2), O_RDONLY);
+	}
+	if (fd < 0) {
+		lua_pushboolean(L, 0);
+		lua_pushstring(L, strerror(errno));
+		return 2;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || offset < 0 || offset > st.st_size) {
+		close(fd);
+		lua_pushboolean(L, 0);
+		lua_pushstring(L, "invalid offset");
+		return 2;
+	}
+	lua_Integer sz = luaL_optinteger(L, 4, st.st_size - offset);
+	if (sz < 0 || sz > st.st_size - offset) {
+		close(fd);
+		lua_pushboolean(L, 0);
+		lua_pushstring(L, "invalid size");
+		return 2;
+	}
+	if (sz == 0) {
+		close(fd);
+		lua_pushboolean(L, 1);
+		lua_pushinteger(L, 0);
+		return 2;
+	}
+	if (skynet_socket_sendfile(ctx, id, fd, offset, (size_t)sz)) {
+		lua_pushboolean(L, 0);
+		lua_pushstring(L, "socket is closed");
+		return 2;
+	}
+	lua_pushboolean(L, 1);
+	lua_pushinteger(L, sz);
+	return 2;
+}
+
 static int
 lbind(lua_State *L) {
 	struct skynet_context * ctx = lua_touserdata(L, lua_upvalueindex(1));
@@ -881,6 +948,7 @@ luaopen_skynet_socketdriver(lua_State *L) {
 		{ "listen", llisten },
 		{ "send", lsend },
 		{ "lsend", lsendlow },
+		{ "sendfile", lsendfile },
 		{ "bind", lbind },
 		{ "start", lstart },
 		{ "pause", lpause },
@@ -11,10 +11,15 @@
 #include "skynet_malloc.h"
 #include "atomic.h"
 
+/*
+	The readers poll the object (lread) without the lock : a reader holds a reference of the copy it read last time,
+	so the address of that copy can't be reused by a new copy, and if obj->copy is still the same address, nothing is updated.
+	The lock and the reference count of the copy are touched only when a reader gets a new copy.
+ */
 struct stm_object {
 	struct rwlock lock;
 	ATOM_INT reference;
-	struct stm_copy * copy;
+	ATOM_POINTER copy;	// struct stm_copy *, changed with write lock
 };
 
 struct stm_copy {
@@ -39,7 +44,7 @@ stm_new(void * msg, int32_t sz) {
 	struct stm_object * obj = skynet_malloc(sizeof(*obj));
 	rwlock_init(&obj->lock);
 	ATOM_INIT(&obj->reference , 1);
-	obj->copy = stm_newcopy(msg, sz);
+	ATOM_INIT(&obj->copy, (uintptr_t)stm_newcopy(msg, sz));
 
 	return obj;
 }
@@ -56,11 +61,11 @@ stm_releasecopy(struct stm_copy *copy) {
 
 static void
 stm_release(struct stm_object *obj) {
-	assert(obj->copy);
+	assert(ATOM_LOAD(&obj->copy));
 	rwlock_wlock(&obj->lock);
 	// writer release the stm object, so release the last copy .
-	stm_releasecopy(obj->copy);
-	obj->copy = NULL;
+	stm_releasecopy((struct stm_copy *)ATOM_LOAD(&obj->copy));
+	ATOM_STORE(&obj->copy, (uintptr_t)NULL);
 	if (ATOM_FDEC(&obj->reference) > 1) {
 		// stm object grab by readers, reset the copy to NULL.
 		rwlock_wunlock(&obj->lock);
@@ -75,7 +80,7 @@ stm_releasereader(struct stm_object *obj) {
 	rwlock_rlock(&obj->lock);
 	if (ATOM_FDEC(&obj->reference) == 1) {
 		// last reader, no writer. so no need to unlock
-		assert(obj->copy == NULL);
+		assert(ATOM_LOAD(&obj->copy) == (uintptr_t)NULL);
 		skynet_free(obj);
 		return;
 	}
@@ -93,7 +98,7 @@ stm_grab(struct stm_object *obj) {
 static struct stm_copy *
 stm_copy(struct stm_object *obj) {
 	rwlock_rlock(&obj->lock);
-	struct stm_copy * ret = obj->copy;
+	struct stm_copy * ret = (struct stm_copy *)ATOM_LOAD(&obj->copy);
 	if (ret) {
 		int ref = ATOM_FINC(&ret->reference);
 		assert(ref > 0);
@@ -107,8 +112,8 @@ static void
 stm_update(struct stm_object *obj, void *msg, int32_t sz) {
 	struct stm_copy *copy = stm_newcopy(msg, sz);
 	rwlock_wlock(&obj->lock);
-	struct stm_copy *oldcopy = obj->copy;
-	obj->copy = copy;
+	struct stm_copy *oldcopy = (struct stm_copy *)ATOM_LOAD(&obj->copy);
+	ATOM_STORE(&obj->copy, (uintptr_t)copy);
 	rwlock_wunlock(&obj->lock);
 
 	stm_releasecopy(oldcopy);
@@ -207,6 +212,12 @@ lread(lua_State *L) {
 	struct boxreader * box = lua_touserdata(L, 1);
 	luaL_checktype(L, 2, LUA_TFUNCTION);
 
+	if ((struct stm_copy *)ATOM_LOAD(&box->obj->copy) == box->lastcopy) {
+		// not update, lastcopy is held by this reader (see struct stm_object)
+		lua_pushboolean(L, 0);
+		return 1;
+	}
+
 	struct stm_copy * copy = stm_copy(box->obj);
 	if (copy == box->lastcopy) {
 		// not update
@@ -0,0 +1,376 @@
+#define LUA_LIB
+
+#include "skynet_malloc.h"
+
+#include <lua.h>
+#include <lauxlib.h>
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+	websocket frame codec (RFC 6455) for lualib/http/websocket.lua
+
+	 0                   1                   2                   3
+	+-+-+-+-+-------+-+-------------+-------------------------------+
+	|F|R|R|R| opcode|M| Payload len |    Extended payload length    |
+	|I|S|S|S|  (4)  |A|     (7)     |             (16/64)           |
+	|N|V|V|V|       |S|             |   (if payload len==126/127)   |
+	| |1|2|3|       |K|             |                               |
+	+-+-+-+-+-------+-+-------------+ - - - - - - - - - - - - - - - +
+	|     Extended payload length continued, if payload len == 127  |
+	+ - - - - - - - - - - - - - - - +-------------------------------+
+	|                               |Masking-key, if MASK set to 1  |
+	+-------------------------------+-------------------------------+
+ */
+
+#define MAX_HEADER 14
+#define BUFFER_METANAME "WEBSOCKET_BUFFER"
+
+static void
+mask_payload(uint8_t *dst, const uint8_t *src, size_t sz, uint32_t key) {
+	uint8_t k[16];
+	int i;
+	for (i=0;i<16;i+=4) {
+		k[i] = (key >> 24) & 0xff;
+		k[i+1] = (key >> 16) & 0xff;
+		k[i+2] = (key >> 8) & 0xff;
+		k[i+3] = key & 0xff;
+	}
+	size_t n = 0;
+#if defined(__SSE2__)
+	if (sz >= 16) {
+		__m128i m = _mm_loadu_si128((const __m128i *)k);
+		for (; n + 64 <= sz; n += 64) {
+			__m128i v0 = _mm_loadu_si128((const __m128i *)(src + n));
+			__m128i v1 = _mm_loadu_si128((const __m128i *)(src + n + 16));
+			__m128i v2 = _mm_loadu_si128((const __m128i *)(src + n + 32));
+			__m128i v3 = _mm_loadu_si128((const __m128i *)(src + n + 48));
+			_mm_storeu_si128((__m128i *)(dst + n), _mm_xor_si128(v0, m));
+			_mm_storeu_si128((__m128i *)(dst + n + 16), _mm_xor_si128(v1, m));
+			_mm_storeu_si128((__m128i *)(dst + n + 32), _mm_xor_si128(v2, m));
+			_mm_storeu_si128((__m128i *)(dst + n + 48), _mm_xor_si128(v3, m));
+		}
+		for (; n + 16 <= sz; n += 16) {
+			__m128i v = _mm_loadu_si128((const __m128i *)(src + n));
+			_mm_storeu_si128((__m128i *)(dst + n), _mm_xor_si128(v, m));
+		}
+	}
+#endif
+	uint64_t m64;
+	memcpy(&m64, k, sizeof(m64));
+	for (; n + 8 <= sz; n += 8) {
+		uint64_t v;
+		memcpy(&v, src + n, sizeof(v));
+		v ^= m64;
+		memcpy(dst + n, &v, sizeof(v));
+	}
+	// n is a multiple of 4 here
+	for (; n < sz; n++) {
+		dst[n] = src[n] ^ k[n & 3];
+	}
+}
+
+static int
+header_size(const uint8_t *head) {
+	int len = head[1] & 0x7f;
+	int sz = (head[1] & 0x80) ? 4 : 0;
+	if (len == 126) {
+		sz += 2;
+	} else if (len == 127) {
+		sz += 8;
+	}
+	return sz;
+}
+
+/*
+	string head (2 bytes at least)
+	string ext (optional, the rest of header : extended payload length and masking key)
+
+	return fin, opcode, rsv1, payload_len, masking_key (integer or false)
+	or nil, (size of ext), (payload_len when it's known)
+ */
+static int
+lheader(lua_State *L) {
+	size_t hsz;
+	const uint8_t * head = (const uint8_t *)luaL_checklstring(L, 1, &hsz);
+	if (hsz < 2) {
+		return luaL_error(L, "Invalid websocket frame header");
+	}
+	int extsz = header_size(head);
+	int len = head[1] & 0x7f;
+	size_t sz = 0;
+	const uint8_t * ext = NULL;
+	if (hsz > 2) {
+		ext = head + 2;
+		sz = hsz - 2;
+	} else if (!lua_isnoneornil(L, 2)) {
+		ext = (const uint8_t *)luaL_checklstring(L, 2, &sz);
+	}
+	if (extsz > 0 && ext == NULL) {
+		lua_pushnil(L);
+		lua_pushinteger(L, extsz);
+		if (len < 126) {
+			lua_pushinteger(L, len);
+			return 3;
+		}
+		return 2;
+	}
+	if (sz < (size_t)extsz) {
+		return luaL_error(L, "Invalid websocket frame header size %d (need %d)", (int)sz, extsz);
+	}
+	lua_Integer payload_len = len;
+	if (len == 126) {
+		payload_len = ext[0] << 8 | ext[1];
+		ext += 2;
+	} else if (len == 127) {
+		uint64_t v = 0;
+		int i;
+		for (i=0;i<8;i++) {
+			v = v << 8 | ext[i];
+		}
+		if (v >> 63) {
+			return luaL_error(L, "Invalid websocket payload length");
+		}
+		payload_len = (lua_Integer)v;
+		ext += 8;
+	}
+	lua_pushboolean(L, head[0] & 0x80);
+	lua_pushinteger(L, head[0] & 0x0f);
+	lua_pushboolean(L, head[0] & 0x40);
+	lua_pushinteger(L, payload_len);
+	if (head[1] & 0x80) {
+		uint32_t key = (uint32_t)ext[0] << 24 | (uint32_t)ext[1] << 16 | (uint32_t)ext[2] << 8 | ext[3];
+		lua_pushinteger(L, key);
+	} else {
+		lua_pushboolean(L, 0);
+	}
+	return 5;
+}
+
+/*
+	string data
+	integer masking_key (false for no mask)
+	integer offset (optional, skip the first offset bytes)
+
+	return string
+ */
+static int
+lunmask(lua_State *L) {
+	size_t sz;
+	const uint8_t * data = (const uint8_t *)luaL_checklstring(L, 1, &sz);
+	lua_Integer offset = luaL_optinteger(L, 3, 0);
+	if (offset < 0 || (size_t)offset > sz) {
+		return luaL_error(L, "Invalid offset %d", (int)offset);
+	}
+	data += offset;
+	sz -= offset;
+	if (!lua_toboolean(L, 2)) {
+		if (offset == 0) {
+			lua_settop(L, 1);
+		} else {
+			lua_pushlstring(L, (const char *)data, sz);
+		}
+		return 1;
+	}
+	uint32_t key = (uint32_t)luaL_checkinteger(L, 2);
+	luaL_Buffer b;
+	uint8_t * buffer = (uint8_t *)luaL_buffinitsize(L, &b, sz);
+	mask_payload(buffer, data, sz, key);
+	luaL_pushresultsize(&b, sz);
+	return 1;
+}
+
+static int
+write_header(uint8_t *header, int op, int fin, int rsv1, size_t sz, int masked, uint32_t key) {
+	int n = 2;
+	header[0] = (fin ? 0x80 : 0) | (rsv1 ? 0x40 : 0) | (op & 0x0f);
+	uint8_t mask = masked ? 0x80 : 0;
+	if (sz < 126) {
+		header[1] = mask | (uint8_t)sz;
+	} else if (sz <= 0xffff) {
+		header[1] = mask | 126;
+		header[2] = (sz >> 8) & 0xff;
+		header[3] = sz & 0xff;
+		n = 4;
+	} else {
+		header[1] = mask | 127;
+		int i;
+		for (i=0;i<8;i++) {
+			header[2+i] = ((uint64_t)sz >> (56 - i * 8)) & 0xff;
+		}
+		n = 10;
+	}
+	if (masked) {
+		header[n] = (key >> 24) & 0xff;
+		header[n+1] = (key >> 16) & 0xff;
+		header[n+2] = (key >> 8) & 0xff;
+		header[n+3] = key & 0xff;
+		n += 4;
+	}
+	return n;
+}
+
+/*
+	integer opcode
+	string payload (optional)
+	integer masking_key (optional)
+	boolean rsv1 (optional, compressed by permessage-deflate)
+	boolean fin (optional, default true)
+
+	return string frame
+ */
+static int
+lframe(lua_State *L) {
+	int op = (int)luaL_checkinteger(L, 1);
+	size_t sz = 0;
+	const uint8_t * payload = NULL;
+	if (!lua_isnoneornil(L, 2)) {
+		payload = (const uint8_t *)luaL_checklstring(L, 2, &sz);
+	}
+	int masked = lua_toboolean(L, 3);
+	uint32_t key = masked ? (uint32_t)luaL_checkinteger(L, 3) : 0;
+	int rsv1 = lua_toboolean(L, 4);
+	int fin = lua_isnoneornil(L, 5) ? 1 : lua_toboolean(L, 5);
+
+	uint8_t header[MAX_HEADER];
+	int n = write_header(header, op, fin, rsv1, sz, masked, key);
+	luaL_Buffer b;
+	uint8_t * buffer = (uint8_t *)luaL_buffinitsize(L, &b, n + sz);
+	memcpy(buffer, header, n);
+	if (sz > 0) {
+		if (masked) {
+			mask_payload(buffer + n, payload, sz, key);
+		} else {
+			memcpy(buffer + n, payload, sz);
+		}
+	}
+	luaL_pushresultsize(&b, n + sz);
+	return 1;
+}
+
+// fragmentation reassembly buffer
+
+struct buffer {
+	size_t size;
+	size_t cap;
+	size_t limit;
+	uint8_t * data;
+};
+
+static int
+lbuffer_gc(lua_State *L) {
+	struct buffer * b = luaL_checkudata(L, 1, BUFFER_METANAME);
+	skynet_free(b->data);
+	b->data = NULL;
+	b->size = b->cap = 0;
+	return 0;
+}
+
+/*
+	userdata buffer
+	string data
+	integer masking_key (false for no mask)
+	integer offset (optional)
+
+	return size of buffer
+ */
+static int
+lbuffer_append(lua_State *L) {
+	struct buffer * b = luaL_checkudata(L, 1, BUFFER_METANAME);
+	size_t sz;
+	const uint8_t * data = (const uint8_t *)luaL_checklstring(L, 2, &sz);
+	lua_Integer offset = luaL_optinteger(L, 4, 0);
+	if (offset < 0 || (size_t)offset > sz) {
+		return luaL_error(L, "Invalid offset %d", (int)offset);
+	}
+	data += offset;
+	sz -= offset;
+	if (b->limit > 0 && b->size + sz > b->limit) {
+		return luaL_error(L, "payload_len is too large");
+	}
+	if (b->size + sz > b->cap) {
+		size_t cap = b->cap ? b->cap : 1024;
+		while (cap < b->size + sz) {
+			cap *= 2;
+		}
+		b->data = skynet_realloc(b->data, cap);
+		b->cap = cap;
+	}
+	if (lua_toboolean(L, 3)) {
+		uint32_t key = (uint32_t)luaL_checkinteger(L, 3);
+		mask_payload(b->data + b->size, data, sz, key);
+	} else {
+		memcpy(b->data + b->size, data, sz);
+	}
+	b->size += sz;
+	lua_pushinteger(L, b->size);
+	return 1;
+}
+
+static int
+lbuffer_size(lua_State *L) {
+	struct buffer * b = luaL_checkudata(L, 1, BUFFER_METANAME);
+	lua_pushinteger(L, b->size);
+	return 1;
+}
+
+/*
+	userdata buffer
+	return string (and clear the buffer)
+ */
+static int
+lbuffer_result(lua_State *L) {
+	struct buffer * b = luaL_checkudata(L, 1, BUFFER_METANAME);
+	lua_pushlstring(L, (const char *)b->data, b->size);
+	b->size = 0;
+	return 1;
+}
+
+/*
+	integer limit (optional, 0 for unlimited)
+	return userdata buffer
+ */
+static int
+lbuffer(lua_State *L) {
+	lua_Integer limit = luaL_optinteger(L, 1, 0);
+	struct buffer * b = lua_newuserdatauv(L, sizeof(*b), 0);
+	b->size = 0;
+	b->cap = 0;
+	b->limit = limit > 0 ? (size_t)limit : 0;
+	b->data = NULL;
+	if (luaL_newmetatable(L, BUFFER_METANAME)) {
+		luaL_Reg l[]={
+			{ "append", lbuffer_append },
+			{ "size", lbuffer_size },
+			{ "result", lbuffer_result },
+			{ NULL, NULL },
+		};
+		luaL_newlib(L,l);
+		lua_setfield(L, -2, "__index");
+		lua_pushcfunction(L, lbuffer_gc);
+		lua_setfield(L, -2, "__gc");
+	}
+	lua_setmetatable(L, -2);
+	return 1;
+}
+
+LUAMOD_API int
+luaopen_skynet_websocket(lua_State *L) {
+	luaL_checkversion(L);
+	luaL_Reg l[] = {
+		{ "header", lheader },
+		{ "unmask", lunmask },
+		{ "frame", lframe },
+		{ "buffer", lbuffer },
+		{ NULL, NULL },
+	};
+	luaL_newlib(L,l);
+
+	return 1;
+}
@@ -0,0 +1,111 @@
+#define LUA_LIB
+
+#include <lua.h>
+#include <lauxlib.h>
+
+#include <zlib.h>
+#include <string.h>
+
+/*
+	permessage-deflate (RFC 7692) for lualib/http/websocket.lua, without context takeover.
+	Each message is a raw deflate stream flushed by Z_SYNC_FLUSH, and the tail 00 00 ff ff is removed.
+ */
+
+#define CHUNK_SIZE 4096
+
+static const unsigned char DEFLATE_TAIL[4] = { 0x00, 0x00, 0xff, 0xff };
+
+static int
+ldeflate(lua_State *L) {
+	size_t sz;
+	const char * data = luaL_checklstring(L, 1, &sz);
+	int level = (int)luaL_optinteger(L, 2, Z_DEFAULT_COMPRESSION);
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+	if (deflateInit2(&zs, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		return luaL_error(L, "deflateInit failed");
+	}
+	luaL_Buffer b;
+	luaL_buffinit(L, &b);
+	zs.next_in = (Bytef *)data;
+	zs.avail_in = (uInt)sz;
+	do {
+		unsigned char * out = (unsigned char *)luaL_prepbuffsize(&b, CHUNK_SIZE);
+		zs.next_out = out;
+		zs.avail_out = CHUNK_SIZE;
+		int r = deflate(&zs, Z_SYNC_FLUSH);
+		if (r != Z_OK && r != Z_BUF_ERROR) {
+			deflateEnd(&zs);
+			return luaL_error(L, "deflate failed : %d", r);
+		}
+		luaL_addsize(&b, CHUNK_SIZE - zs.avail_out);
+	} while (zs.avail_out == 0);
+	deflateEnd(&zs);
+	if (luaL_bufflen(&b) >= 4 && memcmp(luaL_buffaddr(&b) + luaL_bufflen(&b) - 4, DEFLATE_TAIL, 4) == 0) {
+		luaL_buffsub(&b, 4);
+	}
+	luaL_pushresult(&b);
+	return 1;
+}
+
+/*
+	string data
+	integer limit (optional, max size of the message)
+ */
+static int
+linflate(lua_State *L) {
+	size_t sz;
+	const char * data = luaL_checklstring(L, 1, &sz);
+	size_t limit = (size_t)luaL_optinteger(L, 2, 0);
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+	if (inflateInit2(&zs, -MAX_WBITS) != Z_OK) {
+		return luaL_error(L, "inflateInit failed");
+	}
+	luaL_Buffer b;
+	luaL_buffinit(L, &b);
+	int i;
+	for (i=0;i<2;i++) {
+		if (i == 0) {
+			zs.next_in = (Bytef *)data;
+			zs.avail_in = (uInt)sz;
+		} else {
+			zs.next_in = (Bytef *)DEFLATE_TAIL;
+			zs.avail_in = sizeof(DEFLATE_TAIL);
+		}
+		int r;
+		do {
+			unsigned char * out = (unsigned char *)luaL_prepbuffsize(&b, CHUNK_SIZE);
+			zs.next_out = out;
+			zs.avail_out = CHUNK_SIZE;
+			r = inflate(&zs, Z_SYNC_FLUSH);
+			if (r != Z_OK && r != Z_STREAM_END && r != Z_BUF_ERROR) {
+				inflateEnd(&zs);
+				return luaL_error(L, "inflate failed : %d", r);
+			}
+			luaL_addsize(&b, CHUNK_SIZE - zs.avail_out);
+			if (limit > 0 && luaL_bufflen(&b) > limit) {
+				inflateEnd(&zs);
+				return luaL_error(L, "payload_len is too large");
+			}
+		} while (r != Z_STREAM_END && (zs.avail_in > 0 || zs.avail_out == 0));
+		if (r == Z_STREAM_END)
+			break;
+	}
+	inflateEnd(&zs);
+	luaL_pushresult(&b);
+	return 1;
+}
+
+LUAMOD_API int
+luaopen_wsdeflate(lua_State *L) {
+	luaL_checkversion(L);
+	luaL_Reg l[] = {
+		{ "deflate", ldeflate },
+		{ "inflate", linflate },
+		{ NULL, NULL },
+	};
+	luaL_newlib(L,l);
+
+	return 1;
+}
@@ -0,0 +1,207 @@
+#include "lz4block.h"
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+	A small LZ4 block codec : greedy matching with a 4K entries hash table, and skipping faster in incompressible data.
+	It's slower than liblz4, but compatible with it.
+ */
+
+#define MINMATCH 4
+#define LASTLITERALS 5	// the last 5 bytes are always literals
+#define MFLIMIT 12	// the last match must start at least 12 bytes before the end
+#define MAX_OFFSET 65535
+#define HASH_LOG 12
+#define SKIP_TRIGGER 6
+
+static inline uint32_t
+read32(const uint8_t *p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint32_t
+hash32(uint32_t v) {
+	return (v * 2654435761u) >> (32 - HASH_LOG);
+}
+
+// the bytes of [p, limit) equal to q
+static inline const uint8_t *
+match_end(const uint8_t *p, const uint8_t *q, const uint8_t *limit) {
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	while (p + 8 <= limit) {
+		uint64_t a, b;
+		memcpy(&a, p, sizeof(a));
+		memcpy(&b, q, sizeof(b));
+		uint64_t diff = a ^ b;
+		if (diff) {
+			return p + (__builtin_ctzll(diff) >> 3);
+		}
+		p += 8;
+		q += 8;
+	}
+#endif
+	while (p < limit && *p == *q) {
+		++p;
+		++q;
+	}
+	return p;
+}
+
+// the length which doesn't fit the 4 bits in token
+static inline uint8_t *
+write_length(uint8_t *op, size_t len) {
+	len -= 15;
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = (uint8_t)len;
+	return op;
+}
+
+static inline uint8_t *
+write_literals(uint8_t *op, const uint8_t *literals, size_t len) {
+	uint8_t * token = op++;
+	if (len >= 15) {
+		*token = 15 << 4;
+		op = write_length(op, len);
+	} else {
+		*token = (uint8_t)(len << 4);
+	}
+	memcpy(op, literals, len);
+	return op + len;
+}
+
+size_t
+lz4block_compress(const void *source, size_t sz, void *dest, size_t cap) {
+	const uint8_t * src = (const uint8_t *)source;
+	const uint8_t * iend = src + sz;
+	const uint8_t * anchor = src;
+	uint8_t * op = (uint8_t *)dest;
+	uint8_t * oend = op + cap;
+	if (sz > 0x7e000000) {
+		return 0;
+	}
+	if (sz > MFLIMIT) {
+		uint32_t table[1 << HASH_LOG];
+		memset(table, 0, sizeof(table));
+		const uint8_t * mflimit = iend - MFLIMIT;
+		const uint8_t * matchlimit = iend - LASTLITERALS;
+		const uint8_t * ip = src + 1;
+		unsigned search = 1 << SKIP_TRIGGER;
+		while (ip < mflimit) {
+			uint32_t seq = read32(ip);
+			uint32_t h = hash32(seq);
+			const uint8_t * ref = src + table[h];
+			table[h] = (uint32_t)(ip - src);
+			if (ref >= ip || ip - ref > MAX_OFFSET || read32(ref) != seq) {
+				// step faster when there is no match for a while
+				ip += search++ >> SKIP_TRIGGER;
+				continue;
+			}
+			search = 1 << SKIP_TRIGGER;
+			while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+				--ip;
+				--ref;
+			}
+			const uint8_t * p = match_end(ip + MINMATCH, ref + MINMATCH, matchlimit);
+			size_t lit = ip - anchor;
+			size_t mlen = p - ip - MINMATCH;
+			// token, literals, offset and match length
+			if ((size_t)(oend - op) < 1 + lit + lit / 255 + 1 + 2 + mlen / 255 + 1) {
+				return 0;
+			}
+			uint8_t * token = op;
+			op = write_literals(op, anchor, lit);
+			uint16_t offset = (uint16_t)(ip - ref);
+			op[0] = offset & 0xff;
+			op[1] = offset >> 8;
+			op += 2;
+			if (mlen >= 15) {
+				*token |= 15;
+				op = write_length(op, mlen);
+			} else {
+				*token |= (uint8_t)mlen;
+			}
+			ip = anchor = p;
+			if (ip < mflimit) {
+				table[hash32(read32(ip - 2))] = (uint32_t)(ip - 2 - src);
+			}
+		}
+	}
+	size_t lit = iend - anchor;
+	if ((size_t)(oend - op) < 1 + lit + lit / 255 + 1) {
+		return 0;
+	}
+	op = write_literals(op, anchor, lit);
+	return op - (uint8_t *)dest;
+}
+
+static inline int
+read_length(const uint8_t **ip, const uint8_t *iend, size_t *len) {
+	const uint8_t * p = *ip;
+	uint8_t b;
+	do {
+		if (p >= iend)
+			return 0;
+		b = *p++;
+		*len += b;
+		if (*len > 0x7fffffff)
+			return 0;
+	} while (b == 255);
+	*ip = p;
+	return 1;
+}
+
+int
+lz4block_decompress(const void *source, size_t sz, void *dest, size_t cap) {
+	const uint8_t * ip = (const uint8_t *)source;
+	const uint8_t * iend = ip + sz;
+	uint8_t * op = (uint8_t *)dest;
+	uint8_t * oend = op + cap;
+	if (cap > 0x7fffffff)
+		return -1;
+	while (ip < iend) {
+		uint8_t token = *ip++;
+		size_t lit = token >> 4;
+		if (lit == 15 && !read_length(&ip, iend, &lit))
+			return -1;
+		if (lit > (size_t)(iend - ip) || lit > (size_t)(oend - op))
+			return -1;
+		memcpy(op, ip, lit);
+		op += lit;
+		ip += lit;
+		if (ip == iend) {
+			// the last sequence has only literals
+			break;
+		}
+		if (iend - ip < 2)
+			return -1;
+		size_t offset = ip[0] | ip[1] << 8;
+		ip += 2;
+		if (offset == 0 || offset > (size_t)(op - (uint8_t *)dest))
+			return -1;
+		size_t mlen = token & 15;
+		if (mlen == 15 && !read_length(&ip, iend, &mlen))
+			return -1;
+		mlen += MINMATCH;
+		if (mlen > (size_t)(oend - op))
+			return -1;
+		const uint8_t * match = op - offset;
+		if (offset >= mlen) {
+			memcpy(op, match, mlen);
+			op += mlen;
+		} else {
+			// overlapped, repeat the last offset bytes
+			size_t i;
+			for (i=0;i<mlen;i++) {
+				op[i] = match[i];
+			}
+			op += mlen;
+		}
+	}
+	return (int)(op - (uint8_t *)dest);
+}
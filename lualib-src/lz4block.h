@@ -0,0 +1,20 @@
+#ifndef skynet_lz4block_h
+#define skynet_lz4block_h
+
+#include <stddef.h>
+
+/*
+	LZ4 block format (https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md), without the frame.
+	The data compressed here can be decompressed by liblz4 (LZ4_decompress_safe), and vice versa.
+ */
+
+// max size of compressed data
+#define LZ4BLOCK_BOUND(sz) ((sz) + (sz) / 255 + 16)
+
+// return the compressed size, or 0 when dst is not large enough
+size_t lz4block_compress(const void *src, size_t sz, void *dst, size_t cap);
+
+// return the decompressed size, or -1 when src is invalid or dst is not large enough
+int lz4block_decompress(const void *src, size_t sz, void *dst, size_t cap);
+
+#endif
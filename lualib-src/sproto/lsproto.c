@@ -14,6 +14,11 @@
 
 #define ENCODE_MAXSIZE 0x1000000
 #define ENCODE_DEEPLEVEL 64
+// calculate the size when the buffer (larger than it) is not enough
+#define ENCODE_PRESIZE 0x4000
+
+// the key of compiled plans (see push_plan) in registry
+static int PLANS_KEY = 0;
 
 #ifndef luaL_newlib /* using LuaJIT */
 /*
@@ -152,6 +157,14 @@ ldeleteproto(lua_State *L) {
 		return luaL_argerror(L, 1, "Need a sproto object");
 	}
 	sproto_release(sp);
+	// the address of sproto_type may be reused, clear all the plans
+	lua_pushnil(L);
+	while (lua_next(L, lua_upvalueindex(1)) != 0) {
+		lua_pop(L, 1);
+		lua_pushvalue(L, -1);
+		lua_pushnil(L);
+		lua_rawset(L, lua_upvalueindex(1));
+	}
 	return 0;
 }
 
@@ -172,6 +185,34 @@ lquerytype(lua_State *L) {
 	return 0;
 }
 
+/*
+	The compiled plan of a sproto_type is a lua table (tag -> field name string) in the plans table,
+	so decode sets the fields with the lua strings, instead of creating them from the names by lua_setfield.
+	(encode uses lua_getfield, it's as fast as the plan because of the string cache of lua api.)
+	The plans table (an upvalue of decode and deleteproto, shared in the lua state by registry) is keyed
+	by the address of sproto_type, and it's cleared when any sproto object is deleted.
+ */
+static int
+push_plan(lua_State *L, int plans, const struct sproto_type *st) {
+	if (lua_rawgetp(L, plans, st) != LUA_TTABLE) {
+		lua_pop(L, 1);
+		lua_newtable(L);
+		lua_pushvalue(L, -1);
+		lua_rawsetp(L, plans, st);
+	}
+	return lua_gettop(L);
+}
+
+static void
+push_fieldname(lua_State *L, int plan, const struct sproto_arg *args) {
+	if (lua_rawgeti(L, plan, args->tagid) != LUA_TSTRING) {
+		lua_pop(L, 1);
+		lua_pushstring(L, args->tagname);
+		lua_pushvalue(L, -1);
+		lua_rawseti(L, plan, args->tagid);
+	}
+}
+
 struct encode_ud {
 	lua_State *L;
 	struct sproto_type *st;
@@ -337,6 +378,11 @@ encode_one(const struct sproto_arg *args, struct encode_ud *self) {
 			return luaL_error(L, ".%s[%d] is not a string (Is a %s)", 
 				args->tagname, args->index, lua_typename(L, type));
 		}
+		if (args->value == NULL) {
+			// sproto_encode_size
+			lua_pop(L,1);
+			return sz;
+		}
 		if (sz > args->length)
 			return SPROTO_CB_ERROR;
 		memcpy(args->value, str, sz);
@@ -357,7 +403,11 @@ encode_one(const struct sproto_arg *args, struct encode_ud *self) {
 		sub.iter_func = 0;
 		sub.iter_table = 0;
 		sub.iter_key = 0;
-		r = sproto_encode(args->subtype, args->value, args->length, encode, &sub);
+		if (args->value == NULL) {
+			r = sproto_encode_size(args->subtype, encode, &sub);
+		} else {
+			r = sproto_encode(args->subtype, args->value, args->length, encode, &sub);
+		}
 		lua_settop(L, top-1);	// pop the value
 		if (r < 0) 
 			return SPROTO_CB_ERROR;
@@ -405,6 +455,18 @@ expand_buffer(lua_State *L, int osz, int nsz) {
 	return output;
 }
 
+static void
+reset_encode(lua_State *L, struct encode_ud *self) {
+	self->array_tag = NULL;
+	self->array_index = 0;
+	self->deep = 0;
+	lua_settop(L, self->tbl_index);
+	self->map_entry = 0;
+	self->iter_func = 0;
+	self->iter_table = 0;
+	self->iter_key = 0;
+}
+
 /*
 	lightuserdata sproto_type
 	table source
@@ -426,31 +488,40 @@ lencode(lua_State *L) {
 	self.L = L;
 	self.st = st;
 	self.tbl_index = tbl_index;
+	int presized = 0;
 	for (;;) {
 		int r;
-		self.array_tag = NULL;
-		self.array_index = 0;
-		self.deep = 0;
-
-		lua_settop(L, tbl_index);
-		self.map_entry = 0;
-		self.iter_func = 0;
-		self.iter_table = 0;
-		self.iter_key = 0;
-
+		reset_encode(L, &self);
 		r = sproto_encode(st, buffer, sz, encode, &self);
-		if (r<0) {
-			buffer = expand_buffer(L, sz, sz*2);
-			sz *= 2;
-		} else {
+		if (r >= 0) {
 			lua_pushlstring(L, buffer, r);
 			return 1;
 		}
+		if (presized || sz < ENCODE_PRESIZE) {
+			// the size may change if the object has __pairs metamethod
+			buffer = expand_buffer(L, sz, sz*2);
+		} else {
+			// calculate the size instead of encoding again with a doubled buffer, the buffer is reused later.
+			int need;
+			presized = 1;
+			reset_encode(L, &self);
+			need = sproto_encode_size(st, encode, &self);
+			if (need < 0 || need > ENCODE_MAXSIZE) {
+				return luaL_error(L, "object is too large (>%d)", ENCODE_MAXSIZE);
+			}
+			if (need <= sz) {
+				need = sz * 2;
+			}
+			buffer = expand_buffer(L, sz, need);
+		}
+		sz = lua_tointeger(L, lua_upvalueindex(2));
 	}
 }
 
 struct decode_ud {
 	lua_State *L;
+	int plans;
+	int plan;
 	const char * array_tag;
 	int array_index;
 	int result_index;
@@ -472,8 +543,9 @@ decode(const struct sproto_arg *args) {
 		if (args->tagname != self->array_tag) {
 			self->array_tag = args->tagname;
 			lua_newtable(L);
-			lua_pushvalue(L, -1);
-			lua_setfield(L, self->result_index, args->tagname);
+			push_fieldname(L, self->plan, args);
+			lua_pushvalue(L, -2);
+			lua_settable(L, self->result_index);
 			if (self->array_index) {
 				lua_replace(L, self->array_index);
 			} else {
@@ -526,18 +598,20 @@ decode(const struct sproto_arg *args) {
 			}
 			sub.result_index = self->map_entry;
 		} else {
-			lua_newtable(L);
+			lua_createtable(L, 0, sproto_fieldcount(args->subtype));
 			sub.result_index = lua_gettop(L);
 		}
 		sub.deep = self->deep + 1;
 		sub.array_index = 0;
 		sub.array_tag = NULL;
 		sub.map_entry = 0;
+		sub.plans = self->plans;
 		if (args->mainindex >= 0) {
 			// This struct will set into a map, so mark the main index tag.
 			sub.mainindex_tag = args->mainindex;
 			lua_pushnil(L);
 			sub.key_index = lua_gettop(L);
+			sub.plan = push_plan(L, self->plans, args->subtype);
 
 			r = sproto_decode(args->subtype, args->value, args->length, decode, &sub);
 			if (r < 0)
@@ -568,6 +642,7 @@ decode(const struct sproto_arg *args) {
 		} else {
 			sub.mainindex_tag = -1;
 			sub.key_index = 0;
+			sub.plan = push_plan(L, self->plans, args->subtype);
 			r = sproto_decode(args->subtype, args->value, args->length, decode, &sub);
 			if (r < 0)
 				return SPROTO_CB_ERROR;
@@ -589,7 +664,9 @@ decode(const struct sproto_arg *args) {
 			lua_pushvalue(L,-1);
 			lua_replace(L, self->key_index);
 		}
-		lua_setfield(L, self->result_index, args->tagname);
+		push_fieldname(L, self->plan, args);
+		lua_insert(L, -2);
+		lua_settable(L, self->result_index);
 	}
 
 	return 0;
@@ -631,10 +708,12 @@ ldecode(lua_State *L) {
 	sz = 0;
 	buffer = getbuffer(L, 2, &sz);
 	if (!lua_istable(L, -1)) {
-		lua_newtable(L);
+		lua_createtable(L, 0, sproto_fieldcount(st));
 	}
 	self.L = L;
 	self.result_index = lua_gettop(L);
+	self.plans = lua_upvalueindex(1);
+	self.plan = push_plan(L, self.plans, st);
 	self.array_index = 0;
 	self.array_tag = NULL;
 	self.deep = 0;
@@ -714,6 +793,16 @@ pushfunction_withbuffer(lua_State *L, const char * name, lua_CFunction func) {
 	lua_setfield(L, -2, name);
 }
 
+static void
+push_plans(lua_State *L) {
+	if (lua_rawgetp(L, LUA_REGISTRYINDEX, &PLANS_KEY) != LUA_TTABLE) {
+		lua_pop(L, 1);
+		lua_newtable(L);
+		lua_pushvalue(L, -1);
+		lua_rawsetp(L, LUA_REGISTRYINDEX, &PLANS_KEY);
+	}
+}
+
 static int
 lprotocol(lua_State *L) {
 	struct sproto * sp = lua_touserdata(L, 1);
@@ -885,10 +974,8 @@ luaopen_sproto_core(lua_State *L) {
 #endif
 	luaL_Reg l[] = {
 		{ "newproto", lnewproto },
-		{ "deleteproto", ldeleteproto },
 		{ "dumpproto", ldumpproto },
 		{ "querytype", lquerytype },
-		{ "decode", ldecode },
 		{ "protocol", lprotocol },
 		{ "loadproto", lloadproto },
 		{ "saveproto", lsaveproto },
@@ -896,6 +983,12 @@ luaopen_sproto_core(lua_State *L) {
 		{ NULL, NULL },
 	};
 	luaL_newlib(L,l);
+	push_plans(L);
+	lua_pushvalue(L, -1);
+	lua_pushcclosure(L, ldecode, 1);
+	lua_setfield(L, -3, "decode");
+	lua_pushcclosure(L, ldeleteproto, 1);
+	lua_setfield(L, -2, "deleteproto");
 	pushfunction_withbuffer(L, "encode", lencode);
 	pushfunction_withbuffer(L, "pack", lpack);
 	pushfunction_withbuffer(L, "unpack", lunpack);
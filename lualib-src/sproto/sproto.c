@@ -2,11 +2,14 @@
 #include <string.h>
 #include <stdio.h>
 #include <assert.h>
+#include <limits.h>
 #include "msvcint.h"
 
 #include "sproto.h"
 
 #define CHUNK_SIZE 1000
+// build the tag index of a type when (max tag - min tag + 1) <= fields * TAGINDEX_DENSITY
+#define TAGINDEX_DENSITY 4
 #define SIZEOF_LENGTH 4
 #define SIZEOF_HEADER 2
 #define SIZEOF_FIELD 2
@@ -29,6 +32,7 @@ struct sproto_type {
 	int base;
 	int maxn;
 	struct field *f;
+	struct field **index;	// tag -> field (from f[0].tag), when the tags are not continuous but dense enough
 };
 
 struct protocol {
@@ -347,6 +351,16 @@ import_type(struct sproto *s, struct sproto_type *t, const uint8_t * stream) {
 	n = t->f[n-1].tag - t->base + 1;
 	if (n != t->n) {
 		t->base = -1;
+		if (n <= t->n * TAGINDEX_DENSITY) {
+			int first = t->f[0].tag;
+			t->index = pool_alloc(&s->memory, sizeof(struct field *) * n);
+			if (t->index == NULL)
+				return NULL;
+			memset(t->index, 0, sizeof(struct field *) * n);
+			for (i=0;i<t->n;i++) {
+				t->index[t->f[i].tag - first] = &t->f[i];
+			}
+		}
 	}
 	return result;
 }
@@ -643,6 +657,11 @@ sproto_name(struct sproto_type * st) {
 	return st->name;
 }
 
+int
+sproto_fieldcount(const struct sproto_type * st) {
+	return st->n;
+}
+
 static struct field *
 findtag(const struct sproto_type *st, int tag) {
 	int begin, end;
@@ -652,6 +671,12 @@ findtag(const struct sproto_type *st, int tag) {
 			return NULL;
 		return &st->f[tag];
 	}
+	if (st->index) {
+		tag -= st->f[0].tag;
+		if (tag < 0 || tag > st->f[st->n-1].tag - st->f[0].tag)
+			return NULL;
+		return st->index[tag];
+	}
 	begin = 0;
 	end = st->n;
 	while (begin < end) {
@@ -1055,6 +1080,157 @@ sproto_encode(const struct sproto_type *st, void * buffer, int size, sproto_call
 	return SIZEOF_HEADER + index * SIZEOF_FIELD + datasz;
 }
 
+// size of array (without length prefix), or -1 when error, 0 when no array
+static int
+encode_array_size(sproto_callback cb, struct sproto_arg *args, int *noarray) {
+	int sz;
+	int total = 0;
+	int intlen = SIZEOF_INT32;
+	*noarray = 0;
+	args->index = 1;
+	for (;;) {
+		union {
+			uint64_t u64;
+			uint32_t u32;
+		} u;
+		switch (args->type) {
+		case SPROTO_TDOUBLE:
+		case SPROTO_TINTEGER:
+		case SPROTO_TBOOLEAN:
+			args->value = &u;
+			args->length = sizeof(u);
+			break;
+		default:
+			args->value = NULL;
+			args->length = 0;
+			break;
+		}
+		sz = cb(args);
+		if (sz < 0) {
+			if (sz == SPROTO_CB_NIL)
+				break;
+			if (sz == SPROTO_CB_NOARRAY) {
+				*noarray = 1;
+				return 0;
+			}
+			return -1;	// sz == SPROTO_CB_ERROR
+		}
+		switch (args->type) {
+		case SPROTO_TDOUBLE:
+		case SPROTO_TINTEGER:
+			if (sz == SIZEOF_INT64) {
+				intlen = SIZEOF_INT64;
+			} else if (sz != SIZEOF_INT32) {
+				return -1;
+			}
+			break;
+		case SPROTO_TBOOLEAN:
+			total += 1;
+			break;
+		default:
+			total += SIZEOF_LENGTH + sz;
+			break;
+		}
+		if (total < 0)
+			return -1;
+		++args->index;
+	}
+	if (args->type == SPROTO_TINTEGER || args->type == SPROTO_TDOUBLE) {
+		int n = args->index - 1;
+		if (n == 0)
+			return 0;
+		if (n > (INT_MAX - 1) / SIZEOF_INT64)
+			return -1;
+		// sproto_encode checks the space of int64 for each integer
+		total = 1 + n * intlen + (SIZEOF_INT64 - intlen);
+	}
+	return total;
+}
+
+/*
+	The size of buffer sproto_encode needs (may be a little larger than the result), or -1 when error.
+	The callback is called as sproto_encode, but args->value is NULL (and args->length is 0) for string and struct,
+	it should return the size of the object without writing it.
+ */
+int
+sproto_encode_size(const struct sproto_type *st, sproto_callback cb, void *ud) {
+	struct sproto_arg args;
+	int total = SIZEOF_HEADER + st->maxn * SIZEOF_FIELD;
+	int i;
+	args.ud = ud;
+	for (i=0;i<st->n;i++) {
+		struct field *f = &st->f[i];
+		int type = f->type;
+		int sz;
+		args.tagname = f->name;
+		args.tagid = f->tag;
+		args.subtype = f->st;
+		args.mainindex = f->key;
+		args.extra = f->extra;
+		args.ktagname = NULL;
+		args.vtagname = NULL;
+		if (type & SPROTO_TARRAY) {
+			int noarray;
+			args.type = type & (~SPROTO_TARRAY);
+			if (f->map > 0) {
+				args.ktagname = f->st->f[0].name;
+				args.vtagname = f->st->f[1].name;
+			}
+			sz = encode_array_size(cb, &args, &noarray);
+			if (sz < 0)
+				return -1;
+			if (!noarray)
+				sz += SIZEOF_LENGTH;
+		} else {
+			args.type = type;
+			args.index = 0;
+			switch(type) {
+			case SPROTO_TDOUBLE:
+			case SPROTO_TINTEGER:
+			case SPROTO_TBOOLEAN: {
+				union {
+					uint64_t u64;
+					uint32_t u32;
+				} u;
+				args.value = &u;
+				args.length = sizeof(u);
+				sz = cb(&args);
+				if (sz < 0) {
+					if (sz == SPROTO_CB_NIL)
+						continue;
+					if (sz == SPROTO_CB_NOARRAY)
+						return total;
+					return -1;
+				}
+				if (sz == SIZEOF_INT32) {
+					sz = u.u32 < 0x7fff ? 0 : SIZEOF_LENGTH + SIZEOF_INT32;
+				} else if (sz == SIZEOF_INT64) {
+					sz = SIZEOF_LENGTH + SIZEOF_INT64;
+				} else {
+					return -1;
+				}
+				break;
+			}
+			default:
+				args.value = NULL;
+				args.length = 0;
+				sz = cb(&args);
+				if (sz < 0) {
+					if (sz == SPROTO_CB_NIL)
+						continue;
+					return -1;
+				}
+				sz += SIZEOF_LENGTH;
+				break;
+			}
+		}
+		total += sz;
+		if (total < 0)
+			return -1;
+	}
+	return total;
+}
+
 static int
 decode_array_object(sproto_callback cb, struct sproto_arg *args, uint8_t * stream, int sz) {
 	uint32_t hsz;
@@ -62,9 +62,12 @@ typedef int (*sproto_callback)(const struct sproto_arg *args);
 
 int sproto_decode(const struct sproto_type *, const void * data, int size, sproto_callback cb, void *ud);
 int sproto_encode(const struct sproto_type *, void * buffer, int size, sproto_callback cb, void *ud);
+// the buffer size sproto_encode needs, args->value is NULL for string and struct in callback
+int sproto_encode_size(const struct sproto_type *, sproto_callback cb, void *ud);
 
 // for debug use
 void sproto_dump(struct sproto *);
 const char * sproto_name(struct sproto_type *);
+int sproto_fieldcount(const struct sproto_type *);
 
 #endif
@@ -1,6 +1,7 @@
 local internal = require "http.internal"
 
 local string = string
+local table = table
 local type = type
 local assert = assert
 local tonumber = tonumber
@@ -53,23 +54,32 @@ local http_status_msg = {
 	[505] = "HTTP Version not supported",
 }
 
-local function readall(readbytes, bodylimit)
-	local tmpline = {}
-	local body = internal.recvheader(readbytes, tmpline, "")
-	if not body then
+-- HTTP/1.1 keeps the connection alive unless "connection: close", HTTP/1.0 needs "connection: keep-alive"
+local function keepalive(httpver, header)
+	local connection = header["connection"]
+	if type(connection) ~= "string" then
+		return httpver >= 1.1
+	end
+	connection = connection:lower()
+	if httpver >= 1.1 then
+		return not connection:find("close", 1, true)
+	else
+		return connection:find("keep-alive", 1, true) ~= nil
+	end
+end
+
+local function readall(readbytes, bodylimit, buffer)
+	local header = {}
+	local method, url, httpver, body = internal.recvrequest(readbytes, header, buffer or "")
+	if method == nil then
 		return 413	-- Request Entity Too Large
+	elseif method == false then
+		return 400	-- Bad request
 	end
-	local request = assert(tmpline[1])
-	local method, url, httpver = request:match "^(%a+)%s+(.-)%s+HTTP/([%d%.]+)$"
-	assert(method and url and httpver)
-	httpver = assert(tonumber(httpver))
 	if httpver < 1.0 or httpver > 1.1 then
 		return 505	-- HTTP Version not supported
 	end
-	local header = internal.parseheader(tmpline,2,{})
-	if not header then
-		return 400	-- Bad request
-	end
+	local rest = ""
 	local length = header["content-length"]
 	if length then
 		length = tonumber(length)
@@ -82,7 +92,7 @@ local function readall(readbytes, bodylimit)
 	end
 
 	if mode == "chunked" then
-		body, header = internal.recvchunkedbody(readbytes, bodylimit, header, body)
+		body, header, rest = internal.recvchunkedbody(readbytes, bodylimit, header, body)
 		if not body then
 			return 413
 		end
@@ -93,45 +103,75 @@ local function readall(readbytes, bodylimit)
 				return 413
 			end
 			if #body >= length then
+				rest = body:sub(length+1)
 				body = body:sub(1,length)
 			else
 				local padding = readbytes(length - #body)
 				body = body .. padding
 			end
+		else
+			-- no body, the rest is the next request (pipelining)
+			rest = body
+			body = ""
 		end
 	end
 
-	return 200, url, method, header, body
+	if not keepalive(httpver, header) then
+		rest = nil
+	end
+
+	return 200, url, method, header, body, rest
 end
 
+-- read_request(readbytes, bodylimit, buffer)
+-- buffer is the rest of last request in the keep-alive connection.
+-- The 6th return value is the rest of this request (next requests pipelined), or nil when the connection should be closed.
 function httpd.read_request(...)
-	local ok, code, url, method, header, body = pcall(readall, ...)
+	local ok, code, url, method, header, body, rest = pcall(readall, ...)
 	if ok then
-		return code, url, method, header, body
+		return code, url, method, header, body, rest
 	else
 		return nil, code
 	end
 end
 
-local function writeall(writefunc, statuscode, bodyfunc, header)
-	local statusline = string.format("HTTP/1.1 %03d %s\r\n", statuscode, http_status_msg[statuscode] or "")
-	writefunc(statusline)
+-- the status line and header in one string, write it once
+local function genheader(statuscode, header)
+	local tmp = { string.format("HTTP/1.1 %03d %s\r\n", statuscode, http_status_msg[statuscode] or "") }
 	if header then
 		for k,v in pairs(header) do
 			if type(v) == "table" then
 				for _,v in ipairs(v) do
-					writefunc(string.format("%s: %s\r\n", k,v))
+					tmp[#tmp+1] = string.format("%s: %s\r\n", k,v)
 				end
 			else
-				writefunc(string.format("%s: %s\r\n", k,v))
+				tmp[#tmp+1] = string.format("%s: %s\r\n", k,v)
 			end
 		end
 	end
+	return tmp
+end
+
+local function writeheader(writefunc, statuscode, header)
+	writefunc(table.concat(genheader(statuscode, header)))
+end
+
+local function writeall(writefunc, statuscode, bodyfunc, header)
 	local t = type(bodyfunc)
 	if t == "string" then
-		writefunc(string.format("content-length: %d\r\n\r\n", #bodyfunc))
-		writefunc(bodyfunc)
-	elseif t == "function" then
+		local tmp = genheader(statuscode, header)
+		tmp[#tmp+1] = string.format("content-length: %d\r\n\r\n", #bodyfunc)
+		if #bodyfunc < 4096 then
+			tmp[#tmp+1] = bodyfunc
+			writefunc(table.concat(tmp))
+		else
+			writefunc(table.concat(tmp))
+			writefunc(bodyfunc)
+		end
+		return
+	end
+	writeheader(writefunc, statuscode, header)
+	if t == "function" then
 		writefunc("transfer-encoding: chunked\r\n")
 		while true do
 			local s = bodyfunc()
@@ -155,4 +195,36 @@ function httpd.write_response(...)
 	return pcall(writeall, ...)
 end
 
+local function writefile(writefunc, sendfilefunc, statuscode, filename, header)
+	local f = assert(io.open(filename, "rb"))
+	local size = f:seek "end"
+	writeheader(writefunc, statuscode, header)
+	writefunc(string.format("content-length: %d\r\n\r\n", size))
+	if sendfilefunc then
+		-- the file content goes from kernel to socket, without copying into lua.
+		-- send from the file opened here, the size is the same as content-length even if the file is replaced.
+		local ok, err = pcall(sendfilefunc, f, 0, size)
+		f:close()
+		if not ok then
+			error(err)
+		end
+	else
+		-- sendfile is not available (eg. https), read the file by block
+		f:seek "set"
+		while true do
+			local s = f:read(65536)
+			if not s then
+				break
+			end
+			writefunc(s)
+		end
+		f:close()
+	end
+end
+
+-- sendfilefunc can be nil, see sockethelper.sendfilefunc
+function httpd.write_file_response(...)
+	return pcall(writefile, ...)
+end
+
 return httpd
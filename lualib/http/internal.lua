@@ -1,3 +1,5 @@
+local httpparser = require "skynet.httpparser"
+
 local table = table
 local type = type
 local string = string
@@ -13,12 +15,11 @@ local LIMIT = 8192
 
 local function chunksize(readbytes, body)
 	while true do
-		local f,e = body:find("\r\n",1,true)
-		if f then
-			return tonumber(body:sub(1,f-1),16), body:sub(e+1)
-		end
-		if #body > 128 then
-			-- pervent the attacker send very long stream without \r\n
+		local sz, offset = httpparser.chunksize(body)
+		if sz then
+			return sz, body:sub(offset)
+		elseif sz == false then
+			-- invalid chunk size, or the attacker send very long stream without \r\n
 			return
 		end
 		body = body .. readbytes()
@@ -106,8 +107,59 @@ function M.parseheader(lines, from, header)
 	return header
 end
 
+-- parse the head by lualib-src/lua-httpparser.c, the head is never split into lines
+
+local function recvhead(parser, readbytes, header, buffer)
+	local from = 1
+	while true do
+		local a, b, c, d = parser(buffer, header, from)
+		if a then
+			return buffer, a, b, c, d
+		elseif a == false then
+			return false
+		end
+		if #buffer > LIMIT then
+			return
+		end
+		-- \r\n\r\n may be across the boundary
+		from = #buffer > 3 and #buffer - 2 or 1
+		buffer = buffer .. readbytes()
+	end
+end
+
+-- return method, url, httpver, rest of buffer ; nil when the header is too large, false when it's invalid
+function M.recvrequest(readbytes, header, buffer)
+	local buffer, method, url, httpver, offset = recvhead(httpparser.request, readbytes, header, buffer)
+	if not buffer then
+		return buffer
+	end
+	return method, url, httpver, buffer:sub(offset)
+end
+
+-- return code, info, rest of buffer
+function M.recvresponse(readbytes, header, buffer)
+	local buffer, code, info, offset = recvhead(httpparser.response, readbytes, header, buffer)
+	if not buffer then
+		return buffer
+	end
+	return code, info, buffer:sub(offset)
+end
+
+-- read trailer (or header) lines, return the rest of buffer
+local function recvtrailer(readbytes, header, buffer)
+	while true do
+		local offset = httpparser.header(buffer, header)
+		if offset then
+			return buffer:sub(offset)
+		elseif offset == false or #buffer > LIMIT then
+			return
+		end
+		buffer = buffer .. readbytes()
+	end
+end
+
 function M.recvchunkedbody(readbytes, bodylimit, header, body)
-	local result = ""
+	local result = {}
 	local size = 0
 
 	while true do
@@ -124,10 +176,11 @@ function M.recvchunkedbody(readbytes, bodylimit, header, body)
 			return
 		end
 		if #body >= sz then
-			result = result .. body:sub(1,sz)
+			result[#result+1] = body:sub(1,sz)
 			body = body:sub(sz+1)
 		else
-			result = result .. body .. readbytes(sz - #body)
+			result[#result+1] = body
+			result[#result+1] = readbytes(sz - #body)
 			body = ""
 		end
 		body = readcrln(readbytes, body)
@@ -136,15 +189,12 @@ function M.recvchunkedbody(readbytes, bodylimit, header, body)
 		end
 	end
 
-	local tmpline = {}
-	body = M.recvheader(readbytes, tmpline, body)
+	body = recvtrailer(readbytes, header, body)
 	if not body then
 		return
 	end
 
-	header = M.parseheader(tmpline,1,header)
-
-	return result, header
+	return table.concat(result), header, body
 end
 
 local function recvbody(interface, code, header, body)
@@ -193,18 +243,11 @@ function M.request(interface, method, host, url, recvheader, header, content)
 		write(request_header)
 	end
 
-	local tmpline = {}
-	local body = M.recvheader(read, tmpline, "")
-	if not body then
+	local header = recvheader or {}
+	local code, info, body = M.recvresponse(read, header, "")
+	if code == nil then
 		error("Recv header failed")
-	end
-
-	local statusline = tmpline[1]
-	local code, info = statusline:match "HTTP/[%d%.]+%s+([%d]+)%s+(.*)$"
-	code = assert(tonumber(code))
-
-	local header = M.parseheader(tmpline,2,recvheader or {})
-	if not header then
+	elseif code == false then
 		error("Invalid HTTP response header")
 	end
 	return code, body, header
@@ -313,16 +356,13 @@ local function stream_chunked(stream)
 
 	if sz == 0 then
 		-- last chunk
-		local tmpline = {}
-		body = M.recvheader(read, tmpline, body)
+		body = recvtrailer(read, stream.header, body)
 		if not body then
 			stream.connected = false
 			stream:close()
 			return
 		end
 
-		M.parseheader(tmpline,1, stream.header)
-
 		stream._reading = stream.close
 		stream.connected = nil
 		return ""
@@ -82,6 +82,17 @@ function sockethelper.writefunc(fd)
 	end
 end
 
+function sockethelper.sendfilefunc(fd)
+	-- file is a filename or a file opened by io.open
+	return function(file, offset, sz)
+		local ok, err = socket.sendfile(fd, file, offset, sz)
+		if not ok then
+			error(socket_error("sendfile failed fd = " .. fd .. " " .. tostring(err)))
+		end
+		return err
+	end
+end
+
 function sockethelper.connect(host, port, timeout)
 	local fd, err
 	local is_time_out = false
@@ -1,10 +1,13 @@
 local internal = require "http.internal"
 local socket = require "skynet.socket"
 local crypt = require "skynet.crypt"
+local wscodec = require "skynet.websocket"
 local httpd = require "http.httpd"
 local skynet = require "skynet"
 local sockethelper = require "http.sockethelper"
 local socket_error = sockethelper.socket_error
+-- permessage-deflate needs wsdeflate (build with ZLIB_MODULE=wsdeflate)
+local has_deflate, wsdeflate = pcall(require, "wsdeflate")
 
 local GLOBAL_GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
 local MAX_FRAME_SIZE = 256 * 1024 -- max frame is 256K
@@ -96,33 +99,53 @@ local function write_handshake(self, host, url, header)
     if sw_key ~= crypt.sha1(key .. guid) then
         error("websocket handshake invalid Sec-WebSocket-Accept")
     end
+
+    local extensions = recvheader["sec-websocket-extensions"]
+    if extensions and extensions:find("permessage-deflate", 1, true) then
+        if not has_deflate then
+            error("websocket handshake permessage-deflate is not supported")
+        end
+        self.deflate = true
+    end
+end
+
+local DEFLATE_RESPONSE = "Sec-WebSocket-Extensions: permessage-deflate; server_no_context_takeover; client_no_context_takeover\r\n"
+
+-- accept permessage-deflate without context takeover, the window of server is always 15 bits
+local function accept_deflate(extensions)
+    if not extensions then
+        return false
+    end
+    for offer in extensions:gmatch "[^,]+" do
+        if offer:match "^%s*permessage%-deflate" and not offer:find("server_max_window_bits", 1, true) then
+            return true
+        end
+    end
+    return false
 end
 
-local function read_handshake(self, upgrade_ops)
+local function read_handshake(self, upgrade_ops, deflate)
     local header, method, url
     if upgrade_ops then
         header, method, url = upgrade_ops.header, upgrade_ops.method, upgrade_ops.url
     else
-        local tmpline = {}
-        local payload = internal.recvheader(self.read, tmpline, "")
-        if not payload then
+        local httpver, payload
+        header = {}
+        method, url, httpver, payload = internal.recvrequest(self.read, header, "")
+        if method == nil then
             return 413
+        elseif method == false then
+            return 400  -- Bad request
         end
         reader_with_payload(self, payload)
 
-        local request = assert(tmpline[1])
-        local httpver
-        method, url, httpver = request:match "^(%a+)%s+(.-)%s+HTTP/([%d%.]+)$"
-        assert(method and url and httpver)
         if method ~= "GET" then
             return 400, "need GET method"
         end
 
-        httpver = assert(tonumber(httpver))
         if httpver < 1.1 then
             return 505  -- HTTP Version not supported
         end
-        header = internal.parseheader(tmpline, 2, {})
     end
 
     if not header then
@@ -173,6 +196,12 @@ local function read_handshake(self, upgrade_ops)
     -- read 'x-real-ip' header from nginx
     self.real_ip = header["x-real-ip"]
 
+    local extension = ""
+    if deflate and has_deflate and accept_deflate(header["sec-websocket-extensions"]) then
+        self.deflate = true
+        extension = DEFLATE_RESPONSE
+    end
+
     -- response handshake
     local accept = crypt.base64encode(crypt.sha1(sw_key .. self.guid))
     local resp = "HTTP/1.1 101 Switching Protocols\r\n"..
@@ -180,6 +209,7 @@ local function read_handshake(self, upgrade_ops)
                  "Connection: Upgrade\r\n"..
     string.format("Sec-WebSocket-Accept: %s\r\n", accept)..
                   sub_pro ..
+                  extension ..
                   "\r\n"
     self.write(resp)
     return nil, header, url
@@ -208,32 +238,18 @@ local op_code = {
     [0x0A]     = "pong",
 }
 
-local function write_frame(self, op, payload_data, masking_key)
-    payload_data = payload_data or ""
-    local payload_len = #payload_data
+local function write_frame(self, op, payload_data, masking_key, compressed)
     local op_v = assert(op_code[op])
-    local v1 = 0x80 | op_v -- fin is 1 with opcode
-    local s
-    local mask = masking_key and 0x80 or 0x00
-    -- mask set to 0
-    if payload_len < 126 then
-        s = string.pack("I1I1", v1, mask | payload_len)
-    elseif payload_len <= 0xffff then
-        s = string.pack("I1I1>I2", v1, mask | 126, payload_len)
-    else
-        s = string.pack("I1I1>I8", v1, mask | 127, payload_len)
-    end
-    self.write(s)
+    -- header, masking key and payload in one string, see lualib-src/lua-websocket.c
+    self.write(wscodec.frame(op_v, payload_data, masking_key, compressed))
+end
 
-    -- write masking_key
-    if masking_key then
-        s = string.pack(">I4", masking_key)
-        self.write(s)
-        payload_data = crypt.xor_str(payload_data, s)
-    end
 
-    if payload_len > 0 then
-        self.write(payload_data)
+local function write_message(self, op, payload_data, masking_key)
+    if self.deflate then
+        write_frame(self, op, wsdeflate.deflate(payload_data), masking_key, true)
+    else
+        write_frame(self, op, payload_data, masking_key)
     end
 end
 
@@ -249,40 +265,82 @@ local function read_close(payload_data)
 end
 
 
+-- return fin, op, payload_data (masked), masking_key, offset of payload, rsv1
 local function read_frame(self)
-    local s = self.read(2)
-    local v1, v2 = string.unpack("I1I1", s)
-    local fin  = (v1 & 0x80) ~= 0
-    -- unused flag
-    -- local rsv1 = (v1 & 0x40) ~= 0
-    -- local rsv2 = (v1 & 0x20) ~= 0
-    -- local rsv3 = (v1 & 0x10) ~= 0
-    local op   =  v1 & 0x0f
-    local mask = (v2 & 0x80) ~= 0
-    local payload_len = (v2 & 0x7f)
-    if payload_len == 126 then
-        s = self.read(2)
-        payload_len = string.unpack(">I2", s)
-    elseif payload_len == 127 then
-        s = self.read(8)
-        payload_len = string.unpack(">I8", s)
+    local head = self.read(2)
+    local fin, op, rsv1, payload_len, masking_key = wscodec.header(head)
+    local payload_data, offset
+    if fin == nil then
+        -- op is the size of the rest header, and rsv1 is the payload_len if it's less than 126
+        local ext_sz, sz = op, rsv1
+        if sz then
+            -- small frame, read the rest header and payload together
+            payload_data = self.read(ext_sz + sz)
+            offset = ext_sz
+            fin, op, rsv1, payload_len, masking_key = wscodec.header(head, payload_data)
+        else
+            fin, op, rsv1, payload_len, masking_key = wscodec.header(head, self.read(ext_sz))
+        end
     end
 
     if self.mode == "server" and payload_len > MAX_FRAME_SIZE then
         error("payload_len is too large")
     end
 
-    -- print(string.format("fin:%s, op:%s, mask:%s, payload_len:%s", fin, op_code[op], mask, payload_len))
-    local masking_key = mask and self.read(4) or false
-    local payload_data = payload_len>0 and self.read(payload_len) or ""
-    payload_data = masking_key and crypt.xor_str(payload_data, masking_key) or payload_data
-    return fin, assert(op_code[op]), payload_data
+    -- print(string.format("fin:%s, op:%s, mask:%s, payload_len:%s", fin, op_code[op], masking_key, payload_len))
+    if not payload_data then
+        payload_data = payload_len>0 and self.read(payload_len) or ""
+        offset = 0
+    end
+    return fin, assert(op_code[op]), payload_data, masking_key, offset, rsv1
+end
+
+
+local function inflate(self, payload_data)
+    return wsdeflate.inflate(payload_data, self.mode == "server" and MAX_FRAME_SIZE or nil)
+end
+
+
+-- return op, payload_data ; control frames (close/ping/pong) may be returned among the fragments of a message
+local function read_message(self)
+    while true do
+        local fin, op, payload_data, masking_key, offset, rsv1 = read_frame(self)
+        if op == "close" or op == "ping" or op == "pong" then
+            return op, wscodec.unmask(payload_data, masking_key, offset)
+        end
+        local fragment = self.fragment
+        if fin and not fragment then
+            payload_data = wscodec.unmask(payload_data, masking_key, offset)
+            if rsv1 and self.deflate then
+                payload_data = inflate(self, payload_data)
+            end
+            return op, payload_data
+        end
+        if not fragment then
+            fragment = { op = op, compressed = rsv1 and self.deflate }
+            self.fragment = fragment
+        end
+        local buffer = self.buffer
+        if not buffer then
+            buffer = wscodec.buffer(self.mode == "server" and MAX_FRAME_SIZE or nil)
+            self.buffer = buffer
+        end
+        buffer:append(payload_data, masking_key, offset)
+        if fin then
+            self.fragment = nil
+            payload_data = buffer:result()
+            if fragment.compressed then
+                payload_data = inflate(self, payload_data)
+            end
+            return fragment.op, payload_data
+        end
+    end
 end
 
 
 local function resolve_accept(self, options)
     try_handle(self, "connect")
-    local code, err, url = read_handshake(self, options and options.upgrade)
+    local code, err, url = read_handshake(self, options and options.upgrade, options and options.deflate)
     if code then
         local ok, s = httpd.write_response(self.write, code, err)
         if not ok then
@@ -294,15 +352,12 @@ local function resolve_accept(self, options)
 
     local header = err
     try_handle(self, "handshake", header, url)
-    local recv_count = 0
-    local recv_buf = {}
-    local first_op
     while true do
         if _isws_closed(self.id) then
             try_handle(self, "close")
             return
         end
-        local fin, op, payload_data = read_frame(self)
+        local op, payload_data = read_message(self)
         if op == "close" then
             local code, reason = read_close(payload_data)
             write_frame(self, "close")
@@ -314,23 +369,7 @@ local function resolve_accept(self, options)
         elseif op == "pong" then
             try_handle(self, "pong")
         else
-            if fin and #recv_buf == 0 then
-                try_handle(self, "message", payload_data, op)
-            else
-                recv_buf[#recv_buf+1] = payload_data
-                recv_count = recv_count + #payload_data
-                if recv_count > MAX_FRAME_SIZE then
-                    error("payload_len is too large")
-                end
-                first_op = first_op or op
-                if fin then
-                    local s = table.concat(recv_buf)
-                    try_handle(self, "message", s, first_op)
-                    recv_buf = {}  -- clear recv_buf
-                    recv_count = 0
-                    first_op = nil
-                end
-            end
+            try_handle(self, "message", payload_data, op)
         end
     end
 end
@@ -426,6 +465,7 @@ end
 
 -- handle interface
 -- connect / handshake / message / ping / pong / close / error
+-- options : { upgrade = { header, method, url }, deflate = true (enable permessage-deflate) }
 function M.accept(socket_id, handle, protocol, addr, options)
     if not (options and options.upgrade) then
         local isok, err = socket.start(socket_id)
@@ -503,25 +543,15 @@ end
 
 function M.read(id)
     local ws_obj = assert(ws_pool[id])
-    local recv_buf
     while true do
-        local fin, op, payload_data = read_frame(ws_obj)
+        local op, payload_data = read_message(ws_obj)
         if op == "close" then
             _close_websocket(ws_obj)
             return false, payload_data
         elseif op == "ping" then
             write_frame(ws_obj, "pong", payload_data)
         elseif op ~= "pong" then  -- op is frame, text binary
-            if fin and not recv_buf then
-                return payload_data
-            else
-                recv_buf = recv_buf or {}
-                recv_buf[#recv_buf+1] = payload_data
-                if fin then
-                    local s = table.concat(recv_buf)
-                    return s
-                end
-            end
+            return payload_data
         end
     end
 end
@@ -531,7 +561,7 @@ function M.write(id, data, fmt, masking_key)
     local ws_obj = assert(ws_pool[id])
     fmt = fmt or "text"
     assert(fmt == "text" or fmt == "binary")
-    write_frame(ws_obj, fmt, data, masking_key)
+    write_message(ws_obj, fmt, data, masking_key)
 end
 
 
@@ -694,6 +694,13 @@ function skynet.send(addr, typename, ...)
 	return c.send(addr, p.id, 0 , p.pack(...))
 end
 
+-- Send the message to the services in addrs (an array), the local ones share one copy of it. It's read-only for them,
+-- and it can't be kept after dispatching. Returns the number of services sent to.
+function skynet.broadcast(addrs, typename, ...)
+	local p = proto[typename]
+	return c.broadcast(addrs, p.id, p.pack(...))
+end
+
 function skynet.rawsend(addr, typename, msg, sz)
 	local p = proto[typename]
 	return c.send(addr, p.id, 0 , msg, sz)
@@ -706,6 +713,16 @@ skynet.redirect = function(dest,source,typename,...)
 end
 
 skynet.pack = assert(c.pack)
+-- the same as skynet.pack, but each table has the size of its hash part, skynet.unpack doesn't rehash the large
+-- dictionaries. The older version (before the message header) can't read it.
+skynet.packhint = assert(c.packhint)
+-- the same as skynet.pack, but the repeated short strings (keys of records) are written as references.
+-- skynet.unpack decodes both.
+skynet.packintern = assert(c.packintern)
+-- skynet.compress(msg, sz [, threshold]) or skynet.compress(str [, threshold])
+-- returns the compressed message (skynet.unpack decodes it) when it's larger than threshold (4096 by default) and compressible,
+-- or nothing. The msg is not freed.
+skynet.compress = assert(c.compress)
 skynet.packstring = assert(c.packstring)
 skynet.unpack = assert(c.unpack)
 skynet.tostring = assert(c.tostring)
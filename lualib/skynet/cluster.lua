@@ -1,9 +1,12 @@
 local skynet = require "skynet"
+local core = require "skynet.cluster.core"
 
 local clusterd
 local cluster = {}
 local sender = {}
 local task_queue = {}
+local batch_threshold = {}	-- node : the size of batch, see cluster.batch
+local batch = {}	-- node : the pushes not sent
 
 local function repack(address, ...)
 	return address, skynet.pack(...)
@@ -20,10 +23,16 @@ local function request_sender(q, node)
 	q.confirm = confirm
 	q.sender = c
 	for _, task in ipairs(q) do
-		if type(task) == "string" then
+		local t = type(task)
+		if t == "string" then
 			if c then
 				skynet.send(c, "lua", "push", repack(skynet.unpack(task)))
 			end
+		elseif t == "table" then
+			-- batch of pushes
+			if c then
+				skynet.send(c, "lua", "pushbatch", task[1])
+			end
 		else
 			skynet.wakeup(task)
 			skynet.wait(confirm)
@@ -57,7 +66,47 @@ end
 
 cluster.get_sender = get_sender
 
+local function flush_batch(node)
+	local b = batch[node]
+	if not b then
+		return
+	end
+	batch[node] = nil
+	local pushes = table.concat(b)
+	local s = sender[node]
+	if not s then
+		table.insert(task_queue[node], { pushes })
+	else
+		skynet.send(s, "lua", "pushbatch", pushes)
+	end
+end
+
+local function batch_send(node, threshold, address, ...)
+	local b = batch[node]
+	if not b then
+		b = { size = 0 }
+		batch[node] = b
+		skynet.timeout(0, function()
+			if batch[node] == b then
+				flush_batch(node)
+			end
+		end)
+	end
+	-- push package with "ext" header, see lua-cluster.c
+	local msg, sz = skynet.pack(...)
+	local push = core.packpush(address, 1, msg, sz, true)
+	b[#b+1] = push
+	b.size = b.size + #push
+	if b.size >= threshold then
+		flush_batch(node)
+	end
+end
+
 function cluster.call(node, address, ...)
+	if batch[node] then
+		-- the pushes before this call
+		flush_batch(node)
+	end
 	-- skynet.pack(...) will free by cluster.core.packrequest
 	local s = sender[node]
 	if not s then
@@ -68,6 +117,10 @@ function cluster.call(node, address, ...)
 end
 
 function cluster.send(node, address, ...)
+	local threshold = batch_threshold[node]
+	if threshold then
+		return batch_send(node, threshold, address, ...)
+	end
 	-- push is the same with req, but no response
 	local s = sender[node]
 	if not s then
@@ -77,6 +130,17 @@ function cluster.send(node, address, ...)
 	end
 end
 
+-- The pushes (cluster.send) of this service to node are sent in batch, when the size of batch reaches threshold
+-- (64K by default) or at the next tick. The peer dispatches them in one pass. threshold = false turns it off.
+function cluster.batch(node, threshold)
+	if threshold == false then
+		flush_batch(node)
+		batch_threshold[node] = nil
+	else
+		batch_threshold[node] = threshold or 0x10000
+	end
+end
+
 function cluster.open(port, maxclient)
 	if type(port) == "string" then
 		return skynet.call(clusterd, "lua", "listen", port, nil, maxclient)
@@ -393,6 +393,7 @@ end
 
 socket.write = assert(driver.send)
 socket.lwrite = assert(driver.lsend)
+socket.sendfile = assert(driver.sendfile)
 socket.header = assert(driver.header)
 
 function socket.invalid(id)
@@ -406,12 +407,13 @@ function socket.disconnected(id)
 	end
 end
 
-function socket.listen(host, port, backlog)
+-- set reuseport to share the port with other listeners (SO_REUSEPORT)
+function socket.listen(host, port, backlog, reuseport)
 	if port == nil then
 		host, port = string.match(host, "([^:]+):(.+)$")
 		port = tonumber(port)
 	end
-	local id = driver.listen(host, port, backlog)
+	local id = driver.listen(host, port, backlog, reuseport)
 	local s = {
 		id = id,
 		connected = false,
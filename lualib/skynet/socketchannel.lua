@@ -35,6 +35,7 @@ function socket_channel.channel(desc)
 		__result = {}, -- response result { coroutine -> result }
 		__result_data = {},
 		__connecting = {},
+		__connect_sleep = false,	-- the coroutine sleeping before reconnect
 		__sock = false,
 		__closed = false,
 		__authcoroutine = false,
@@ -402,13 +403,17 @@ local function try_connect(self , once)
 		else
 			skynet.error("socket: connect", err)
 		end
+		-- channel:close() breaks the sleep
+		local co = coroutine.running()
+		self.__connect_sleep = co
 		if t > 1000 then
 			skynet.error("socket: try to reconnect", self.__host, self.__port)
-			skynet.sleep(t)
+			skynet.sleep(t, co)
 			t = 0
 		else
-			skynet.sleep(t)
+			skynet.sleep(t, co)
 		end
+		self.__connect_sleep = false
 		t = t + 100
 	end
 end
@@ -537,17 +542,32 @@ function channel:request(request, response, padding)
 	return wait_for_response(self, response)
 end
 
-function channel:response(response)
-	assert(block_connect(self))
+-- once : don't reconnect if it's not connected, raise an error
+function channel:response(response, once)
+	assert(block_connect(self, once))
 
 	return wait_for_response(self, response)
 end
 
+-- wakeup the coroutine waiting for the response (session mode) with an error, when the request is not sent
+function channel:cancel(response, errmsg)
+	local co = self.__thread[response]
+	if co then
+		self.__thread[response] = nil
+		self.__result[co] = socket_error
+		self.__result_data[co] = errmsg
+		skynet.wakeup(co)
+	end
+end
+
 function channel:close()
 	if not self.__closed then
 		term_dispatch_thread(self)
 		self.__closed = true
 		close_channel_socket(self)
+		if self.__connect_sleep then
+			skynet.wakeup(self.__connect_sleep)
+		end
 	end
 end
 
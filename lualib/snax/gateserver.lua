@@ -42,8 +42,14 @@ function gateserver.start(handler)
 		local port = assert(conf.port)
 		maxclient = conf.maxclient or 1024
 		nodelay = conf.nodelay
+		if conf.header or conf.slice then
+			-- conf.header : length field of package, "2be" (default), "2le", "4be", "4le", "varint", "ext", with optional "+N" fixed header
+			-- conf.slice : handler.message(fd, msg, sz, slice) gets a slice of socket buffer, release it by netpack.release(slice)
+			queue = netpack.queue(conf.header, conf.maxpackage, conf.slice)
+		end
 		skynet.error(string.format("Listen on %s:%d", address, port))
-		socket = socketdriver.listen(address, port, conf.backlog)
+		-- conf.reuseport : many gates can listen on the same port, the kernel distributes connections among them
+		socket = socketdriver.listen(address, port, conf.backlog, conf.reuseport)
 		listen_context.co = coroutine.running()
 		listen_context.fd = socket
 		skynet.wait(listen_context.co)
@@ -63,26 +69,26 @@ function gateserver.start(handler)
 
 	local MSG = {}
 
-	local function dispatch_msg(fd, msg, sz)
+	local function dispatch_msg(fd, msg, sz, slice)
 		if connection[fd] then
-			handler.message(fd, msg, sz)
+			handler.message(fd, msg, sz, slice)
 		else
-			skynet.error(string.format("Drop message from fd (%d) : %s", fd, netpack.tostring(msg,sz)))
+			skynet.error(string.format("Drop message from fd (%d) : %s", fd, netpack.tostring(msg,sz,slice)))
 		end
 	end
 
 	MSG.data = dispatch_msg
 
 	local function dispatch_queue()
-		local fd, msg, sz = netpack.pop(queue)
+		local fd, msg, sz, slice = netpack.pop(queue)
 		if fd then
 			-- may dispatch even the handler.message blocked
 			-- If the handler.message never block, the queue should be empty, so only fork once and then exit.
 			skynet.fork(dispatch_queue)
-			dispatch_msg(fd, msg, sz)
+			dispatch_msg(fd, msg, sz, slice)
 
-			for fd, msg, sz in netpack.pop, queue do
-				dispatch_msg(fd, msg, sz)
+			for fd, msg, sz, slice in netpack.pop, queue do
+				dispatch_msg(fd, msg, sz, slice)
 			end
 		end
 	end
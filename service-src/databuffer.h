@@ -5,6 +5,8 @@
 #include <string.h>
 #include <assert.h>
 
+#include "packet_header.h"
+
 #define MESSAGEPOOL 1023
 
 struct message {
@@ -122,21 +124,41 @@ databuffer_push(struct databuffer *db, struct messagepool *mp, void *data, int s
 	}
 }
 
+static void
+databuffer_peek(struct databuffer *db, char * buffer, int sz) {
+	assert(db->size >= sz);
+	struct message *current = db->head;
+	int offset = db->offset;
+	while (sz > 0) {
+		int bsz = current->size - offset;
+		if (bsz > sz) {
+			bsz = sz;
+		}
+		memcpy(buffer, current->buffer + offset, bsz);
+		buffer += bsz;
+		sz -= bsz;
+		current = current->next;
+		offset = 0;
+	}
+}
+
+// return -1 when the package is not complete, -2 when the length field is invalid
 static int
-databuffer_readheader(struct databuffer *db, struct messagepool *mp, int header_size) {
+databuffer_readheader(struct databuffer *db, struct messagepool *mp, const struct packet_header *h) {
 	if (db->header == 0) {
-		// parser header (2 or 4)
-		if (db->size < header_size) {
+		uint8_t plen[PACKET_HEADER_MAXSIZE];
+		int sz = db->size < PACKET_HEADER_MAXSIZE ? db->size : PACKET_HEADER_MAXSIZE;
+		if (sz == 0) {
 			return -1;
 		}
-		uint8_t plen[4];
-		databuffer_read(db,mp,(char *)plen,header_size);
-		// big-endian
-		if (header_size == 2) {
-			db->header = plen[0] << 8 | plen[1];
-		} else {
-			db->header = plen[0] << 24 | plen[1] << 16 | plen[2] << 8 | plen[3];
+		databuffer_peek(db, (char *)plen, sz);
+		int n = packet_header_read(h, plen, sz, &db->header);
+		if (n == 0) {
+			return -1;
+		} else if (n < 0) {
+			return -2;
 		}
+		databuffer_read(db,mp,(char *)plen,n);
 	}
 	if (db->size < db->header)
 		return -1;
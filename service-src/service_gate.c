@@ -1,6 +1,7 @@
 #include "skynet.h"
 #include "skynet_socket.h"
 #include "databuffer.h"
+#include "packet_header.h"
 #include "hashid.h"
 
 #include <stdlib.h>
@@ -26,7 +27,7 @@ struct gate {
 	uint32_t watchdog;
 	uint32_t broker;
 	int client_tag;
-	int header_size;
+	struct packet_header header;
 	int max_connection;
 	struct hashid hash;
 	struct connection *conn;
@@ -195,8 +196,14 @@ static void
 dispatch_message(struct gate *g, struct connection *c, int id, void * data, int sz) {
 	databuffer_push(&c->buffer,&g->mp, data, sz);
 	for (;;) {
-		int size = databuffer_readheader(&c->buffer, &g->mp, g->header_size);
-		if (size < 0) {
+		int size = databuffer_readheader(&c->buffer, &g->mp, &g->header);
+		if (size == -1) {
+			return;
+		} else if (size < 0) {
+			struct skynet_context * ctx = g->ctx;
+			databuffer_clear(&c->buffer,&g->mp);
+			skynet_socket_close(ctx, id);
+			skynet_error(ctx, "Recv socket message with invalid size");
 			return;
 		} else if (size > 0) {
 			if (size >= 0x1000000) {
@@ -348,8 +355,8 @@ gate_init(struct gate *g , struct skynet_context * ctx, char * parm) {
 	char watchdog[sz];
 	char binding[sz];
 	int client_tag = 0;
-	char header;
-	int n = sscanf(parm, "%c %s %s %d %d", &header, watchdog, binding, &client_tag, &max);
+	char header[sz];
+	int n = sscanf(parm, "%s %s %s %d %d", header, watchdog, binding, &client_tag, &max);
 	if (n<4) {
 		skynet_error(ctx, "Invalid gate parm %s",parm);
 		return 1;
@@ -358,7 +365,14 @@ gate_init(struct gate *g , struct skynet_context * ctx, char * parm) {
 		skynet_error(ctx, "Need max connection");
 		return 1;
 	}
-	if (header != 'S' && header !='L') {
+	// S : 2 bytes big-endian, L : 4 bytes big-endian, or the format in packet_header.h (4le, varint, 2be+2, etc)
+	const char * format = header;
+	if (strcmp(header, "S") == 0) {
+		format = "2be";
+	} else if (strcmp(header, "L") == 0) {
+		format = "4be";
+	}
+	if (packet_header_init(&g->header, format)) {
 		skynet_error(ctx, "Invalid data header style");
 		return 1;
 	}
@@ -388,7 +402,6 @@ gate_init(struct gate *g , struct skynet_context * ctx, char * parm) {
 	}
 	
 	g->client_tag = client_tag;
-	g->header_size = header=='S' ? 2 : 4;
 
 	skynet_callback(ctx,g,_cb);
 
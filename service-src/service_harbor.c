@@ -11,6 +11,9 @@
 
 	If the fd is disconnected, send message to slave in PTYPE_TEXT.  D id
 	If we don't known a globalname, send message to slave in PTYPE_TEXT. Q name
+
+	The messages to a remote harbor are written into a buffer of the link, and the buffer is sent
+	when it's full, or after the messages already in the harbor's queue are dispatched (a TIMEOUT 0 response).
  */
 
 #include <stdio.h>
@@ -23,6 +26,9 @@
 
 #define HASH_SIZE 4096
 #define DEFAULT_QUEUE_SIZE 1024
+// the buffered messages of a link are sent when they reach 64K, larger message is sent alone
+#define WRITE_BUFFER_SIZE 0x10000
+#define WRITE_BUFFER_INIT 256
 
 // 12 is sizeof(struct remote_message_header)
 #define HEADER_COOKIE_LENGTH 12
@@ -76,11 +82,15 @@ struct slave {
 	int read;
 	uint8_t size[4];
 	char * recv_buffer;
+	uint8_t * write_buffer;
+	size_t write_size;
+	size_t write_cap;
 };
 
 struct harbor {
 	struct skynet_context *ctx;
 	int id;
+	bool flushing;
 	uint32_t slave;
 	struct hashmap * map;
 	struct slave s[REMOTE_MAX];
@@ -151,13 +161,22 @@ release_queue(struct harbor_msg_queue *queue) {
 	skynet_free(queue);
 }
 
+// names are padded with 0, mix all the 16 bytes, for the short names differ in a few bytes only
+static inline uint32_t
+name_hash(const char name[GLOBALNAME_LENGTH]) {
+	uint64_t a, b;
+	memcpy(&a, name, sizeof(a));
+	memcpy(&b, name + sizeof(a), sizeof(b));
+	uint64_t h = (a ^ (b * 0x9e3779b97f4a7c15ull)) * 0xff51afd7ed558ccdull;
+	return (uint32_t)(h >> 32);
+}
+
 static struct keyvalue *
 hash_search(struct hashmap * hash, const char name[GLOBALNAME_LENGTH]) {
-	uint32_t *ptr = (uint32_t*) name;
-	uint32_t h = ptr[0] ^ ptr[1] ^ ptr[2] ^ ptr[3];
+	uint32_t h = name_hash(name);
 	struct keyvalue * node = hash->node[h % HASH_SIZE];
 	while (node) {
-		if (node->hash == h && strncmp(node->key, name, GLOBALNAME_LENGTH) == 0) {
+		if (node->hash == h && memcmp(node->key, name, GLOBALNAME_LENGTH) == 0) {
 			return node;
 		}
 		node = node->next;
@@ -189,8 +208,7 @@ hash_erase(struct hashmap * hash, char name[GLOBALNAME_LENGTH) {
 
 static struct keyvalue *
 hash_insert(struct hashmap * hash, const char name[GLOBALNAME_LENGTH]) {
-	uint32_t *ptr = (uint32_t *)name;
-	uint32_t h = ptr[0] ^ ptr[1] ^ ptr[2] ^ ptr[3];
+	uint32_t h = name_hash(name);
 	struct keyvalue ** pkv = &hash->node[h % HASH_SIZE];
 	struct keyvalue * node = skynet_malloc(sizeof(*node));
 	memcpy(node->key, name, GLOBALNAME_LENGTH);
@@ -239,6 +257,10 @@ close_harbor(struct harbor *h, int id) {
 		release_queue(s->queue);
 		s->queue = NULL;
 	}
+	skynet_free(s->write_buffer);
+	s->write_buffer = NULL;
+	s->write_size = 0;
+	s->write_cap = 0;
 }
 
 static void
@@ -330,25 +352,81 @@ forward_local_messsage(struct harbor *h, void *msg, int sz) {
 }
 
 static void
-send_remote(struct skynet_context * ctx, int fd, const char * buffer, size_t sz, struct remote_message_header * cookie) {
+flush_remote(struct harbor *h, struct slave *s) {
+	if (s->write_size == 0)
+		return;
+	struct socket_sendbuffer tmp;
+	tmp.id = s->fd;
+	tmp.type = SOCKET_BUFFER_MEMORY;
+	tmp.buffer = s->write_buffer;
+	tmp.sz = s->write_size;
+	s->write_buffer = NULL;
+	s->write_size = 0;
+	s->write_cap = 0;
+
+	// ignore send error, because if the connection is broken, the mainloop will recv a message.
+	skynet_socket_sendbuffer(h->ctx, &tmp);
+}
+
+static void
+flush_all_remotes(struct harbor *h) {
+	int i;
+	h->flushing = false;
+	for (i=1;i<REMOTE_MAX;i++) {
+		struct slave *s = &h->s[i];
+		if (s->fd) {
+			flush_remote(h, s);
+		}
+	}
+}
+
+// reserve sz bytes in the write buffer of the link, the buffer is sent later (flush_all_remotes)
+static uint8_t *
+reserve_remote(struct harbor *h, struct slave *s, size_t sz) {
+	if (s->write_size + sz > WRITE_BUFFER_SIZE) {
+		flush_remote(h, s);
+		if (sz > WRITE_BUFFER_SIZE) {
+			// send alone, by flush_remote at once
+			s->write_buffer = skynet_malloc(sz);
+			s->write_size = sz;
+			s->write_cap = sz;
+			return s->write_buffer;
+		}
+	}
+	if (s->write_size + sz > s->write_cap) {
+		size_t cap = s->write_cap ? s->write_cap : WRITE_BUFFER_INIT;
+		while (cap < s->write_size + sz) {
+			cap *= 2;
+		}
+		s->write_buffer = skynet_realloc(s->write_buffer, cap);
+		s->write_cap = cap;
+	}
+	uint8_t * ptr = s->write_buffer + s->write_size;
+	s->write_size += sz;
+	if (!h->flushing) {
+		// the response of TIMEOUT 0 comes after the messages in queue now
+		h->flushing = true;
+		skynet_command(h->ctx, "TIMEOUT", "0");
+	}
+	return ptr;
+}
+
+static void
+send_remote(struct harbor *h, struct slave *s, const char * buffer, size_t sz, struct remote_message_header * cookie) {
 	size_t sz_header = sz+sizeof(*cookie);
 	if (sz_header > UINT32_MAX) {
-		skynet_error(ctx, "remote message from :%08x to :%08x is too large.", cookie->source, cookie->destination);
+		skynet_error(h->ctx, "remote message from :%08x to :%08x is too large.", cookie->source, cookie->destination);
 		return;
 	}
-	uint8_t sendbuf[sz_header+4];
+	uint8_t * sendbuf = reserve_remote(h, s, sz_header+4);
 	to_bigendian(sendbuf, (uint32_t)sz_header);
 	memcpy(sendbuf+4, buffer, sz);
 	header_to_message(cookie, sendbuf+4+sz);
 
-	struct socket_sendbuffer tmp;
-	tmp.id = fd;
-	tmp.type = SOCKET_BUFFER_RAWPOINTER;
-	tmp.buffer = sendbuf;
-	tmp.sz = sz_header+4;
-
-	// ignore send error, because if the connection is broken, the mainloop will recv a message.
-	skynet_socket_sendbuffer(ctx, &tmp);
+	if (sz_header+4 > WRITE_BUFFER_SIZE) {
+		// the large message is sent alone at once
+		flush_remote(h, s);
+	}
 }
 
 static void
@@ -391,7 +469,7 @@ dispatch_name_queue(struct harbor *h, struct keyvalue * node) {
 	struct harbor_msg * m;
 	while ((m = pop_queue(queue)) != NULL) {
 		m->header.destination |= (handle & HANDLE_MASK);
-		send_remote(context, fd, m->buffer, m->size, &m->header);
+		send_remote(h, s, m->buffer, m->size, &m->header);
 		skynet_free(m->buffer);
 	}
 }
@@ -408,7 +486,7 @@ dispatch_queue(struct harbor *h, int id) {
 
 	struct harbor_msg * m;
 	while ((m = pop_queue(queue)) != NULL) {
-		send_remote(h->ctx, fd, m->buffer, m->size, &m->header);
+		send_remote(h, s, m->buffer, m->size, &m->header);
 		skynet_free(m->buffer);
 	}
 	release_queue(queue);
@@ -556,7 +634,7 @@ remote_send_handle(struct harbor *h, uint32_t source, uint32_t destination, int
 		cookie.source = source;
 		cookie.destination = (destination & HANDLE_MASK) | ((uint32_t)type << HANDLE_REMOTE_SHIFT);
 		cookie.session = (uint32_t)session;
-		send_remote(context, s->fd, msg,sz,&cookie);
+		send_remote(h, s, msg,sz,&cookie);
 	}
 
 	return 0;
@@ -704,6 +782,11 @@ mainloop(struct skynet_context * context, void * ud, int type, int session, uint
 		harbor_command(h, msg,sz,session,source);
 		return 0;
 	}
+	case PTYPE_RESPONSE: {
+		// TIMEOUT 0 from reserve_remote
+		flush_all_remotes(h);
+		return 0;
+	}
 	case PTYPE_SYSTEM : {
 		// remote message out
 		const struct remote_message *rmsg = msg;
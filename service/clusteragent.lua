@@ -8,7 +8,8 @@ clusterd = tonumber(clusterd)
 gate = tonumber(gate)
 fd = tonumber(fd)
 
-local large_request = {}
+local compress	-- the threshold of compression negotiated by hello
+local large	-- the large response in one package, negotiated by hello
 local inquery_name = {}
 local register_name
 
@@ -42,49 +43,58 @@ local function new_register_name()
 end
 new_register_name()
 
-local tracetag
+local function dispatch_batch(batch)
+	for i = 1, #batch, 3 do
+		local addr, msg, sz = batch[i], batch[i+1], batch[i+2]
+		if cluster.isname(addr) then
+			addr = register_name[addr]
+		end
+		if addr then
+			skynet.rawsend(addr, "lua", msg, sz)
+		else
+			skynet.trash(msg, sz)
+		end
+	end
+end
 
-local function dispatch_request(_,_,addr, session, msg, sz, padding, is_push)
+local function dispatch_request(_,_,addr, session, msg, sz, is_push, tracetag)
 	ignoreret()	-- session is fd, don't call skynet.ret
-	if session == nil then
-		-- trace
-		tracetag = addr
+	if addr == nil then
+		-- trace tag or a part of large request, kept by the decoder
+		return
+	elseif addr == true then
+		-- the pushes in a batch, session is the table of them
+		dispatch_batch(session)
 		return
 	end
-	if padding then
-		local req = large_request[session] or { addr = addr , is_push = is_push, tracetag = tracetag }
-		tracetag = nil
-		large_request[session] = req
-		cluster.append(req, msg, sz)
+	if not msg then
+		local response = cluster.packresponse(session, false, "Invalid large req")
+		socket.write(fd, response)
 		return
-	else
-		local req = large_request[session]
-		if req then
-			tracetag = req.tracetag
-			large_request[session] = nil
-			cluster.append(req, msg, sz)
-			msg,sz = cluster.concat(req)
-			addr = req.addr
-			is_push = req.is_push
-		end
-		if not msg then
-			tracetag = nil
-			local response = cluster.packresponse(session, false, "Invalid large req")
-			socket.write(fd, response)
-			return
-		end
 	end
 	local ok, response
 	if addr == 0 then
-		local name = skynet.unpack(msg, sz)
+		local name, opt = skynet.unpack(msg, sz)
 		skynet.trash(msg, sz)
-		local addr = register_name["@" .. name]
-		if addr then
+		if type(opt) == "table" then
+			-- hello from clustersender
+			compress = tonumber(opt.compress)
+			large = opt.large == true	-- the gate of clusterd reads "ext" header
+			ok = true
+			msg = skynet.packstring { compress = compress, large = large, batch = true }
+		elseif name == "" then
+			-- heartbeat from clustersender
 			ok = true
-			msg = skynet.packstring(addr)
+			msg = skynet.packstring(nil)
 		else
-			ok = false
-			msg = "name not found"
+			local addr = register_name["@" .. name]
+			if addr then
+				ok = true
+				msg = skynet.packstring(addr)
+			else
+				ok = false
+				msg = "name not found"
+			end
 		end
 		sz = nil
 	else
@@ -98,10 +108,17 @@ local function dispatch_request(_,_,addr, session, msg, sz, padding, is_push)
 			else
 				if tracetag then
 					ok , msg, sz = pcall(skynet.tracecall, tracetag, addr, "lua", msg, sz)
-					tracetag = nil
 				else
 					ok , msg, sz = pcall(skynet.rawcall, addr, "lua", msg, sz)
 				end
+				if ok and compress then
+					local cmsg, csz = skynet.compress(msg, sz, compress)
+					if cmsg then
+						-- the message returned by rawcall is not ours, free the compressed one after packresponse
+						response = cluster.packresponse(session, true, cmsg, csz, large)
+						skynet.trash(cmsg, csz)
+					end
+				end
 			end
 		else
 			ok = false
@@ -109,7 +126,7 @@ local function dispatch_request(_,_,addr, session, msg, sz, padding, is_push)
 		end
 	end
 	if ok then
-		response = cluster.packresponse(session, true, msg, sz)
+		response = response or cluster.packresponse(session, true, msg, sz, large)
 		if type(response) == "table" then
 			for _, v in ipairs(response) do
 				socket.lwrite(fd, v)
@@ -127,7 +144,7 @@ skynet.start(function()
 	skynet.register_protocol {
 		name = "client",
 		id = skynet.PTYPE_CLIENT,
-		unpack = cluster.unpackrequest,
+		unpack = cluster.requestdecoder(),	-- reassemble the large requests
 		dispatch = dispatch_request,
 	}
 	-- fd can write, but don't read fd, the data package will forward from gate though client protocol.
@@ -5,13 +5,32 @@ local cluster = require "skynet.cluster.core"
 local config_name = skynet.getenv "cluster"
 local node_address = {}
 local node_sender = {}
+local node_sender_pool = {}	-- node_sender[node] and other senders, when __connections > 1
 local node_sender_closed = {}
+local node_backup = {}	-- the address of the standby connections of node (__backup)
 local command = {}
 local config = {}
 local nodename = cluster.nodename()
 
 local connecting = {}
 
+-- Each sender keeps a standby connection to the backup of node, it's used when the node is down (see __heartbeat).
+local function set_standby(key)
+	local pool = node_sender_pool[key]
+	local backup = config.backup and config.backup[key] or nil
+	if pool == nil or node_backup[key] == backup then
+		return
+	end
+	node_backup[key] = backup
+	local host, port
+	if backup then
+		host, port = string.match(backup, "([^:]+):(.*)$")
+	end
+	for _, s in ipairs(pool) do
+		skynet.call(s, "lua", "standby", host, port)
+	end
+end
+
 local function open_channel(t, key)
 	local ct = connecting[key]
 	if ct then
@@ -49,15 +68,26 @@ local function open_channel(t, key)
 				c = node_sender[key]
 			else
 				node_sender[key] = c
+				local pool = { c }
+				node_sender_pool[key] = pool
+				for i = 2, tonumber(config.connections) or 1 do
+					pool[i] = skynet.newservice("clustersender", key, nodename, host, port)
+				end
 			end
 		end
 
-		succ = pcall(skynet.call, c, "lua", "changenode", host, port)
+		for _, s in ipairs(node_sender_pool[key]) do
+			succ = pcall(skynet.call, s, "lua", "changenode", host, port, config.compress)
+			if not succ then
+				break
+			end
+		end
 
 		if succ then
 			t[key] = c
 			ct.channel = c
                         node_sender_closed[key] = nil
+			set_standby(key)
 		else
 			err = string.format("changenode [%s] (%s:%s) failed", key, host, port)
 		end
@@ -68,7 +98,12 @@ local function open_channel(t, key)
 			succ = true
 		else
 			-- trun off the sender
-			succ, err = pcall(skynet.call, c, "lua", "changenode", false)
+			for _, s in ipairs(node_sender_pool[key]) do
+				succ, err = pcall(skynet.call, s, "lua", "changenode", false)
+				if not succ then
+					break
+				end
+			end
                         if succ then --trun off failed, wait next index todo turn off
                                 node_sender_closed[key] = true
                         end
@@ -89,6 +124,40 @@ end
 
 local node_channel = setmetatable({}, { __index = open_channel })
 
+local node_down = {}	-- sender : true
+
+local function check_sender(key, s, ti)
+	local ok, alive, address = pcall(skynet.call, s, "lua", "heartbeat", ti)
+	if not ok then
+		return
+	end
+	if address then
+		skynet.error(string.format("Cluster node [%s] is down, switch to %s", key, address))
+		node_down[s] = nil
+	elseif not alive ~= (node_down[s] == true) then
+		node_down[s] = not alive or nil
+		skynet.error(string.format("Cluster node [%s] is %s", key, alive and "up" or "down"))
+	end
+end
+
+-- Ping the nodes every __heartbeat (1/100 s), the sender switches to the standby connection if there is no reply.
+local heartbeat_running = false
+
+local function heartbeat()
+	while config.heartbeat do
+		local ti = tonumber(config.heartbeat)
+		skynet.sleep(ti)
+		for key, pool in pairs(node_sender_pool) do
+			if not node_sender_closed[key] and not connecting[key] then
+				for _, s in ipairs(pool) do
+					skynet.fork(check_sender, key, s, ti)
+				end
+			end
+		end
+	end
+	heartbeat_running = false
+end
+
 local function loadconfig(tmp)
 	if tmp == nil then
 		tmp = {}
@@ -135,6 +204,17 @@ local function loadconfig(tmp)
 		-- open_channel would block
 		skynet.fork(open_channel, node_channel, name)
 	end
+	if tmp.__backup ~= nil then
+		for name in pairs(node_sender_pool) do
+			if not connecting[name] then
+				skynet.fork(set_standby, name)
+			end
+		end
+	end
+	if config.heartbeat and not heartbeat_running then
+		heartbeat_running = true
+		skynet.fork(heartbeat)
+	end
 end
 
 function command.reload(source, config)
@@ -149,16 +229,22 @@ function command.listen(source, addr, port, maxclient)
 		addr, port = string.match(address, "(.+):([^:]+)$")
 		port = tonumber(port)
 		assert(port ~= 0)
-		skynet.call(gate, "lua", "open", { address = addr, port = port, maxclient = maxclient })
+		skynet.call(gate, "lua", "open", { address = addr, port = port, maxclient = maxclient, nodelay = true, header = "ext" })
 		skynet.ret(skynet.pack(addr, port))
 	else
-		local realaddr, realport = skynet.call(gate, "lua", "open", { address = addr, port = port, maxclient = maxclient })
+		local realaddr, realport = skynet.call(gate, "lua", "open", { address = addr, port = port, maxclient = maxclient, nodelay = true, header = "ext" })
 		skynet.ret(skynet.pack(realaddr, realport))
 	end
 end
 
+-- Each service uses one sender of the pool (by its address), so the messages from a service are in order.
 function command.sender(source, node)
-	skynet.ret(skynet.pack(node_channel[node]))
+	local c = node_channel[node]
+	local pool = node_sender_pool[node]
+	if pool and #pool > 1 then
+		c = pool[source % #pool + 1]
+	end
+	skynet.ret(skynet.pack(c))
 end
 
 function command.senders(source)
@@ -1,20 +1,115 @@
 local skynet = require "skynet"
-local sc = require "skynet.socketchannel"
 local socket = require "skynet.socket"
+local sc = require "skynet.socketchannel"
 local cluster = require "skynet.cluster.core"
 
 local channel
 local session = 1
 local node, nodename, init_host, init_port = ...
+local compress	-- the threshold of compression in config (__compress)
+local compress_link = false	-- the peer can decompress
+local large_link = false	-- the peer reads the large message in one package ("ext" header)
+local batch_link = false	-- the peer reads the batch of pushes
+local link_option = setmetatable({}, { __mode = "k" })	-- socket channel : the options negotiated by hello
+
+-- The standby channel is connected to the backup of node (__backup) before it's needed. When the heartbeat of channel
+-- times out, they are swapped, and the requests go to the standby at once.
+local standby
+local standby_alive = false
 
 local command = {}
 
+-- The requests and pushes in the message queue are written together (coalesced) by one socket write.
+local BATCH_SIZE = 0x10000
+local batch
+
+local failover
+
+local function flush(b)
+	skynet.yield()	-- wait for the other messages in queue
+	if batch == b then
+		batch = nil
+	end
+	local c = b.channel
+	local ok, err
+	if b.padding then
+		ok, err = pcall(c.request, c, b[1], nil, b.padding)
+	else
+		ok, err = pcall(c.request, c, table.concat(b))
+	end
+	if not ok then
+		skynet.error(string.format("Cluster sender %s write error : %s", node, err))
+		-- the requests of this batch are not sent
+		for _, s in ipairs(b.sessions) do
+			c:cancel(s, "write failed")
+		end
+		if c == channel and standby_alive then
+			failover()
+		end
+	end
+end
+
+-- returns the channel which the request is written to, the session (of a request) is canceled if the batch fails.
+-- trace is the trace tag package (cluster.packtrace) before the request.
+local function write(request, padding, session, trace)
+	if padding or #request >= BATCH_SIZE then
+		-- the large request is written alone by the low priority socket write (see channel:request) after the
+		-- batch before it, it's not copied into a batch, and the small ones after it don't wait for it
+		if trace then
+			-- the trace tag goes with it
+			if padding then
+				table.insert(padding, 1, request)
+			else
+				padding = { request }
+			end
+			request = trace
+		end
+		local b = { request, channel = channel, sessions = { session }, padding = padding or {} }
+		batch = nil
+		skynet.fork(flush, b)
+		return b.channel
+	end
+	local b = batch
+	if b == nil then
+		b = { size = 0, channel = channel, sessions = {} }
+		batch = b
+		skynet.fork(flush, b)
+	end
+	if trace then
+		b[#b+1] = trace
+		b.size = b.size + #trace
+	end
+	b[#b+1] = request
+	b.size = b.size + #request
+	if session then
+		b.sessions[#b.sessions+1] = session
+	end
+	if b.size >= BATCH_SIZE then
+		-- the next request goes to a new batch, which is written after this one
+		batch = nil
+	end
+	return b.channel
+end
+
+local function compress_msg(msg, sz)
+	if compress_link then
+		local cmsg, csz = skynet.compress(msg, sz, compress)
+		if cmsg then
+			skynet.trash(msg, sz)
+			return cmsg, csz
+		end
+	end
+	return msg, sz
+end
+
 local function send_request(addr, msg, sz)
 	-- msg is a local pointer, cluster.packrequest will free it
+	msg, sz = compress_msg(msg, sz)
 	local current_session = session
-	local request, new_session, padding = cluster.packrequest(addr, session, msg, sz)
+	local request, new_session, padding = cluster.packrequest(addr, session, msg, sz, large_link)
 	session = new_session
 
+	local trace
 	local tracetag = skynet.tracetag()
 	if tracetag then
 		if tracetag:sub(1,1) ~= "(" then
@@ -24,19 +119,17 @@ local function send_request(addr, msg, sz)
 			tracetag = newtag
 		end
 		skynet.tracelog(tracetag, string.format("cluster %s", node))
-		channel:request(cluster.packtrace(tracetag))
+		trace = cluster.packtrace(tracetag)
 	end
-	return channel:request(request, current_session, padding)
+	local c = write(request, padding, current_session, trace)
+	-- don't reconnect when waiting, the call fails at once if the node is down
+	return c:response(current_session, true)
 end
 
 function command.req(...)
 	local ok, msg = pcall(send_request, ...)
 	if ok then
-		if type(msg) == "table" then
-			skynet.ret(cluster.concat(msg))
-		else
-			skynet.ret(msg)
-		end
+		skynet.ret(msg)
 	else
 		skynet.error(msg)
 		skynet.response()(false)
@@ -44,38 +137,262 @@ function command.req(...)
 end
 
 function command.push(addr, msg, sz)
-	local request, new_session, padding = cluster.packpush(addr, session, msg, sz)
+	msg, sz = compress_msg(msg, sz)
+	local request, new_session, padding = cluster.packpush(addr, session, msg, sz, large_link)
 	if padding then	-- is multi push
 		session = new_session
 	end
 
-	channel:request(request, nil, padding)
+	write(request, padding)
+end
+
+-- compress the pushes of batch one by one (cluster.send packs them before the link is known)
+local function compress_batch(pushes)
+	if #pushes < compress then
+		-- no one is large enough
+		return pushes
+	end
+	local t = cluster.unpackbatch(pushes)
+	local b = {}
+	for i = 1, #t, 3 do
+		local msg, sz = compress_msg(t[i+1], t[i+2])
+		b[#b+1] = cluster.packpush(t[i], 1, msg, sz, true)
+	end
+	return table.concat(b)
+end
+
+-- pushes packed by cluster.send in batch mode (see cluster.batch)
+function command.pushbatch(pushes)
+	if batch_link then
+		if compress_link then
+			pushes = compress_batch(pushes)
+		end
+		write(cluster.packbatch(pushes))
+	else
+		-- the old version peer, push one by one
+		local t = cluster.unpackbatch(pushes)
+		for i = 1, #t, 3 do
+			command.push(t[i], t[i+1], t[i+2])
+		end
+	end
 end
 
+-- The decoder splits the packages from the bytes of socket, and reassembles the large responses.
+-- One decoder for each connection, the standby channel reads the responses too.
+local decoders = setmetatable({}, { __mode = "k" })
+
 local function read_response(sock)
-	local sz = socket.header(sock:read(2))
-	local msg = sock:read(sz)
-	return cluster.unpackresponse(msg)	-- session, ok, data, padding
+	local decoder = decoders[sock]
+	if decoder == nil then
+		-- a new connection
+		decoder = cluster.responsedecoder()
+		decoders[sock] = decoder
+	end
+	local session, ok, data = decoder()
+	while not session do
+		-- ok is the size of the rest of next package
+		session, ok, data = decoder(sock:read(ok))
+	end
+	return session, ok, data
+end
+
+local function use_link(c)
+	local opt = link_option[c]
+	compress_link = opt ~= nil and opt.compress
+	large_link = opt ~= nil and opt.large
+	batch_link = opt ~= nil and opt.batch
+end
+
+local HELLO_TIMEOUT = 500	-- 1/100 s
+
+-- Say hello (a name query with options) after connected. skynet.pack writes the version 0 format, the old version
+-- peer reads it as a query of the empty name and replies "name not found", the link keeps the old options.
+-- The connection is closed if there is no reply in HELLO_TIMEOUT.
+local function hello(so)
+	local link = { compress = false, large = false, batch = false }
+	link_option[so] = link
+	if so == channel then
+		use_link(so)
+	end
+	local current_session = session
+	local request, new_session = cluster.packrequest(0, session, skynet.pack("", { compress = compress, large = true }))
+	session = new_session
+	local sock = so.__sock
+	local replied = false
+	skynet.timeout(HELLO_TIMEOUT, function()
+		if not replied and so.__sock == sock then
+			skynet.error(string.format("Cluster sender %s hello to %s:%d timeout", node, so.__host, so.__port))
+			-- the request raises an error, and the auth fails
+			socket.shutdown(sock[1])
+		end
+	end)
+	local ok, ret = pcall(so.request, so, request, current_session)
+	replied = true
+	if not ok and so.__sock ~= sock then
+		-- socket error
+		error(ret)
+	end
+	if ok then
+		local opt = skynet.unpack(ret)
+		if type(opt) == "table" then
+			link.compress = opt.compress ~= nil
+			link.large = opt.large == true
+			link.batch = opt.batch == true
+			if so == channel then
+				use_link(so)
+			end
+		end
+	end
+end
+
+local function new_channel(host, port)
+	return sc.channel {
+		host = host,
+		port = tonumber(port),
+		response = read_response,
+		nodelay = true,
+		auth = hello,
+	}
+end
+
+local function ping_request(c, request, ping_session, reconnect)
+	if reconnect then
+		-- connect (once) again if it's closed or down
+		c:connect(true)
+	end
+	return c:request(request, ping_session)
+end
+
+-- Query the empty name, returns false if the peer doesn't reply in ti (1/100 s)
+local function ping(c, ti, reconnect)
+	local co = coroutine.running()
+	local alive = false
+	local waiting = true
+	local ping_session = session
+	local request, new_session = cluster.packrequest(0, session, skynet.pack(""))
+	session = new_session
+	skynet.fork(function()
+		local ok, err = pcall(ping_request, c, request, ping_session, reconnect)
+		-- the old version peer reads the empty name (skynet.pack writes the version 0 format), and replies
+		-- "name not found" (after the position of assert in socketchannel)
+		alive = ok or (type(err) == "string" and err:find("name not found", 1, true) ~= nil)
+		if waiting then
+			skynet.wakeup(co)
+		end
+	end)
+	skynet.sleep(ti, co)
+	waiting = false
+	if not alive then
+		-- don't wait for the reply any more
+		c:cancel(ping_session, "heartbeat timeout")
+	end
+	return alive
+end
+
+local HEARTBEAT_MISSES = 3	-- the node is down after the heartbeats without reply in a row
+local misses = 0	-- of channel
+local checking_standby = false
+local standby_skip = 0	-- the heartbeats to skip before checking the standby which is down
+local standby_down = 0
+
+function failover()
+	local down = channel
+	channel, standby = standby, down
+	standby_alive = false
+	standby_down = 0
+	standby_skip = 0
+	misses = 0
+	-- the requests after now are written to the new channel
+	batch = nil
+	use_link(channel)
+	skynet.error(string.format("Cluster node %s (%s:%d) is down, switch to %s:%d",
+		node, down.__host, down.__port, channel.__host, channel.__port))
+	-- wakeup the coroutines waiting for it, it would be connected again as the standby
+	down:close()
+end
+
+local function check_standby(ti)
+	checking_standby = true
+	local c = standby
+	local alive = ping(c, ti, true)
+	if c == standby then
+		standby_alive = alive
+		if alive then
+			standby_down = 0
+		else
+			-- connect again later, the hello may be lost
+			c:close()
+			standby_down = math.min(standby_down * 2 + 1, 63)
+			standby_skip = standby_down
+		end
+	end
+	checking_standby = false
+end
+
+-- called by clusterd every __heartbeat (1/100 s), returns if the node is alive, and the new address after failover
+function command.heartbeat(ti)
+	if standby and not checking_standby then
+		if standby_skip > 0 then
+			standby_skip = standby_skip - 1
+		else
+			skynet.fork(check_standby, ti)
+		end
+	end
+	local c = channel
+	-- the channel is closed after it's down, connect again
+	local alive = ping(c, ti, misses >= HEARTBEAT_MISSES)
+	if c == channel then
+		-- a slow reply (a large response before it, or a busy agent) is not a failure
+		misses = alive and 0 or misses + 1
+	end
+	local address
+	if misses >= HEARTBEAT_MISSES then
+		if standby_alive then
+			failover()
+			address = string.format("%s:%d", channel.__host, channel.__port)
+		else
+			-- no standby, the calls in flight fail, and the calls fail at once until it replies again
+			channel:close()
+		end
+	end
+	skynet.ret(skynet.pack(misses < HEARTBEAT_MISSES, address))
 end
 
-function command.changenode(host, port)
+-- set the backup of node, or remove it (host == nil)
+function command.standby(host, port)
+	if standby then
+		standby:close()
+		standby = nil
+		standby_alive = false
+	end
+	if host then
+		standby = new_channel(host, port)
+		standby_down = 0
+		standby_skip = 0
+		-- connect now, it's ready before the failover
+		skynet.fork(check_standby, 100)
+	end
+	skynet.ret(skynet.pack(nil))
+end
+
+function command.changenode(host, port, threshold)
+	compress = tonumber(threshold)
 	if not host then
 		skynet.error(string.format("Close cluster sender %s:%d", channel.__host, channel.__port))
 		channel:close()
+		if standby then
+			standby:close()
+		end
 	else
 		channel:changehost(host, tonumber(port))
+		misses = 0
 		channel:connect(true)
 	end
 	skynet.ret(skynet.pack(nil))
 end
 
 skynet.start(function()
-	channel = sc.channel {
-			host = init_host,
-			port = tonumber(init_port),
-			response = read_response,
-			nodelay = true,
-		}
+	channel = new_channel(init_host, init_port)
 	skynet.dispatch("lua", function(session , source, cmd, ...)
 		local f = assert(command[cmd])
 		f(...)
@@ -63,32 +63,19 @@ local function remote_publish(node, channel, source, ...)
 	skynet.redirect(node_address[node], source, "multicast", channel, ...)
 end
 
--- publish a message, for local node, use the message pointer (call mc.bind to add the reference)
--- for remote node, call remote_publish. (call mc.unpack and skynet.tostring to convert message pointer to string)
+-- publish a message, for local node, use the message pointer (mc.publish adds the reference)
+-- for remote node, mc.publish sends a copy of the message to the multicastd of each node.
 local function publish(c , source, pack, size)
 	local remote = channel_remote[c]
-	if remote then
-		-- remote publish should unpack the pack, because we should not publish the pointer out.
-		local _, msg, sz = mc.unpack(pack, size)
-		local msg = skynet.tostring(msg,sz)
+	local nodes
+	if remote and next(remote) then
+		nodes = {}
 		for node in pairs(remote) do
-			remote_publish(node, c, source, msg)
+			nodes[#nodes+1] = node_address[node]
 		end
 	end
-
-	local group = channel[c]
-	if group == nil or next(group) == nil then
-		-- dead channel, delete the pack. mc.bind returns the pointer in pack and free the pack (struct mc_package **)
-		local pack = mc.bind(pack, 1)
-		mc.close(pack)
-		return
-	end
-	local msg = skynet.tostring(pack, size)	-- copy (pack,size) to a string
-	mc.bind(pack, channel_n[c])	-- mc.bind will free the pack(struct mc_package **)
-	for k in pairs(group) do
-		-- the msg is a pointer to the real message, publish pointer in local is ok.
-		skynet.redirect(k, source, "multicast", c , msg)
-	end
+	-- mc.publish frees the pack(struct mc_package **), and frees the message if no one gets it.
+	mc.publish(pack, source, c, channel[c], nodes)
 end
 
 skynet.register_protocol {
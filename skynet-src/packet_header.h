@@ -0,0 +1,207 @@
+#ifndef skynet_packet_header_h
+#define skynet_packet_header_h
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+
+/*
+	The length field of a stream package, and an optional fixed header (message type, etc) after it.
+
+	"2be" / "2le" : uint16 in big-endian / little-endian (2be is the default)
+	"4be" / "4le" : uint32 in big-endian / little-endian
+	"varint" : base 128 varint (LEB128), 1 to 5 bytes
+	"ext" : uint16 in big-endian, or 0 and uint32 in big-endian (6 bytes) for the package larger than 0xffff.
+		It's the same as "2be" for the packages of 1 to 0xffff bytes.
+	"<length>+N" : N bytes fixed header follows the length field, the length field doesn't count it.
+		The fixed header is a part of the package, it's the first N bytes of data.
+ */
+
+#define PACKET_HEADER_BE 0
+#define PACKET_HEADER_LE 1
+#define PACKET_HEADER_VARINT 2
+#define PACKET_HEADER_EXT 3
+
+#define PACKET_HEADER_MAXSIZE 6
+#define PACKET_HEADER_VARINT_MAXSIZE 5
+#define PACKET_HEADER_MAXEXTRA 64
+
+struct packet_header {
+	int type;
+	int size;	// bytes of length field, 0 for varint
+	int extra;	// bytes of fixed header
+	int limit;	// max value of length field
+};
+
+static inline void
+packet_header_default(struct packet_header *h) {
+	h->type = PACKET_HEADER_BE;
+	h->size = 2;
+	h->extra = 0;
+	h->limit = 0xffff;
+}
+
+// return 0 when succ
+static inline int
+packet_header_init(struct packet_header *h, const char *format) {
+	packet_header_default(h);
+	if (format == NULL)
+		return 0;
+	const char * extra = strchr(format, '+');
+	size_t n = extra ? (size_t)(extra - format) : strlen(format);
+	if (n == 6 && memcmp(format, "varint", 6) == 0) {
+		h->type = PACKET_HEADER_VARINT;
+		h->size = 0;
+		h->limit = INT_MAX;
+	} else if (n == 3 && memcmp(format, "ext", 3) == 0) {
+		h->type = PACKET_HEADER_EXT;
+		h->size = 0;
+		h->limit = INT_MAX;
+	} else if (n == 3 && (format[0] == '2' || format[0] == '4')) {
+		if (memcmp(format+1, "be", 2) == 0) {
+			h->type = PACKET_HEADER_BE;
+		} else if (memcmp(format+1, "le", 2) == 0) {
+			h->type = PACKET_HEADER_LE;
+		} else {
+			return 1;
+		}
+		h->size = format[0] - '0';
+		h->limit = h->size == 2 ? 0xffff : INT_MAX;
+	} else {
+		return 1;
+	}
+	if (extra) {
+		char * endptr;
+		long e = strtol(extra+1, &endptr, 10);
+		if (*endptr != '\0' || e <= 0 || e > PACKET_HEADER_MAXEXTRA)
+			return 1;
+		h->extra = (int)e;
+		if (h->limit > INT_MAX - h->extra)
+			h->limit = INT_MAX - h->extra;
+	}
+	return 0;
+}
+
+/*
+	Read the length field from buffer.
+	return the bytes of length field, and *sz is the size of package (fixed header included)
+	return 0 when the length field is not complete, and -1 when the length is invalid.
+ */
+static inline int
+packet_header_read(const struct packet_header *h, const uint8_t *buffer, int size, int *sz) {
+	uint32_t len = 0;
+	int n;
+	switch (h->type) {
+	case PACKET_HEADER_VARINT: {
+		int i;
+		for (i=0;;i++) {
+			if (i >= size)
+				return 0;
+			if (i >= PACKET_HEADER_VARINT_MAXSIZE)
+				return -1;
+			uint8_t c = buffer[i];
+			if (i == PACKET_HEADER_VARINT_MAXSIZE - 1 && c > 0x0f)
+				return -1;
+			len |= (uint32_t)(c & 0x7f) << (7 * i);
+			if ((c & 0x80) == 0)
+				break;
+		}
+		n = i + 1;
+		break;
+	}
+	case PACKET_HEADER_EXT:
+		if (size < 2)
+			return 0;
+		len = (uint32_t)buffer[0] << 8 | buffer[1];
+		n = 2;
+		if (len == 0) {
+			if (size < 6)
+				return 0;
+			len = (uint32_t)buffer[2] << 24 | (uint32_t)buffer[3] << 16 | (uint32_t)buffer[4] << 8 | buffer[5];
+			n = 6;
+		}
+		break;
+	case PACKET_HEADER_LE:
+		n = h->size;
+		if (size < n)
+			return 0;
+		len = buffer[0] | (uint32_t)buffer[1] << 8;
+		if (n == 4)
+			len |= (uint32_t)buffer[2] << 16 | (uint32_t)buffer[3] << 24;
+		break;
+	default:
+		n = h->size;
+		if (size < n)
+			return 0;
+		if (n == 2) {
+			len = (uint32_t)buffer[0] << 8 | buffer[1];
+		} else {
+			len = (uint32_t)buffer[0] << 24 | (uint32_t)buffer[1] << 16 | (uint32_t)buffer[2] << 8 | buffer[3];
+		}
+		break;
+	}
+	if (len > (uint32_t)h->limit)
+		return -1;
+	*sz = (int)len + h->extra;
+	return n;
+}
+
+/*
+	Write the length field of a package of sz bytes (fixed header included) into buffer.
+	buffer should have PACKET_HEADER_MAXSIZE bytes at least.
+	return the bytes of length field, or -1 when sz is invalid.
+ */
+static inline int
+packet_header_write(const struct packet_header *h, uint8_t *buffer, size_t sz) {
+	if (sz < (size_t)h->extra)
+		return -1;
+	size_t len = sz - h->extra;
+	if (len > (size_t)h->limit)
+		return -1;
+	switch (h->type) {
+	case PACKET_HEADER_VARINT: {
+		int n = 0;
+		while (len >= 0x80) {
+			buffer[n++] = (uint8_t)(len | 0x80);
+			len >>= 7;
+		}
+		buffer[n++] = (uint8_t)len;
+		return n;
+	}
+	case PACKET_HEADER_EXT:
+		if (len > 0 && len <= 0xffff) {
+			buffer[0] = (len >> 8) & 0xff;
+			buffer[1] = len & 0xff;
+			return 2;
+		}
+		buffer[0] = 0;
+		buffer[1] = 0;
+		buffer[2] = (len >> 24) & 0xff;
+		buffer[3] = (len >> 16) & 0xff;
+		buffer[4] = (len >> 8) & 0xff;
+		buffer[5] = len & 0xff;
+		return 6;
+	case PACKET_HEADER_LE:
+		buffer[0] = len & 0xff;
+		buffer[1] = (len >> 8) & 0xff;
+		if (h->size == 4) {
+			buffer[2] = (len >> 16) & 0xff;
+			buffer[3] = (len >> 24) & 0xff;
+		}
+		return h->size;
+	default:
+		if (h->size == 2) {
+			buffer[0] = (len >> 8) & 0xff;
+			buffer[1] = len & 0xff;
+		} else {
+			buffer[0] = (len >> 24) & 0xff;
+			buffer[1] = (len >> 16) & 0xff;
+			buffer[2] = (len >> 8) & 0xff;
+			buffer[3] = len & 0xff;
+		}
+		return h->size;
+	}
+}
+
+#endif
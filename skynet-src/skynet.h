@@ -31,6 +31,10 @@ const char * skynet_command(struct skynet_context * context, const char * cmd ,
 uint32_t skynet_queryname(struct skynet_context * context, const char * name);
 int skynet_send(struct skynet_context * context, uint32_t source, uint32_t destination , int type, int session, void * msg, size_t sz);
 int skynet_sendname(struct skynet_context * context, uint32_t source, const char * destination , int type, int session, void * msg, size_t sz);
+// Send one copy of msg to n services (session is 0), the local ones share it. Returns the number of services sent to.
+int skynet_broadcast(struct skynet_context * context, uint32_t source, const uint32_t * handles, int n, int type, void * msg, size_t sz);
+// The message in callback is shared by a broadcast, it's read-only, and the callback can't keep it (returns 1).
+int skynet_isshared(struct skynet_context *);
 
 int skynet_isremote(struct skynet_context *, uint32_t handle, int * harbor);
 
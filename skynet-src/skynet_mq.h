@@ -14,6 +14,9 @@ struct skynet_message {
 // type is encoding in skynet_message.sz high 8bit
 #define MESSAGE_TYPE_MASK (SIZE_MAX >> 8)
 #define MESSAGE_TYPE_SHIFT ((sizeof(size_t)-1) * 8)
+// the next bit is set when the data is shared by the messages of a broadcast (skynet_broadcast)
+#define MESSAGE_SHARED ((size_t)1 << (MESSAGE_TYPE_SHIFT - 1))
+#define MESSAGE_SIZE_MASK (MESSAGE_TYPE_MASK >> 1)
 
 struct message_queue;
 
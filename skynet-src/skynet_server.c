@@ -56,6 +56,7 @@ struct skynet_context {
 	bool init;
 	bool endless;
 	bool profile;
+	bool shared;	// the message in dispatching is shared
 
 	CHECKCALLING_DECL
 };
@@ -107,6 +108,26 @@ id_to_hex(char * str, uint32_t id) {
 	str[9] = '\0';
 }
 
+// A broadcast message is one allocation : the data, '\0', and the reference count (aligned).
+#define SHARED_REF_OFFSET(sz) (((sz) + sizeof(ATOM_INT)) / sizeof(ATOM_INT) * sizeof(ATOM_INT))
+
+static inline ATOM_INT *
+shared_ref(void *data, size_t sz) {
+	return (ATOM_INT *)((char *)data + SHARED_REF_OFFSET(sz));
+}
+
+static void
+release_message(struct skynet_message *msg) {
+	if (msg->sz & MESSAGE_SHARED) {
+		size_t sz = msg->sz & MESSAGE_SIZE_MASK;
+		if (ATOM_FDEC(shared_ref(msg->data, sz)) > 1) {
+			// others have it
+			return;
+		}
+	}
+	skynet_free(msg->data);
+}
+
 struct drop_t {
 	uint32_t handle;
 };
@@ -114,7 +135,7 @@ struct drop_t {
 static void
 drop_message(struct skynet_message *msg, void *ud) {
 	struct drop_t *d = ud;
-	skynet_free(msg->data);
+	release_message(msg);
 	uint32_t source = d->handle;
 	assert(source);
 	// report error to the message source
@@ -149,6 +170,7 @@ skynet_context_new(const char * name, const char *param) {
 	ctx->cpu_start = 0;
 	ctx->message_count = 0;
 	ctx->profile = G_NODE.profile;
+	ctx->shared = false;
 	// Should set to 0 first to avoid skynet_handle_retireall get an uninitialized handle
 	ctx->handle = 0;	
 	ctx->handle = skynet_handle_register(ctx);
@@ -263,7 +285,8 @@ dispatch_message(struct skynet_context *ctx, struct skynet_message *msg) {
 	CHECKCALLING_BEGIN(ctx)
 	pthread_setspecific(G_NODE.handle_key, (void *)(uintptr_t)(ctx->handle));
 	int type = msg->sz >> MESSAGE_TYPE_SHIFT;
-	size_t sz = msg->sz & MESSAGE_TYPE_MASK;
+	size_t sz = msg->sz & MESSAGE_SIZE_MASK;
+	ctx->shared = (msg->sz & MESSAGE_SHARED) != 0;
 	FILE *f = (FILE *)ATOM_LOAD(&ctx->logfile);
 	if (f) {
 		skynet_log_output(f, msg->source, type, msg->session, msg->data, sz);
@@ -279,8 +302,11 @@ dispatch_message(struct skynet_context *ctx, struct skynet_message *msg) {
 		reserve_msg = ctx->cb(ctx, ctx->cb_ud, type, msg->session, msg->source, msg->data, sz);
 	}
 	if (!reserve_msg) {
-		skynet_free(msg->data);
+		release_message(msg);
+	} else if (ctx->shared) {
+		skynet_error(ctx, "error: The broadcast message from %x is kept, it may be freed by others", msg->source);
 	}
+	ctx->shared = false;
 	CHECKCALLING_END(ctx)
 }
 
@@ -330,7 +356,7 @@ skynet_context_message_dispatch(struct skynet_monitor *sm, struct message_queue
 		skynet_monitor_trigger(sm, msg.source , handle);
 
 		if (ctx->cb == NULL) {
-			skynet_free(msg.data);
+			release_message(&msg);
 		} else {
 			dispatch_message(ctx, &msg);
 		}
@@ -699,7 +725,7 @@ _filter_args(struct skynet_context * context, int type, int *session, void ** da
 
 int
 skynet_send(struct skynet_context * context, uint32_t source, uint32_t destination , int type, int session, void * data, size_t sz) {
-	if ((sz & MESSAGE_TYPE_MASK) != sz) {
+	if ((sz & MESSAGE_SIZE_MASK) != sz) {
 		skynet_error(context, "error: The message to %x is too large", destination);
 		if (type & PTYPE_TAG_DONTCOPY) {
 			skynet_free(data);
@@ -760,7 +786,7 @@ skynet_sendname(struct skynet_context * context, uint32_t source, const char * a
 			return -1;
 		}
 	} else {
-		if ((sz & MESSAGE_TYPE_MASK) != sz) {
+		if ((sz & MESSAGE_SIZE_MASK) != sz) {
 			skynet_error(context, "error: The message to %s is too large", addr);
 			if (type & PTYPE_TAG_DONTCOPY) {
 				skynet_free(data);
@@ -783,6 +809,74 @@ skynet_sendname(struct skynet_context * context, uint32_t source, const char * a
 	return skynet_send(context, source, des, type, session, data, sz);
 }
 
+int
+skynet_broadcast(struct skynet_context * context, uint32_t source, const uint32_t * handles, int n, int type, void * data, size_t sz) {
+	if ((sz & MESSAGE_SIZE_MASK) != sz) {
+		skynet_error(context, "error: The broadcast message is too large");
+		if (type & PTYPE_TAG_DONTCOPY) {
+			skynet_free(data);
+		}
+		return -2;
+	}
+	if (source == 0) {
+		source = context->handle;
+	}
+	int ptype = type & 0xff;
+	int i;
+	int local = 0;
+	int count = 0;
+	for (i=0;i<n;i++) {
+		uint32_t handle = handles[i];
+		if (handle == 0)
+			continue;
+		if (skynet_harbor_message_isremote(handle)) {
+			// the harbor service owns the message, send a copy
+			if (skynet_send(context, source, handle, ptype, 0, data, sz) >= 0) {
+				++count;
+			}
+		} else {
+			++local;
+		}
+	}
+	if (local == 0) {
+		if (type & PTYPE_TAG_DONTCOPY) {
+			skynet_free(data);
+		}
+		return count;
+	}
+	char * msg = skynet_malloc(SHARED_REF_OFFSET(sz) + sizeof(ATOM_INT));
+	if (data) {
+		memcpy(msg, data, sz);
+	}
+	msg[sz] = '\0';
+	if (type & PTYPE_TAG_DONTCOPY) {
+		skynet_free(data);
+	}
+	ATOM_INIT(shared_ref(msg, sz), local);
+
+	struct skynet_message smsg;
+	smsg.source = source;
+	smsg.session = 0;
+	smsg.data = msg;
+	smsg.sz = sz | MESSAGE_SHARED | (size_t)ptype << MESSAGE_TYPE_SHIFT;
+	for (i=0;i<n;i++) {
+		uint32_t handle = handles[i];
+		if (handle == 0 || skynet_harbor_message_isremote(handle))
+			continue;
+		if (skynet_context_push(handle, &smsg)) {
+			release_message(&smsg);
+		} else {
+			++count;
+		}
+	}
+	return count;
+}
+
+int
+skynet_isshared(struct skynet_context *ctx) {
+	return ctx->shared;
+}
+
 uint32_t 
 skynet_context_handle(struct skynet_context *ctx) {
 	return ctx->handle;
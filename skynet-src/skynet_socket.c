@@ -14,8 +14,8 @@
 static struct socket_server * SOCKET_SERVER = NULL;
 
 void 
-skynet_socket_init() {
-	SOCKET_SERVER = socket_server_create(skynet_now());
+skynet_socket_init(int max_socket) {
+	SOCKET_SERVER = socket_server_create(skynet_now(), max_socket);
 }
 
 void
@@ -126,12 +126,23 @@ skynet_socket_sendbuffer_lowpriority(struct skynet_context *ctx, struct socket_s
 	return socket_server_send_lowpriority(SOCKET_SERVER, buffer);
 }
 
+int
+skynet_socket_sendfile(struct skynet_context *ctx, int id, int fd, int64_t offset, size_t sz) {
+	return socket_server_sendfile(SOCKET_SERVER, id, fd, offset, sz);
+}
+
 int 
 skynet_socket_listen(struct skynet_context *ctx, const char *host, int port, int backlog) {
 	uint32_t source = skynet_context_handle(ctx);
 	return socket_server_listen(SOCKET_SERVER, source, host, port, backlog);
 }
 
+int
+skynet_socket_listen_reuseport(struct skynet_context *ctx, const char *host, int port, int backlog) {
+	uint32_t source = skynet_context_handle(ctx);
+	return socket_server_listen_reuseport(SOCKET_SERVER, source, host, port, backlog);
+}
+
 int 
 skynet_socket_connect(struct skynet_context *ctx, const char *host, int port) {
 	uint32_t source = skynet_context_handle(ctx);
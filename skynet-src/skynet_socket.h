@@ -21,7 +21,7 @@ struct skynet_socket_message {
 	char * buffer;
 };
 
-void skynet_socket_init();
+void skynet_socket_init(int max_socket);
 void skynet_socket_exit();
 void skynet_socket_free();
 int skynet_socket_poll();
@@ -29,7 +29,9 @@ void skynet_socket_updatetime();
 
 int skynet_socket_sendbuffer(struct skynet_context *ctx, struct socket_sendbuffer *buffer);
 int skynet_socket_sendbuffer_lowpriority(struct skynet_context *ctx, struct socket_sendbuffer *buffer);
+int skynet_socket_sendfile(struct skynet_context *ctx, int id, int fd, int64_t offset, size_t sz);
 int skynet_socket_listen(struct skynet_context *ctx, const char *host, int port, int backlog);
+int skynet_socket_listen_reuseport(struct skynet_context *ctx, const char *host, int port, int backlog);
 int skynet_socket_connect(struct skynet_context *ctx, const char *host, int port);
 int skynet_socket_bind(struct skynet_context *ctx, int fd);
 void skynet_socket_close(struct skynet_context *ctx, int id);
@@ -273,7 +273,7 @@ skynet_start(struct skynet_config * config) {
 	skynet_mq_init();
 	skynet_module_init(config->module_path);
 	skynet_timer_init();
-	skynet_socket_init();
+	skynet_socket_init(config->max_socket);
 	skynet_profile_enable(config->profile);
 
 	struct skynet_context *ctx = skynet_context_new(config->logservice, config->logger);
@@ -1,3 +1,8 @@
+#ifdef __linux__
+// for recvmmsg / sendmmsg
+#define _GNU_SOURCE
+#endif
+
 #include "skynet.h"
 
 #include "socket_server.h"
@@ -16,10 +21,18 @@
 #include <stdint.h>
 #include <assert.h>
 #include <string.h>
+#include <sched.h>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#endif
 
 #define MAX_INFO 128
-// MAX_SOCKET will be 2^MAX_SOCKET_P
-#define MAX_SOCKET_P 16
+// The size of slot table is 2^n, default is 2^DEFAULT_SOCKET_P, and can be set by config
+#define DEFAULT_SOCKET_P 16
+#define MIN_SOCKET_P 6
+#define MAX_SOCKET_P 24
 #define MAX_EVENT 64
 #define MIN_READ_BUFFER 64
 #define SOCKET_TYPE_INVALID 0
@@ -33,13 +46,11 @@
 #define SOCKET_TYPE_PACCEPT 8
 #define SOCKET_TYPE_BIND 9
 
-#define MAX_SOCKET (1<<MAX_SOCKET_P)
-
 #define PRIORITY_HIGH 0
 #define PRIORITY_LOW 1
 
-#define HASH_ID(id) (((unsigned)id) % MAX_SOCKET)
-#define ID_TAG16(id) ((id>>MAX_SOCKET_P) & 0xffff)
+#define HASH_ID(ss, id) (((unsigned)id) & ((ss)->slot_size - 1))
+#define ID_TAG16(ss, id) ((id>>(ss)->slot_bits) & 0xffff)
 
 #define PROTOCOL_TCP 0
 #define PROTOCOL_UDP 1
@@ -49,6 +60,8 @@
 #define UDP_ADDRESS_SIZE 19	// ipv6 128bit + port 16bit + 1 byte type
 
 #define MAX_UDP_PACKAGE 65535
+// max udp packages per recvmmsg/sendmmsg (linux)
+#define UDP_BATCH 8
 
 // EAGAIN and EWOULDBLOCK may be not the same value.
 #if (EAGAIN != EWOULDBLOCK)
@@ -61,12 +74,17 @@
 
 #define USEROBJECT ((size_t)(-1))
 
+// ctrl commands are queued in a ring with CTRL_RING_SIZE cells, must be 2^n
+#define CTRL_RING_SIZE 1024
+#define CTRL_PAYLOAD 256
+
 struct write_buffer {
 	struct write_buffer * next;
 	const void *buffer;
 	char *ptr;
 	size_t sz;
 	bool userobject;
+	bool file;
 };
 
 struct write_buffer_udp {
@@ -74,6 +92,13 @@ struct write_buffer_udp {
 	uint8_t udp_address[UDP_ADDRESS_SIZE];
 };
 
+// file content sent by sendfile, buffer.sz is the rest size
+struct write_buffer_file {
+	struct write_buffer buffer;
+	int fd;
+	off_t offset;
+};
+
 struct wb_list {
 	struct write_buffer * head;
 	struct write_buffer * tail;
@@ -112,22 +137,45 @@ struct socket {
 	size_t dw_size;
 };
 
+struct ctrl_cell {
+	ATOM_ULONG sequence;
+	uint8_t type;
+	uint8_t len;
+	union {
+		char buffer[CTRL_PAYLOAD];
+		uintptr_t align;
+	} u;
+};
+
+struct ctrl_ring {
+	ATOM_ULONG tail;	// producers (any thread)
+	char pad[64 - sizeof(ATOM_ULONG)];	// keep tail and head in different cache lines
+	unsigned long head;	// consumer (socket thread only)
+	struct ctrl_cell cell[CTRL_RING_SIZE];
+};
+
 struct socket_server {
 	volatile uint64_t time;
 	int reserve_fd;	// for EMFILE
-	int recvctrl_fd;
+	int recvctrl_fd;	// doorbell : eventfd on linux (recvctrl_fd == sendctrl_fd), or a pipe
 	int sendctrl_fd;
 	int checkctrl;
+	ATOM_INT doorbell;	// 1 means there is an unread wakeup in recvctrl_fd
+	struct ctrl_ring *ctrl;
 	poll_fd event_fd;
 	ATOM_INT alloc_id;
 	int event_n;
 	int event_index;
 	struct socket_object_interface soi;
 	struct event ev[MAX_EVENT];
-	struct socket slot[MAX_SOCKET];
+	int slot_bits;
+	int slot_size;	// 2^slot_bits
+	struct socket *slot;
 	char buffer[MAX_INFO];
 	uint8_t udpbuffer[MAX_UDP_PACKAGE];
-	fd_set rfds;
+#ifdef __linux__
+	struct udp_batch *udpbatch;	// create on first udp read
+#endif
 };
 
 struct request_open {
@@ -148,6 +196,13 @@ struct request_send_udp {
 	uint8_t address[UDP_ADDRESS_SIZE];
 };
 
+struct request_sendfile {
+	int id;
+	int fd;
+	int64_t offset;
+	size_t sz;
+};
+
 struct request_setudp {
 	int id;
 	uint8_t address[UDP_ADDRESS_SIZE];
@@ -198,7 +253,7 @@ struct request_dial_udp {
 };
 
 /*
-	The first byte is TYPE
+	Commands are queued in ctrl_ring, each cell carries a TYPE
 	R Resume socket
 	S Pause socket
 	B Bind socket
@@ -209,6 +264,7 @@ struct request_dial_udp {
 	W Enable write
 	D Send package (high)
 	P Send package (low)
+	F Send file
 	A Send UDP package
 	C set udp address
 	N client dial to UDP host port
@@ -217,12 +273,12 @@ struct request_dial_udp {
  */
 
 struct request_package {
-	uint8_t header[8];	// 6 bytes dummy
 	union {
 		char buffer[256];
 		struct request_open open;
 		struct request_send send;
 		struct request_send_udp send_udp;
+		struct request_sendfile sendfile;
 		struct request_close close;
 		struct request_listen listen;
 		struct request_bind bind;
@@ -241,6 +297,20 @@ union sockaddr_all {
 	struct sockaddr_in6 v6;
 };
 
+#ifdef __linux__
+
+struct udp_batch {
+	int id;	// socket id of the rest packages
+	int n;
+	int index;
+	struct mmsghdr msg[UDP_BATCH];
+	struct iovec iov[UDP_BATCH];
+	union sockaddr_all addr[UDP_BATCH];
+	uint8_t buffer[UDP_BATCH][MAX_UDP_PACKAGE];
+};
+
+#endif
+
 struct send_object {
 	const void * buffer;
 	size_t sz;
@@ -338,7 +408,9 @@ send_object_init_from_sendbuffer(struct socket_server *ss, struct send_object *s
 
 static inline void
 write_buffer_free(struct socket_server *ss, struct write_buffer *wb) {
-	if (wb->userobject) {
+	if (wb->file) {
+		close(((struct write_buffer_file *)wb)->fd);
+	} else if (wb->userobject) {
 		ss->soi.free((void *)wb->buffer);
 	} else {
 		FREE((void *)wb->buffer);
@@ -355,12 +427,12 @@ socket_keepalive(int fd) {
 static int
 reserve_id(struct socket_server *ss) {
 	int i;
-	for (i=0;i<MAX_SOCKET;i++) {
+	for (i=0;i<ss->slot_size;i++) {
 		int id = ATOM_FINC(&(ss->alloc_id))+1;
 		if (id < 0) {
 			id = ATOM_FAND(&(ss->alloc_id), 0x7fffffff) & 0x7fffffff;
 		}
-		struct socket *s = &ss->slot[HASH_ID(id)];
+		struct socket *s = &ss->slot[HASH_ID(ss, id)];
 		int type_invalid = ATOM_LOAD(&s->type);
 		if (type_invalid == SOCKET_TYPE_INVALID) {
 			if (ATOM_CAS(&s->type, type_invalid, SOCKET_TYPE_RESERVE)) {
@@ -386,8 +458,54 @@ clear_wb_list(struct wb_list *list) {
 	list->tail = NULL;
 }
 
+static int
+create_doorbell(int fd[2]) {
+#ifdef __linux__
+	int efd = eventfd(0, EFD_NONBLOCK);
+	if (efd < 0)
+		return 1;
+	fd[0] = efd;
+	fd[1] = efd;
+	return 0;
+#else
+	if (pipe(fd))
+		return 1;
+	sp_nonblocking(fd[0]);
+	return 0;
+#endif
+}
+
+static void
+close_doorbell(int fd[2]) {
+	close(fd[0]);
+	if (fd[1] != fd[0])
+		close(fd[1]);
+}
+
+static struct ctrl_ring *
+ctrl_ring_create() {
+	struct ctrl_ring *r = MALLOC(sizeof(*r));
+	unsigned long i;
+	ATOM_INIT(&r->tail, 0);
+	r->head = 0;
+	for (i=0;i<CTRL_RING_SIZE;i++) {
+		ATOM_INIT(&r->cell[i].sequence, i);
+	}
+	return r;
+}
+
+static int
+slot_bits(int max_socket) {
+	int bits = MIN_SOCKET_P;
+	if (max_socket <= 0)
+		return DEFAULT_SOCKET_P;
+	while (bits < MAX_SOCKET_P && (1 << bits) < max_socket)
+		++bits;
+	return bits;
+}
+
 struct socket_server * 
-socket_server_create(uint64_t time) {
+socket_server_create(uint64_t time, int max_socket) {
 	int i;
 	int fd[2];
 	poll_fd efd = sp_create();
@@ -395,16 +513,15 @@ socket_server_create(uint64_t time) {
 		skynet_error(NULL, "socket-server error: create event pool failed.");
 		return NULL;
 	}
-	if (pipe(fd)) {
+	if (create_doorbell(fd)) {
 		sp_release(efd);
-		skynet_error(NULL, "socket-server error: create socket pair failed.");
+		skynet_error(NULL, "socket-server error: create ctrl doorbell failed.");
 		return NULL;
 	}
 	if (sp_add(efd, fd[0], NULL)) {
 		// add recvctrl_fd to event poll
 		skynet_error(NULL, "socket-server error: can't add server fd to event pool.");
-		close(fd[0]);
-		close(fd[1]);
+		close_doorbell(fd);
 		sp_release(efd);
 		return NULL;
 	}
@@ -415,9 +532,14 @@ socket_server_create(uint64_t time) {
 	ss->recvctrl_fd = fd[0];
 	ss->sendctrl_fd = fd[1];
 	ss->checkctrl = 1;
+	ATOM_INIT(&ss->doorbell, 0);
+	ss->ctrl = ctrl_ring_create();
 	ss->reserve_fd = dup(1);	// reserve an extra fd for EMFILE
+	ss->slot_bits = slot_bits(max_socket);
+	ss->slot_size = 1 << ss->slot_bits;
+	ss->slot = MALLOC(ss->slot_size * sizeof(struct socket));
 
-	for (i=0;i<MAX_SOCKET;i++) {
+	for (i=0;i<ss->slot_size;i++) {
 		struct socket *s = &ss->slot[i];
 		ATOM_INIT(&s->type, SOCKET_TYPE_INVALID);
 		clear_wb_list(&s->high);
@@ -428,8 +550,9 @@ socket_server_create(uint64_t time) {
 	ss->event_n = 0;
 	ss->event_index = 0;
 	memset(&ss->soi, 0, sizeof(ss->soi));
-	FD_ZERO(&ss->rfds);
-	assert(ss->recvctrl_fd < FD_SETSIZE);
+#ifdef __linux__
+	ss->udpbatch = NULL;
+#endif
 
 	return ss;
 }
@@ -524,7 +647,7 @@ void
 socket_server_release(struct socket_server *ss) {
 	int i;
 	struct socket_message dummy;
-	for (i=0;i<MAX_SOCKET;i++) {
+	for (i=0;i<ss->slot_size;i++) {
 		struct socket *s = &ss->slot[i];
 		struct socket_lock l;
 		socket_lock_init(s, &l);
@@ -533,8 +656,13 @@ socket_server_release(struct socket_server *ss) {
 		}
 		spinlock_destroy(&s->dw_lock);
 	}
-	close(ss->sendctrl_fd);
-	close(ss->recvctrl_fd);
+	int fd[2] = { ss->recvctrl_fd, ss->sendctrl_fd };
+	close_doorbell(fd);
+	FREE(ss->ctrl);
+	FREE(ss->slot);
+#ifdef __linux__
+	FREE(ss->udpbatch);
+#endif
 	sp_release(ss->event_fd);
 	if (ss->reserve_fd >= 0)
 		close(ss->reserve_fd);
@@ -567,7 +695,7 @@ enable_read(struct socket_server *ss, struct socket *s, bool enable) {
 
 static struct socket *
 new_fd(struct socket_server *ss, int id, int fd, int protocol, uintptr_t opaque, bool reading) {
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = &ss->slot[HASH_ID(ss, id)];
 	assert(ATOM_LOAD(&s->type) == SOCKET_TYPE_RESERVE);
 
 	if (sp_add(ss->event_fd, fd, s)) {
@@ -580,7 +708,7 @@ new_fd(struct socket_server *ss, int id, int fd, int protocol, uintptr_t opaque,
 	s->reading = true;
 	s->writing = false;
 	s->closing = false;
-	ATOM_INIT(&s->sending , ID_TAG16(id) << 16 | 0);
+	ATOM_INIT(&s->sending , ID_TAG16(ss, id) << 16 | 0);
 	s->protocol = protocol;
 	s->p.size = MIN_READ_BUFFER;
 	s->opaque = opaque;
@@ -687,7 +815,7 @@ _failed:
 		close(sock);
 	freeaddrinfo( ai_list );
 _failed_getaddrinfo:
-	ATOM_STORE(&ss->slot[HASH_ID(id)].type, SOCKET_TYPE_INVALID);
+	ATOM_STORE(&ss->slot[HASH_ID(ss, id)].type, SOCKET_TYPE_INVALID);
 	return SOCKET_ERR;
 }
 
@@ -723,12 +851,36 @@ close_write(struct socket_server *ss, struct socket *s, struct socket_lock *l, s
 	}
 }
 
+static ssize_t
+send_file(struct socket_server *ss, int sock, struct write_buffer_file *f) {
+	size_t sz = f->buffer.sz;
+#ifdef __linux__
+	return sendfile(sock, f->fd, &f->offset, sz);
+#else
+	// no portable sendfile, copy through udpbuffer (only socket thread use it)
+	if (sz > sizeof(ss->udpbuffer))
+		sz = sizeof(ss->udpbuffer);
+	ssize_t n = pread(f->fd, ss->udpbuffer, sz, f->offset);
+	if (n <= 0)
+		return n;
+	n = write(sock, ss->udpbuffer, n);
+	if (n > 0)
+		f->offset += n;
+	return n;
+#endif
+}
+
 static int
 send_list_tcp(struct socket_server *ss, struct socket *s, struct wb_list *list, struct socket_lock *l, struct socket_message *result) {
 	while (list->head) {
 		struct write_buffer * tmp = list->head;
 		for (;;) {
-			ssize_t sz = write(s->fd, tmp->ptr, tmp->sz);
+			ssize_t sz;
+			if (tmp->file) {
+				sz = send_file(ss, s->fd, (struct write_buffer_file *)tmp);
+			} else {
+				sz = write(s->fd, tmp->ptr, tmp->sz);
+			}
 			if (sz < 0) {
 				switch(errno) {
 				case EINTR:
@@ -738,6 +890,19 @@ send_list_tcp(struct socket_server *ss, struct socket *s, struct wb_list *list,
 				}
 				return close_write(ss, s, l, result);
 			}
+			if (tmp->file) {
+				// file content is not counted in wb_size
+				if (sz == 0) {
+					skynet_error(NULL, "socket-server : sendfile (%d) error: file is shorter than expected.", s->id);
+					break;
+				}
+				stat_write(ss,s,(int)sz);
+				if (sz != tmp->sz) {
+					tmp->sz -= sz;
+					return -1;
+				}
+				break;
+			}
 			stat_write(ss,s,(int)sz);
 			s->wb_size -= sz;
 			if (sz != tmp->sz) {
@@ -788,6 +953,64 @@ drop_udp(struct socket_server *ss, struct socket *s, struct wb_list *list, struc
 	write_buffer_free(ss,tmp);
 }
 
+#ifdef __linux__
+
+static int
+send_list_udp(struct socket_server *ss, struct socket *s, struct wb_list *list, struct socket_message *result) {
+	while (list->head) {
+		struct mmsghdr msg[UDP_BATCH];
+		struct iovec iov[UDP_BATCH];
+		union sockaddr_all sa[UDP_BATCH];
+		struct write_buffer * tmp = list->head;
+		int n = 0;
+		// collect packages from the head of list
+		while (tmp && n < UDP_BATCH) {
+			struct write_buffer_udp * udp = (struct write_buffer_udp *)tmp;
+			socklen_t sasz = udp_socket_address(s, udp->udp_address, &sa[n]);
+			if (sasz == 0) {
+				if (n > 0)
+					break;	// send the packages before it first
+				skynet_error(NULL, "socket-server : udp (%d) error: type mismatch.", s->id);
+				drop_udp(ss, s, list, tmp);
+				return -1;
+			}
+			iov[n].iov_base = tmp->ptr;
+			iov[n].iov_len = tmp->sz;
+			memset(&msg[n], 0, sizeof(msg[n]));
+			msg[n].msg_hdr.msg_name = &sa[n].s;
+			msg[n].msg_hdr.msg_namelen = sasz;
+			msg[n].msg_hdr.msg_iov = &iov[n];
+			msg[n].msg_hdr.msg_iovlen = 1;
+			++n;
+			tmp = tmp->next;
+		}
+		int sent = sendmmsg(s->fd, msg, n, 0);
+		if (sent < 0) {
+			switch(errno) {
+			case EINTR:
+			case AGAIN_WOULDBLOCK:
+				return -1;
+			}
+			skynet_error(NULL, "socket-server : udp (%d) sendto error %s.",s->id, strerror(errno));
+			drop_udp(ss, s, list, list->head);
+			return -1;
+		}
+		int i;
+		for (i=0;i<sent;i++) {
+			tmp = list->head;
+			stat_write(ss,s,tmp->sz);
+			s->wb_size -= tmp->sz;
+			list->head = tmp->next;
+			write_buffer_free(ss,tmp);
+		}
+	}
+	list->tail = NULL;
+
+	return -1;
+}
+
+#else
+
 static int
 send_list_udp(struct socket_server *ss, struct socket *s, struct wb_list *list, struct socket_message *result) {
 	while (list->head) {
@@ -821,6 +1044,8 @@ send_list_udp(struct socket_server *ss, struct socket *s, struct wb_list *list,
 	return -1;
 }
 
+#endif
+
 static int
 send_list(struct socket_server *ss, struct socket *s, struct wb_list *list, struct socket_lock *l, struct socket_message *result) {
 	if (s->protocol == PROTOCOL_TCP) {
@@ -939,6 +1164,7 @@ send_buffer(struct socket_server *ss, struct socket *s, struct socket_lock *l, s
 		struct write_buffer * buf = MALLOC(sizeof(*buf));
 		struct send_object so;
 		buf->userobject = send_object_init(ss, &so, (void *)s->dw_buffer, s->dw_size);
+		buf->file = false;
 		buf->ptr = (char*)so.buffer+s->dw_offset;
 		buf->sz = so.sz - s->dw_offset;
 		buf->buffer = (void *)s->dw_buffer;
@@ -963,6 +1189,7 @@ append_sendbuffer_(struct socket_server *ss, struct wb_list *s, struct request_s
 	struct write_buffer * buf = MALLOC(size);
 	struct send_object so;
 	buf->userobject = send_object_init(ss, &so, request->buffer, request->sz);
+	buf->file = false;
 	buf->ptr = (char*)so.buffer;
 	buf->sz = so.sz;
 	buf->buffer = request->buffer;
@@ -1001,7 +1228,7 @@ append_sendbuffer_low(struct socket_server *ss,struct socket *s, struct request_
 static int
 trigger_write(struct socket_server *ss, struct request_send * request, struct socket_message *result) {
 	int id = request->id;
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = &ss->slot[HASH_ID(ss, id)];
 	if (socket_invalid(s, id))
 		return -1;
 	if (enable_write(ss, s, true)) {
@@ -1010,6 +1237,47 @@ trigger_write(struct socket_server *ss, struct request_send * request, struct so
 	return -1;
 }
 
+static int
+sendfile_socket(struct socket_server *ss, struct request_sendfile * request, struct socket_message *result) {
+	int id = request->id;
+	struct socket * s = &ss->slot[HASH_ID(ss, id)];
+	uint8_t type = ATOM_LOAD(&s->type);
+	if (type == SOCKET_TYPE_INVALID || s->id != id
+		|| type == SOCKET_TYPE_HALFCLOSE_WRITE
+		|| type == SOCKET_TYPE_PACCEPT
+		|| type == SOCKET_TYPE_PLISTEN
+		|| type == SOCKET_TYPE_LISTEN
+		|| s->protocol != PROTOCOL_TCP
+		|| s->closing) {
+		close(request->fd);
+		return -1;
+	}
+	struct write_buffer_file * f = MALLOC(sizeof(*f));
+	struct write_buffer * buf = &f->buffer;
+	buf->buffer = NULL;
+	buf->ptr = NULL;
+	buf->sz = request->sz;
+	buf->userobject = false;
+	buf->file = true;
+	buf->next = NULL;
+	f->fd = request->fd;
+	f->offset = (off_t)request->offset;
+
+	// always append to high list, keep the order with packages sent by socket_server_send
+	struct wb_list *list = &s->high;
+	bool empty = send_buffer_empty(s);
+	if (list->head == NULL) {
+		list->head = list->tail = buf;
+	} else {
+		list->tail->next = buf;
+		list->tail = buf;
+	}
+	if (empty && enable_write(ss, s, true)) {
+		return report_error(s, result, "enable write failed");
+	}
+	return -1;
+}
+
 /*
 	When send a package , we can assign the priority : PRIORITY_HIGH or PRIORITY_LOW
 
@@ -1020,7 +1288,7 @@ trigger_write(struct socket_server *ss, struct request_send * request, struct so
 static int
 send_socket(struct socket_server *ss, struct request_send * request, struct socket_message *result, int priority, const uint8_t *udp_address) {
 	int id = request->id;
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = &ss->slot[HASH_ID(ss, id)];
 	struct send_object so;
 	send_object_init(ss, &so, request->buffer, request->sz);
 	uint8_t type = ATOM_LOAD(&s->type);
@@ -1126,7 +1394,7 @@ _failed:
 	result->id = id;
 	result->ud = 0;
 	result->data = "reach skynet socket number limit";
-	ss->slot[HASH_ID(id)].type = SOCKET_TYPE_INVALID;
+	ss->slot[HASH_ID(ss, id)].type = SOCKET_TYPE_INVALID;
 
 	return SOCKET_ERR;
 }
@@ -1162,7 +1430,7 @@ halfclose_read(struct socket *s) {
 static int
 close_socket(struct socket_server *ss, struct request_close *request, struct socket_message *result) {
 	int id = request->id;
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = &ss->slot[HASH_ID(ss, id)];
 	if (socket_invalid(s, id)) {
 		// The socket is closed, ignore
 		return -1;
@@ -1212,7 +1480,7 @@ resume_socket(struct socket_server *ss, struct request_resumepause *request, str
 	result->opaque = request->opaque;
 	result->ud = 0;
 	result->data = NULL;
-	struct socket *s = &ss->slot[HASH_ID(id)];
+	struct socket *s = &ss->slot[HASH_ID(ss, id)];
 	if (socket_invalid(s, id)) {
 		result->data = "invalid socket";
 		return SOCKET_ERR;
@@ -1247,7 +1515,7 @@ resume_socket(struct socket_server *ss, struct request_resumepause *request, str
 static int
 pause_socket(struct socket_server *ss, struct request_resumepause *request, struct socket_message *result) {
 	int id = request->id;
-	struct socket *s = &ss->slot[HASH_ID(id)];
+	struct socket *s = &ss->slot[HASH_ID(ss, id)];
 	if (socket_invalid(s, id)) {
 		return -1;
 	}
@@ -1260,7 +1528,7 @@ pause_socket(struct socket_server *ss, struct request_resumepause *request, stru
 static void
 setopt_socket(struct socket_server *ss, struct request_setopt *request) {
 	int id = request->id;
-	struct socket *s = &ss->slot[HASH_ID(id)];
+	struct socket *s = &ss->slot[HASH_ID(ss, id)];
 	if (socket_invalid(s, id)) {
 		return;
 	}
@@ -1268,34 +1536,31 @@ setopt_socket(struct socket_server *ss, struct request_setopt *request) {
 	setsockopt(s->fd, IPPROTO_TCP, request->what, &v, sizeof(v));
 }
 
-static void
-block_readpipe(int pipefd, void *buffer, int sz) {
-	for (;;) {
-		int n = read(pipefd, buffer, sz);
-		if (n<0) {
-			if (errno == EINTR)
-				continue;
-			skynet_error(NULL, "socket-server : read pipe error %s.",strerror(errno));
-			return;
-		}
-		// must atomic read from a pipe
-		assert(n == sz);
-		return;
-	}
+static inline struct ctrl_cell *
+ctrl_ring_front(struct ctrl_ring *r) {
+	struct ctrl_cell *c = &r->cell[r->head & (CTRL_RING_SIZE-1)];
+	if (ATOM_LOAD(&c->sequence) != r->head + 1)
+		return NULL;
+	return c;
 }
 
 static int
 has_cmd(struct socket_server *ss) {
-	struct timeval tv = {0,0};
-	int retval;
-
-	FD_SET(ss->recvctrl_fd, &ss->rfds);
+	return ctrl_ring_front(ss->ctrl) != NULL;
+}
 
-	retval = select(ss->recvctrl_fd+1, &ss->rfds, NULL, NULL, &tv);
-	if (retval == 1) {
-		return 1;
+// Only the socket thread reads the doorbell. Reset it before draining the ring,
+// so a command published after the drain always rings again.
+static void
+clear_doorbell(struct socket_server *ss) {
+	uint64_t counter;
+	for (;;) {
+		int n = read(ss->recvctrl_fd, &counter, sizeof(counter));
+		if (n < 0 && errno == EINTR)
+			continue;
+		break;
 	}
-	return 0;
+	ATOM_STORE(&ss->doorbell, 0);
 }
 
 static void
@@ -1310,7 +1575,7 @@ add_udp_socket(struct socket_server *ss, struct request_udp *udp) {
 	struct socket *ns = new_fd(ss, id, udp->fd, protocol, udp->opaque, true);
 	if (ns == NULL) {
 		close(udp->fd);
-		ss->slot[HASH_ID(id)].type = SOCKET_TYPE_INVALID;
+		ss->slot[HASH_ID(ss, id)].type = SOCKET_TYPE_INVALID;
 		return;
 	}
 	ATOM_STORE(&ns->type , SOCKET_TYPE_CONNECTED);
@@ -1320,7 +1585,7 @@ add_udp_socket(struct socket_server *ss, struct request_udp *udp) {
 static int
 set_udp_address(struct socket_server *ss, struct request_setudp *request, struct socket_message *result) {
 	int id = request->id;
-	struct socket *s = &ss->slot[HASH_ID(id)];
+	struct socket *s = &ss->slot[HASH_ID(ss, id)];
 	if (socket_invalid(s, id)) {
 		return -1;
 	}
@@ -1346,7 +1611,7 @@ dial_udp_socket(struct socket_server *ss, struct request_dial_udp *request, stru
 	struct socket *ns = new_fd(ss, id, request->fd, protocol, request->opaque, true);
 	if (ns == NULL){
 		close(request->fd);
-		ss->slot[HASH_ID(id)].type = SOCKET_TYPE_INVALID;
+		ss->slot[HASH_ID(ss, id)].type = SOCKET_TYPE_INVALID;
 		return -1;
 	}
 
@@ -1363,12 +1628,12 @@ dial_udp_socket(struct socket_server *ss, struct request_dial_udp *request, stru
 }
 
 static inline void
-inc_sending_ref(struct socket *s, int id) {
+inc_sending_ref(struct socket_server *ss, struct socket *s, int id) {
 	if (s->protocol != PROTOCOL_TCP)
 		return;
 	for (;;) {
 		unsigned long sending = ATOM_LOAD(&s->sending);
-		if ((sending >> 16) == ID_TAG16(id)) {
+		if ((sending >> 16) == ID_TAG16(ss, id)) {
 			if ((sending & 0xffff) == 0xffff) {
 				// s->sending may overflow (rarely), so busy waiting here for socket thread dec it. see issue #794
 				continue;
@@ -1386,7 +1651,7 @@ inc_sending_ref(struct socket *s, int id) {
 
 static inline void
 dec_sending_ref(struct socket_server *ss, int id) {
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = &ss->slot[HASH_ID(ss, id)];
 	// Notice: udp may inc sending while type == SOCKET_TYPE_RESERVE
 	if (s->id == id && s->protocol == PROTOCOL_TCP) {
 		assert((ATOM_LOAD(&s->sending) & 0xffff) != 0);
@@ -1397,14 +1662,20 @@ dec_sending_ref(struct socket_server *ss, int id) {
 // return type
 static int
 ctrl_cmd(struct socket_server *ss, struct socket_message *result) {
-	int fd = ss->recvctrl_fd;
+	struct ctrl_ring *r = ss->ctrl;
+	struct ctrl_cell *c = ctrl_ring_front(r);
 	// the length of message is one byte, so 256 buffer size is enough.
-	uint8_t buffer[256];
-	uint8_t header[2];
-	block_readpipe(fd, header, sizeof(header));
-	int type = header[0];
-	int len = header[1];
-	block_readpipe(fd, buffer, len);
+	union {
+		uint8_t buffer[CTRL_PAYLOAD];
+		uintptr_t align;
+	} u;
+	int type = c->type;
+	int len = c->len;
+	memcpy(u.buffer, c->u.buffer, len);
+	// release the cell to producers
+	ATOM_STORE(&c->sequence, r->head + CTRL_RING_SIZE);
+	++r->head;
+	uint8_t *buffer = u.buffer;
 	// ctrl command only exist in local fd, so don't worry about endian.
 	switch (type) {
 	case 'R':
@@ -1435,6 +1706,12 @@ ctrl_cmd(struct socket_server *ss, struct socket_message *result) {
 		dec_sending_ref(ss, request->id);
 		return ret;
 	}
+	case 'F': {
+		struct request_sendfile * request = (struct request_sendfile *) buffer;
+		int ret = sendfile_socket(ss, request, result);
+		dec_sending_ref(ss, request->id);
+		return ret;
+	}
 	case 'A': {
 		struct request_send_udp * rsu = (struct request_send_udp *)buffer;
 		return send_socket(ss, &rsu->send, result, PRIORITY_HIGH, rsu->address);
@@ -1538,45 +1815,100 @@ gen_udp_address(int protocol, union sockaddr_all *sa, uint8_t * udp_address) {
 	return addrsz;
 }
 
+#ifdef __linux__
+
+// read a batch of packages by recvmmsg, and return them one by one.
 static int
-forward_message_udp(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message * result) {
-	union sockaddr_all sa;
-	socklen_t slen = sizeof(sa);
-	int n = recvfrom(s->fd, ss->udpbuffer,MAX_UDP_PACKAGE,0,&sa.s,&slen);
-	if (n<0) {
-		switch(errno) {
-		case EINTR:
-		case AGAIN_WOULDBLOCK:
+recv_udp(struct socket_server *ss, struct socket *s, union sockaddr_all *sa, socklen_t *slen, uint8_t **buffer) {
+	struct udp_batch *b = ss->udpbatch;
+	if (b == NULL) {
+		b = ss->udpbatch = MALLOC(sizeof(*b));
+		b->id = -1;
+		b->n = 0;
+		b->index = 0;
+	}
+	if (b->id != s->id || b->index >= b->n) {
+		// socket changed (the rest packages belong to a closed socket) or all packages dispatched
+		int i;
+		for (i=0;i<UDP_BATCH;i++) {
+			b->iov[i].iov_base = b->buffer[i];
+			b->iov[i].iov_len = MAX_UDP_PACKAGE;
+			memset(&b->msg[i], 0, sizeof(b->msg[i]));
+			b->msg[i].msg_hdr.msg_name = &b->addr[i];
+			b->msg[i].msg_hdr.msg_namelen = sizeof(b->addr[i]);
+			b->msg[i].msg_hdr.msg_iov = &b->iov[i];
+			b->msg[i].msg_hdr.msg_iovlen = 1;
+		}
+		b->id = s->id;
+		b->index = 0;
+		int n = recvmmsg(s->fd, b->msg, UDP_BATCH, 0, NULL);
+		if (n < 0) {
+			b->n = 0;
 			return -1;
 		}
-		int error = errno;
-		// close when error
-		force_close(ss, s, l, result);
-		result->data = strerror(error);
-		return SOCKET_ERR;
+		b->n = n;
 	}
-	stat_read(ss,s,n);
+	struct mmsghdr *m = &b->msg[b->index];
+	*slen = m->msg_hdr.msg_namelen;
+	memcpy(sa, &b->addr[b->index], *slen);
+	*buffer = b->buffer[b->index];
+	++b->index;
+	return m->msg_len;
+}
 
-	uint8_t * data;
-	if (slen == sizeof(sa.v4)) {
-		if (s->protocol != PROTOCOL_UDP)
-			return -1;
-		data = MALLOC(n + 1 + 2 + 4);
-		gen_udp_address(PROTOCOL_UDP, &sa, data + n);
-	} else {
-		if (s->protocol != PROTOCOL_UDPv6)
-			return -1;
-		data = MALLOC(n + 1 + 2 + 16);
-		gen_udp_address(PROTOCOL_UDPv6, &sa, data + n);
-	}
-	memcpy(data, ss->udpbuffer, n);
+#else
 
-	result->opaque = s->opaque;
-	result->id = s->id;
-	result->ud = n;
-	result->data = (char *)data;
+static int
+recv_udp(struct socket_server *ss, struct socket *s, union sockaddr_all *sa, socklen_t *slen, uint8_t **buffer) {
+	*slen = sizeof(*sa);
+	*buffer = ss->udpbuffer;
+	return recvfrom(s->fd, ss->udpbuffer,MAX_UDP_PACKAGE,0,&sa->s,slen);
+}
+
+#endif
 
-	return SOCKET_UDP;
+static int
+forward_message_udp(struct socket_server *ss, struct socket *s, struct socket_lock *l, struct socket_message * result) {
+	for (;;) {
+		union sockaddr_all sa;
+		socklen_t slen;
+		uint8_t * buffer;
+		int n = recv_udp(ss, s, &sa, &slen, &buffer);
+		if (n<0) {
+			switch(errno) {
+			case EINTR:
+			case AGAIN_WOULDBLOCK:
+				return -1;
+			}
+			int error = errno;
+			// close when error
+			force_close(ss, s, l, result);
+			result->data = strerror(error);
+			return SOCKET_ERR;
+		}
+		stat_read(ss,s,n);
+
+		uint8_t * data;
+		if (slen == sizeof(sa.v4)) {
+			if (s->protocol != PROTOCOL_UDP)
+				continue;	// drop it
+			data = MALLOC(n + 1 + 2 + 4);
+			gen_udp_address(PROTOCOL_UDP, &sa, data + n);
+		} else {
+			if (s->protocol != PROTOCOL_UDPv6)
+				continue;	// drop it
+			data = MALLOC(n + 1 + 2 + 16);
+			gen_udp_address(PROTOCOL_UDPv6, &sa, data + n);
+		}
+		memcpy(data, buffer, n);
+
+		result->opaque = s->opaque;
+		result->id = s->id;
+		result->ud = n;
+		result->data = (char *)data;
+
+		return SOCKET_UDP;
+	}
 }
 
 static int
@@ -1634,7 +1966,11 @@ static int
 report_accept(struct socket_server *ss, struct socket *s, struct socket_message *result) {
 	union sockaddr_all u;
 	socklen_t len = sizeof(u);
+#ifdef __linux__
+	int client_fd = accept4(s->fd, &u.s, &len, SOCK_NONBLOCK);
+#else
 	int client_fd = accept(s->fd, &u.s, &len);
+#endif
 	if (client_fd < 0) {
 		if (errno == EMFILE || errno == ENFILE) {
 			result->opaque = s->opaque;
@@ -1662,7 +1998,9 @@ report_accept(struct socket_server *ss, struct socket *s, struct socket_message
 		return 0;
 	}
 	socket_keepalive(client_fd);
+#ifndef __linux__
 	sp_nonblocking(client_fd);
+#endif
 	struct socket *ns = new_fd(ss, id, client_fd, PROTOCOL_TCP, s->opaque, false);
 	if (ns == NULL) {
 		close(client_fd);
@@ -1737,7 +2075,9 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 		struct event *e = &ss->ev[ss->event_index++];
 		struct socket *s = e->s;
 		if (s == NULL) {
-			// dispatch pipe message at beginning
+			// doorbell : dispatch ctrl commands before the next event
+			clear_doorbell(ss);
+			ss->checkctrl = 1;
 			continue;
 		}
 		struct socket_lock l;
@@ -1748,6 +2088,8 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 		case SOCKET_TYPE_LISTEN: {
 			int ok = report_accept(ss, s, result);
 			if (ok > 0) {
+				// accept again until EAGAIN, so a burst of connections are accepted in one wakeup
+				--ss->event_index;
 				return SOCKET_ACCEPT;
 			} if (ok < 0 ) {
 				return SOCKET_ERR;
@@ -1820,19 +2162,43 @@ socket_server_poll(struct socket_server *ss, struct socket_message * result, int
 
 static void
 send_request(struct socket_server *ss, struct request_package *request, char type, int len) {
-	request->header[6] = (uint8_t)type;
-	request->header[7] = (uint8_t)len;
-	const char * req = (const char *)request + offsetof(struct request_package, header[6]);
+	struct ctrl_ring *r = ss->ctrl;
+	struct ctrl_cell *c;
+	unsigned long pos = ATOM_LOAD(&r->tail);
 	for (;;) {
-		ssize_t n = write(ss->sendctrl_fd, req, len+2);
-		if (n<0) {
-			if (errno != EINTR) {
-				skynet_error(NULL, "socket-server : send ctrl command error %s.", strerror(errno));
-			}
+		c = &r->cell[pos & (CTRL_RING_SIZE-1)];
+		long diff = (long)(ATOM_LOAD(&c->sequence) - pos);
+		if (diff == 0) {
+			if (ATOM_CAS_ULONG(&r->tail, pos, pos + 1))
+				break;
+		} else if (diff < 0) {
+			// ring is full, wait for socket thread
+			sched_yield();
+		}
+		pos = ATOM_LOAD(&r->tail);
+	}
+	c->type = (uint8_t)type;
+	c->len = (uint8_t)len;
+	memcpy(c->u.buffer, &request->u, len);
+	ATOM_STORE(&c->sequence, pos + 1);
+
+	// coalesce wakeups : only the first command after the socket thread clears the doorbell writes to it.
+	while (ATOM_LOAD(&ss->doorbell) == 0) {
+		if (!ATOM_CAS(&ss->doorbell, 0, 1))
 			continue;
+		uint64_t one = 1;
+		for (;;) {
+			ssize_t n = write(ss->sendctrl_fd, &one, sizeof(one));
+			if (n<0) {
+				if (errno != EINTR) {
+					skynet_error(NULL, "socket-server : send ctrl command error %s.", strerror(errno));
+					return;
+				}
+				continue;
+			}
+			assert(n == sizeof(one));
+			return;
 		}
-		assert(n == len+2);
-		return;
 	}
 }
 
@@ -1874,7 +2240,7 @@ can_direct_write(struct socket *s, int id) {
 int 
 socket_server_send(struct socket_server *ss, struct socket_sendbuffer *buf) {
 	int id = buf->id;
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = &ss->slot[HASH_ID(ss, id)];
 	if (socket_invalid(s, id) || s->closing) {
 		free_buffer(ss, buf);
 		return -1;
@@ -1933,7 +2299,7 @@ socket_server_send(struct socket_server *ss, struct socket_sendbuffer *buf) {
 		socket_unlock(&l);
 	}
 
-	inc_sending_ref(s, id);
+	inc_sending_ref(ss, s, id);
 
 	struct request_package request;
 	request.u.send.id = id;
@@ -1948,13 +2314,13 @@ int
 socket_server_send_lowpriority(struct socket_server *ss, struct socket_sendbuffer *buf) {
 	int id = buf->id;
 
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = &ss->slot[HASH_ID(ss, id)];
 	if (socket_invalid(s, id)) {
 		free_buffer(ss, buf);
 		return -1;
 	}
 
-	inc_sending_ref(s, id);
+	inc_sending_ref(ss, s, id);
 
 	struct request_package request;
 	request.u.send.id = id;
@@ -1964,6 +2330,27 @@ socket_server_send_lowpriority(struct socket_server *ss, struct socket_sendbuffe
 	return 0;
 }
 
+// return -1 when error, 0 when success. The fd is owned (and closed) by socket server after calling it.
+int
+socket_server_sendfile(struct socket_server *ss, int id, int fd, int64_t offset, size_t sz) {
+	struct socket * s = &ss->slot[HASH_ID(ss, id)];
+	if (socket_invalid(s, id) || s->closing || s->protocol != PROTOCOL_TCP) {
+		close(fd);
+		return -1;
+	}
+
+	inc_sending_ref(ss, s, id);
+
+	struct request_package request;
+	request.u.sendfile.id = id;
+	request.u.sendfile.fd = fd;
+	request.u.sendfile.offset = offset;
+	request.u.sendfile.sz = sz;
+
+	send_request(ss, &request, 'F', sizeof(request.u.sendfile));
+	return 0;
+}
+
 void
 socket_server_exit(struct socket_server *ss) {
 	struct request_package request;
@@ -1992,7 +2379,7 @@ socket_server_shutdown(struct socket_server *ss, uintptr_t opaque, int id) {
 // return -1 means failed
 // or return AF_INET or AF_INET6
 static int
-do_bind(const char *host, int port, int protocol, int *family) {
+do_bind(const char *host, int port, int protocol, int *family, bool reuseport) {
 	int fd;
 	int status;
 	int reuse = 1;
@@ -2025,6 +2412,16 @@ do_bind(const char *host, int port, int protocol, int *family) {
 	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (void *)&reuse, sizeof(int))==-1) {
 		goto _failed;
 	}
+	if (reuseport) {
+#ifdef SO_REUSEPORT
+		// each listener bound with SO_REUSEPORT gets a share of incoming connections
+		if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, (void *)&reuse, sizeof(int))==-1) {
+			goto _failed;
+		}
+#else
+		goto _failed;
+#endif
+	}
 	status = bind(fd, (struct sockaddr *)ai_list->ai_addr, ai_list->ai_addrlen);
 	if (status != 0)
 		goto _failed;
@@ -2039,9 +2436,9 @@ _failed_fd:
 }
 
 static int
-do_listen(const char * host, int port, int backlog) {
+do_listen(const char * host, int port, int backlog, bool reuseport) {
 	int family = 0;
-	int listen_fd = do_bind(host, port, IPPROTO_TCP, &family);
+	int listen_fd = do_bind(host, port, IPPROTO_TCP, &family, reuseport);
 	if (listen_fd < 0) {
 		return -1;
 	}
@@ -2049,12 +2446,14 @@ do_listen(const char * host, int port, int backlog) {
 		close(listen_fd);
 		return -1;
 	}
+	// report_accept accepts until EAGAIN
+	sp_nonblocking(listen_fd);
 	return listen_fd;
 }
 
-int 
-socket_server_listen(struct socket_server *ss, uintptr_t opaque, const char * addr, int port, int backlog) {
-	int fd = do_listen(addr, port, backlog);
+static int
+listen_request(struct socket_server *ss, uintptr_t opaque, const char * addr, int port, int backlog, bool reuseport) {
+	int fd = do_listen(addr, port, backlog, reuseport);
 	if (fd < 0) {
 		return -1;
 	}
@@ -2071,6 +2470,16 @@ socket_server_listen(struct socket_server *ss, uintptr_t opaque, const char * ad
 	return id;
 }
 
+int 
+socket_server_listen(struct socket_server *ss, uintptr_t opaque, const char * addr, int port, int backlog) {
+	return listen_request(ss, opaque, addr, port, backlog, false);
+}
+
+int
+socket_server_listen_reuseport(struct socket_server *ss, uintptr_t opaque, const char * addr, int port, int backlog) {
+	return listen_request(ss, opaque, addr, port, backlog, true);
+}
+
 int
 socket_server_bind(struct socket_server *ss, uintptr_t opaque, int fd) {
 	struct request_package request;
@@ -2122,7 +2531,7 @@ socket_server_udp(struct socket_server *ss, uintptr_t opaque, const char * addr,
 	int family;
 	if (port != 0 || addr != NULL) {
 		// bind
-		fd = do_bind(addr, port, IPPROTO_UDP, &family);
+		fd = do_bind(addr, port, IPPROTO_UDP, &family, false);
 		if (fd < 0) {
 			return -1;
 		}
@@ -2159,7 +2568,7 @@ socket_server_udp_listen(struct socket_server *ss, uintptr_t opaque, const char*
 
 	int family;
 	// bind
-	fd = do_bind(addr, port, IPPROTO_UDP, &family);
+	fd = do_bind(addr, port, IPPROTO_UDP, &family, false);
 	if (fd < 0) {
 		return -1;
 	}
@@ -2239,7 +2648,7 @@ socket_server_udp_dial(struct socket_server *ss, uintptr_t opaque, const char* a
 int 
 socket_server_udp_send(struct socket_server *ss, const struct socket_udp_address *addr, struct socket_sendbuffer *buf) {
 	int id = buf->id;
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = &ss->slot[HASH_ID(ss, id)];
 	if (socket_invalid(s, id)) {
 		free_buffer(ss, buf);
 		return -1;
@@ -2300,7 +2709,7 @@ socket_server_udp_send(struct socket_server *ss, const struct socket_udp_address
 
 int
 socket_server_udp_connect(struct socket_server *ss, int id, const char * addr, int port) {
-	struct socket * s = &ss->slot[HASH_ID(id)];
+	struct socket * s = &ss->slot[HASH_ID(ss, id)];
 	if (socket_invalid(s, id)) {
 		return -1;
 	}
@@ -2437,7 +2846,7 @@ struct socket_info *
 socket_server_info(struct socket_server *ss) {
 	int i;
 	struct socket_info * si = NULL;
-	for (i=0;i<MAX_SOCKET;i++) {
+	for (i=0;i<ss->slot_size;i++) {
 		struct socket * s = &ss->slot[i];
 		int id = s->id;
 		struct socket_info temp;
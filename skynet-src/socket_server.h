@@ -27,7 +27,8 @@ struct socket_message {
 	char * data;
 };
 
-struct socket_server * socket_server_create(uint64_t time);
+// max_socket is rounded up to 2^n, use default size (65536) when max_socket <= 0
+struct socket_server * socket_server_create(uint64_t time, int max_socket);
 void socket_server_release(struct socket_server *);
 void socket_server_updatetime(struct socket_server *, uint64_t time);
 int socket_server_poll(struct socket_server *, struct socket_message *result, int *more);
@@ -41,9 +42,13 @@ void socket_server_pause(struct socket_server *, uintptr_t opaque, int id);
 // return -1 when error
 int socket_server_send(struct socket_server *, struct socket_sendbuffer *buffer);
 int socket_server_send_lowpriority(struct socket_server *, struct socket_sendbuffer *buffer);
+// send sz bytes of file fd from offset (tcp only), socket server takes the ownership of fd (close it after sending)
+int socket_server_sendfile(struct socket_server *, int id, int fd, int64_t offset, size_t sz);
 
 // ctrl command below returns id
 int socket_server_listen(struct socket_server *, uintptr_t opaque, const char * addr, int port, int backlog);
+// listen with SO_REUSEPORT, many listeners (in different services) can share one port
+int socket_server_listen_reuseport(struct socket_server *, uintptr_t opaque, const char * addr, int port, int backlog);
 int socket_server_connect(struct socket_server *, uintptr_t opaque, const char * addr, int port);
 int socket_server_bind(struct socket_server *, uintptr_t opaque, int fd);
 
@@ -0,0 +1,123 @@
+local skynet = require "skynet"
+require "skynet.manager"	-- import skynet.forward_type, skynet.register
+
+-- skynet.broadcast : one copy of message shared by the receivers, compare with skynet.send to each of them
+
+local mode, target = ...
+
+if mode == "sub" then
+
+local count = 0
+local bytes = 0
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_,_, cmd, data)
+		if cmd == "data" then
+			count = count + 1
+			bytes = bytes + #data
+		elseif cmd == "count" then
+			skynet.ret(skynet.pack(count, bytes))
+		end
+	end)
+end)
+
+elseif mode == "forward" then
+
+-- the messages are kept in forward mode, it gets a copy of broadcast message
+skynet.register_protocol {
+	name = "system",
+	id = skynet.PTYPE_SYSTEM,
+	unpack = function (...) return ... end,
+}
+
+local forward_map = {
+	[skynet.PTYPE_LUA] = skynet.PTYPE_SYSTEM,
+	[skynet.PTYPE_RESPONSE] = skynet.PTYPE_RESPONSE,	-- don't free response message
+}
+
+skynet.forward_type(forward_map, function()
+	target = tonumber(target)
+	skynet.dispatch("system", function(session, source, msg, sz)
+		-- the receiver frees the message
+		skynet.redirect(target, source, "lua", session, msg, sz)
+	end)
+end)
+
+else
+
+local function counts(subs)
+	local n, bytes = 0, 0
+	for _, s in ipairs(subs) do
+		local c, b = skynet.call(s, "lua", "count")
+		n = n + c
+		bytes = bytes + b
+	end
+	return n, bytes
+end
+
+local function test()
+	local subs = {}
+	for i = 1, 3 do
+		subs[i] = skynet.newservice(SERVICE_NAME, "sub")
+	end
+	skynet.name(".broadcast_sub", subs[3])
+	local forward = skynet.newservice(SERVICE_NAME, "forward", subs[1])
+	local dead = skynet.newservice(SERVICE_NAME, "sub")
+	skynet.kill(dead)
+	local data = string.rep("x", 100)
+	local n = skynet.broadcast({ subs[1], subs[2], ".broadcast_sub", dead, forward }, "lua", "data", data)
+	assert(n == 4, n)
+	assert(skynet.broadcast({}, "lua", "data", data) == 0)
+	assert(skynet.broadcast({ subs[2], subs[3] }, "lua", "data", "") == 2)
+	-- a bad address raises an error before sending, the packed message is freed
+	assert(not pcall(skynet.broadcast, { subs[1], true }, "lua", "data", data))
+	assert(not pcall(skynet.broadcast, nil, "lua", "data", data))
+	-- wait for the message from forward
+	skynet.sleep(10)
+	assert(skynet.call(subs[1], "lua", "count") == 2)
+	assert(skynet.call(subs[2], "lua", "count") == 2)
+	local n, bytes = counts(subs)
+	assert(n == 6 and bytes == 400, bytes)
+	for _, s in ipairs(subs) do
+		skynet.kill(s)
+	end
+	skynet.kill(forward)
+	print("broadcast ok")
+end
+
+local function bench(subs, size, n)
+	local data = string.rep("x", size)
+	local base = counts(subs)
+	local start = skynet.hpc()
+	for i = 1, n do
+		for _, s in ipairs(subs) do
+			skynet.send(s, "lua", "data", data)
+		end
+	end
+	local t1 = (skynet.hpc() - start) / 1e6
+	assert(counts(subs) == base + n * #subs)
+	local t2 = (skynet.hpc() - start) / 1e6
+	start = skynet.hpc()
+	for i = 1, n do
+		assert(skynet.broadcast(subs, "lua", "data", data) == #subs)
+	end
+	local t3 = (skynet.hpc() - start) / 1e6
+	assert(counts(subs) == base + 2 * n * #subs)
+	local t4 = (skynet.hpc() - start) / 1e6
+	print(string.format("%5d bytes to %d services x %d : send %8.3f ms (%8.3f ms until all get it), broadcast %8.3f ms (%8.3f ms)",
+		size, #subs, n, t1, t2, t3, t4))
+end
+
+skynet.start(function()
+	test()
+	local subs = {}
+	for i = 1, 1000 do
+		subs[i] = skynet.newservice(SERVICE_NAME, "sub")
+	end
+	bench(subs, 16, 20)
+	bench(subs, 1024, 20)
+	bench(subs, 65536, 20)
+	skynet.exit()
+end)
+
+end
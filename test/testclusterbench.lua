@@ -0,0 +1,218 @@
+local skynet = require "skynet"
+local cluster = require "skynet.cluster"
+local core = require "skynet.cluster.core"
+
+-- cluster throughput on loopback : calls and pushes from many services, with 1 or more connections (__connections),
+-- and the large messages (multi part, or one package with "ext" header) read by the decoders of cluster.core
+
+local mode, node, n, window = ...
+
+if mode == "server" then
+
+local count = 0
+
+skynet.start(function()
+	skynet.dispatch("lua", function(session, _, cmd, ...)
+		if cmd == "push" then
+			count = count + 1
+		elseif cmd == "count" then
+			skynet.ret(skynet.pack(count))
+		else
+			skynet.ret(skynet.pack(...))
+		end
+	end)
+end)
+
+elseif mode == "client" then
+
+n = tonumber(n)
+window = tonumber(window)
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_,_, cmd)
+		if cmd == "call" then
+			-- window coroutines call concurrently
+			local co = coroutine.running()
+			local done = 0
+			for i = 1, window do
+				skynet.fork(function()
+					for j = 1, n // window do
+						assert(cluster.call(node, "@server", "echo", j) == j)
+					end
+					done = done + 1
+					if done == window then
+						skynet.wakeup(co)
+					end
+				end)
+			end
+			skynet.wait(co)
+		else
+			if cmd == "batch" then
+				cluster.batch(node)
+			end
+			for i = 1, n do
+				cluster.send(node, "@server", "push", i)
+			end
+			-- the pushes are before the call in the same connection
+			cluster.call(node, "@server", "count")
+			cluster.batch(node, false)
+		end
+		skynet.ret()
+	end)
+end)
+
+else
+
+local function bench(node, clients, n, window)
+	local c = {}
+	for i = 1, clients do
+		c[i] = skynet.newservice(SERVICE_NAME, "client", node, n, window)
+	end
+	local function run(cmd)
+		local co = coroutine.running()
+		local done = 0
+		local start = skynet.hpc()
+		for i = 1, clients do
+			skynet.fork(function()
+				skynet.call(c[i], "lua", cmd)
+				done = done + 1
+				if done == clients then
+					skynet.wakeup(co)
+				end
+			end)
+		end
+		skynet.wait(co)
+		return (skynet.hpc() - start) / 1e9
+	end
+	local t1 = run "call"
+	local t2 = run "push"
+	local t3 = run "batch"
+	local total = clients * n
+	print(string.format("%-12s %2d clients x %d : %7.0f calls/sec, %7.0f pushes/sec, %7.0f pushes/sec in batch",
+		node, clients, window, total / t1, total / t2, total / t3))
+	for i = 1, clients do
+		skynet.send(c[i], "debug", "EXIT")
+	end
+end
+
+-- feed the decoders with the packages in random pieces
+local function test_decoder()
+	local big = string.rep("0123456789abcdef", 0x4000) .. "end"
+	local response = core.responsedecoder()
+	local stream = { core.packresponse(1, false, "error") }
+	for _, v in ipairs(core.packresponse(2, true, big)) do
+		table.insert(stream, v)
+	end
+	table.insert(stream, core.packresponse(3, true, "small"))
+	-- the large response in one package, for the peer knows "ext" header
+	table.insert(stream, core.packresponse(4, true, big, nil, true))
+	table.insert(stream, core.packresponse(5, true, "small", nil, true))
+	stream = table.concat(stream)
+	local results = {}
+	local i = 1
+	while i <= #stream do
+		local n = math.random(1, 0x3000)
+		local session, ok, data = response(stream:sub(i, i + n - 1))
+		while session do
+			table.insert(results, { session, ok, data })
+			session, ok, data = response()
+		end
+		i = i + n
+	end
+	assert(#results == 5)
+	assert(results[4][1] == 4 and results[4][3] == big)
+	assert(results[5][1] == 5 and results[5][3] == "small")
+	assert(results[1][1] == 1 and results[1][2] == false and results[1][3] == "error")
+	assert(results[2][1] == 2 and results[2][2] == true and results[2][3] == big)
+	assert(results[3][1] == 3 and results[3][3] == "small")
+
+	-- the requests come from gate without the size header
+	local decoder = core.requestdecoder()
+	local function request(pack)
+		return decoder(pack:sub(3))
+	end
+	assert(request(core.packtrace "tag") == nil)
+	local msg, sz = skynet.pack(big)
+	local req, _, padding = core.packrequest("@server", 10, msg, sz)
+	assert(request(req) == nil)
+	for i = 1, #padding - 1 do
+		assert(request(padding[i]) == nil)
+	end
+	local addr, session, msg, sz, is_push, tag = request(padding[#padding])
+	assert(addr == "@server" and session == 10 and is_push == false and tag == "tag")
+	assert(skynet.unpack(msg, sz) == big)
+	skynet.trash(msg, sz)
+	-- the trace tag is for one request only
+	local msg, sz = skynet.pack "hello"
+	local addr, session, msg, sz, is_push, tag = request(core.packpush(1, 11, msg, sz))
+	assert(addr == 1 and session == 0 and is_push == true and tag == nil)
+	skynet.trash(msg, sz)
+	-- one package with "ext" header (6 bytes)
+	local msg, sz = skynet.pack(big)
+	local req, _, padding = core.packrequest("@server", 13, msg, sz, true)
+	assert(padding == nil and req:byte(1) == 0 and req:byte(2) == 0)
+	local addr, session, msg, sz, is_push = decoder(req:sub(7))
+	assert(addr == "@server" and session == 13 and not is_push)
+	assert(skynet.unpack(msg, sz) == big)
+	skynet.trash(msg, sz)
+	-- batch of pushes
+	local function packpush(addr, v)
+		local msg, sz = skynet.pack(v)
+		return (core.packpush(addr, 1, msg, sz, true))
+	end
+	local pushes = packpush(1, "a") .. packpush("@server", big)
+	local ok, t = decoder(core.packbatch(pushes):sub(7))
+	assert(ok == true and #t == 6 and t[1] == 1 and t[4] == "@server")
+	assert(skynet.unpack(t[2], t[3]) == "a" and skynet.unpack(t[5], t[6]) == big)
+	skynet.trash(t[2], t[3])
+	skynet.trash(t[5], t[6])
+	assert(not pcall(core.unpackbatch, pushes:sub(1, -2)))
+	-- a part lost
+	local msg, sz = skynet.pack(big)
+	local req, _, padding = core.packrequest(1, 12, msg, sz)
+	request(req)
+	local addr, session, msg = request(padding[#padding])
+	assert(addr == 1 and session == 12 and msg == nil)
+	-- the size in multi begin is out of range
+	for _, size in ipairs { 0xffffffff, 100 } do
+		assert(request(string.pack("<I2BI4I4I4", 0, 1, 1, 14, size)) == nil)
+		local addr, session, msg = request(string.pack("<I2BI4", 0, 3, 14) .. "small")
+		assert(addr == 1 and session == 14 and msg == nil)
+	end
+	local response = core.responsedecoder()
+	local session, ok = response(string.pack(">I2<I4BI4", 9, 15, 2, 0xffffffff) .. string.pack(">I2<I4B", 10, 15, 4) .. "small")
+	assert(session == 15 and ok == false)
+	print("cluster decoder ok")
+end
+
+local function bench_large(node, size, n)
+	local str = string.rep("x", size)
+	local start = skynet.hpc()
+	for i = 1, n do
+		local r = cluster.call(node, "@server", "large", str)
+		assert(#r == size)
+	end
+	local ti = (skynet.hpc() - start) / 1e9
+	print(string.format("%-12s %8d bytes : %7.0f calls/sec, %7.1f MB/s", node, size, n / ti, n * size * 2 / ti / (1024 * 1024)))
+end
+
+skynet.start(function()
+	test_decoder()
+	local server = skynet.newservice(SERVICE_NAME, "server")
+	cluster.register("server", server)
+	local _, port = cluster.open(0)
+	local address = "127.0.0.1:" .. port
+	for _, conns in ipairs { 1, 4 } do
+		local node = "conns" .. conns
+		cluster.reload { __connections = conns, [node] = address }
+		bench(node, 1, 20000, 16)
+		bench(node, 8, 5000, 16)
+	end
+	local total = skynet.call(server, "lua", "count")
+	assert(total == 2 * 2 * (20000 + 8 * 5000), total)
+	bench_large("conns1", 0x10000, 1000)
+	bench_large("conns1", 0x100000, 100)
+	skynet.exit()
+end)
+
+end
@@ -0,0 +1,88 @@
+local skynet = require "skynet"
+local cluster = require "skynet.cluster"
+
+-- A cluster link between this version and an older one (built from an older tree), in both directions.
+-- The script uses the apis of the older version only, run the server in one node and the client in the other :
+--	start = "testclustercompat server 2528"
+--	start = "testclustercompat client 2528"
+
+local mode, port = ...
+
+if mode == "echo" then
+
+local count = 0
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_,_, cmd, v)
+		if cmd == "push" then
+			count = count + 1
+		elseif cmd == "count" then
+			skynet.ret(skynet.pack(count))
+		else
+			skynet.ret(skynet.pack(v))
+		end
+	end)
+end)
+
+elseif mode == "server" then
+
+skynet.start(function()
+	cluster.register("compat", skynet.newservice(SERVICE_NAME, "echo"))
+	cluster.open(tonumber(port))
+	print("cluster compat server", port)
+end)
+
+else
+
+local function timeout(ti, f, ...)
+	local co = coroutine.running()
+	local ret
+	skynet.fork(function(...)
+		ret = table.pack(pcall(f, ...))
+		skynet.wakeup(co)
+	end, ...)
+	skynet.sleep(ti, co)
+	assert(ret, "timeout")
+	assert(ret[1], ret[2])
+	return table.unpack(ret, 2, ret.n)
+end
+
+skynet.start(function()
+	local node = "compat"
+	local new_version = cluster.batch ~= nil
+	-- set the options of this version, the older one ignores them
+	cluster.reload {
+		__compress = 1024,
+		__heartbeat = 20,
+		[node] = "127.0.0.1:" .. port,
+	}
+	-- the link hangs if the peer can't read the hello
+	assert(timeout(500, cluster.call, node, "@compat", "echo", "hello") == "hello")
+	-- large and compressible
+	local big = string.rep("0123456789", 20000)
+	assert(cluster.call(node, "@compat", "echo", big) == big)
+	local addr = cluster.query(node, "compat")
+	assert(cluster.call(node, addr, "echo", 1) == 1)
+	assert(not pcall(cluster.query, node, "nothing"))
+	local n = cluster.call(node, "@compat", "count")
+	for i = 1, 100 do
+		cluster.send(node, "@compat", "push", i)
+	end
+	if new_version then
+		cluster.batch(node)
+		for i = 1, 100 do
+			cluster.send(node, "@compat", "push", i)
+		end
+		cluster.batch(node, false)
+		n = n + 100
+	end
+	assert(cluster.call(node, "@compat", "count") == n + 100)
+	if new_version then
+		-- the peer (maybe the older version) answers the heartbeat
+		skynet.sleep(100)
+		assert(timeout(500, skynet.call, cluster.get_sender(node), "lua", "heartbeat", 100))
+	end
+	print("cluster compat ok")
+end)
+
+end
@@ -0,0 +1,197 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+local cluster = require "skynet.cluster"
+
+-- cluster heartbeat (__heartbeat) and failover to the standby connection (__backup).
+-- The node and its backup are two relays to the cluster port of this process, a relay can hang or die.
+
+local mode, port = ...
+
+if mode == "relay" then
+
+local listen_fd
+local conns = {}
+local hang = false
+local pause = false
+local accepts = 0
+
+local function pump(from, to)
+	while true do
+		local data = socket.read(from)
+		if not data then
+			break
+		end
+		while pause do
+			skynet.sleep(1)
+		end
+		if not hang then
+			socket.write(to, data)
+		end
+	end
+	-- the other pump closes the other side
+	conns[from] = nil
+	socket.close(from)
+	socket.shutdown(to)
+end
+
+local command = {}
+
+function command.open()
+	local fd, _, p = socket.listen("127.0.0.1", 0)
+	listen_fd = fd
+	socket.start(fd, function(fd)
+		accepts = accepts + 1
+		local upstream = socket.open("127.0.0.1", tonumber(port))
+		socket.start(fd)
+		conns[fd] = true
+		conns[upstream] = true
+		skynet.fork(pump, fd, upstream)
+		skynet.fork(pump, upstream, fd)
+	end)
+	return p
+end
+
+-- the connections are alive, but no data goes through
+function command.hang(v)
+	hang = v
+end
+
+-- the data is delayed for ti (1/100 s), returns the connections accepted
+function command.pause(ti)
+	pause = true
+	skynet.timeout(ti, function()
+		pause = false
+	end)
+	return accepts
+end
+
+function command.kill()
+	socket.close(listen_fd)
+	for fd in pairs(conns) do
+		socket.shutdown(fd)
+	end
+end
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_,_, cmd, ...)
+		skynet.retpack(command[cmd](...))
+	end)
+end)
+
+elseif mode == "server" then
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_,_, v)
+		skynet.retpack(v)
+	end)
+end)
+
+else
+
+-- call the node until succeed, returns the seconds it takes
+local function recover_node(node, n)
+	local start = skynet.hpc()
+	local fails = 0
+	while true do
+		local ok, r = pcall(cluster.call, node, "@server", n)
+		if ok then
+			assert(r == n)
+			break
+		end
+		fails = fails + 1
+		skynet.sleep(1)
+	end
+	return (skynet.hpc() - start) / 1e9, fails
+end
+
+local function recover(n)
+	return recover_node("db", n)
+end
+
+skynet.start(function()
+	local server = skynet.newservice(SERVICE_NAME, "server")
+	cluster.register("server", server)
+	local _, port = cluster.open(0)
+	local primary = skynet.newservice(SERVICE_NAME, "relay", port)
+	local backup = skynet.newservice(SERVICE_NAME, "relay", port)
+	local solo = skynet.newservice(SERVICE_NAME, "relay", port)
+	local mute = skynet.newservice(SERVICE_NAME, "relay", port)
+	local primary_port = skynet.call(primary, "lua", "open")
+	local backup_port = skynet.call(backup, "lua", "open")
+	local solo_port = skynet.call(solo, "lua", "open")
+	local mute_port = skynet.call(mute, "lua", "open")
+	cluster.reload {
+		__heartbeat = 20,
+		__backup = { db = "127.0.0.1:" .. backup_port },
+		db = "127.0.0.1:" .. primary_port,
+		solo = "127.0.0.1:" .. solo_port,	-- without backup
+		mute = "127.0.0.1:" .. mute_port,	-- never replies
+	}
+	assert(cluster.call("db", "@server", 1) == 1)
+	-- the standby connection is ready
+	skynet.sleep(50)
+
+	-- a slow reply (in 1.5 heartbeats) doesn't switch to the backup
+	local accepts = skynet.call(primary, "lua", "pause", 30)
+	assert(cluster.call("db", "@server", 1) == 1)
+	skynet.sleep(100)
+	assert(skynet.call(primary, "lua", "pause", 0) == accepts, "switch to the backup")
+
+	-- the primary hangs, the calls go to the backup after the heartbeat times out
+	skynet.call(primary, "lua", "hang", true)
+	local ti, fails = recover(2)
+	print(string.format("primary hangs : recovered in %.3f sec, %d failed calls", ti, fails))
+	-- 3 heartbeats without reply
+	assert(ti < 2)
+	for i = 1, 100 do
+		assert(cluster.call("db", "@server", i) == i)
+	end
+
+	-- the primary is back (as the standby now), and the backup dies
+	skynet.call(primary, "lua", "hang", false)
+	skynet.sleep(50)
+	skynet.call(backup, "lua", "kill")
+	local ti, fails = recover(3)
+	print(string.format("backup dies : recovered in %.3f sec, %d failed calls", ti, fails))
+	assert(ti < 1)
+	for i = 1, 100 do
+		assert(cluster.call("db", "@server", i) == i)
+	end
+
+	-- the node without backup hangs, the call in flight fails after the heartbeat times out, and the node is
+	-- connected again when it's back
+	assert(cluster.call("solo", "@server", 4) == 4)
+	skynet.call(solo, "lua", "hang", true)
+	local start = skynet.hpc()
+	assert(not pcall(cluster.call, "solo", "@server", 4))
+	local ti = (skynet.hpc() - start) / 1e9
+	print(string.format("node hangs : the call failed in %.3f sec", ti))
+	assert(ti < 2)
+	skynet.call(solo, "lua", "hang", false)
+	local ti, fails = recover_node("solo", 4)
+	print(string.format("node is back : recovered in %.3f sec, %d failed calls", ti, fails))
+	assert(ti < 2)
+
+	-- the node without backup dies, the calls fail at once (the sender doesn't reconnect while waiting)
+	assert(cluster.call("solo", "@server", 4) == 4)
+	skynet.call(solo, "lua", "kill")
+	local start = skynet.hpc()
+	for i = 1, 3 do
+		assert(not pcall(cluster.call, "solo", "@server", i))
+	end
+	local ti = (skynet.hpc() - start) / 1e9
+	print(string.format("node dies : 3 calls failed in %.3f sec", ti))
+	assert(ti < 1)
+
+	-- the node accepts the connection, but doesn't reply the hello
+	skynet.call(mute, "lua", "hang", true)
+	local start = skynet.hpc()
+	assert(not pcall(cluster.call, "mute", "@server", 5))
+	local ti = (skynet.hpc() - start) / 1e9
+	print(string.format("node mute : the call failed in %.3f sec", ti))
+	assert(ti < 10)
+	print("cluster failover ok")
+	skynet.exit()
+end)
+
+end
@@ -0,0 +1,177 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+local cluster = require "skynet.cluster"
+
+-- skynet.compress : the ratio and cpu cost of messages, and the bytes on the wire of cluster (__compress)
+
+local mode = ...
+
+if mode == "echo" then
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_,_, ...)
+		skynet.retpack(...)
+	end)
+end)
+
+else
+
+local function player(id, items)
+	local bag = {}
+	for i = 1, items do
+		bag[i] = { id = 10000 + i, count = i % 99 + 1, bind = i % 3 == 0, attr = { 1.5 * i, i * 7, -i } }
+	end
+	return {
+		id = id,
+		name = "player" .. id,
+		level = 60,
+		pos = { x = 1024.5, y = 768.25, z = 0, map = "main_city" },
+		bag = bag,
+		quest = { done = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 }, desc = string.rep("q", 100) },
+	}
+end
+
+local function scene(players, items)
+	local t = {}
+	for i = 1, players do
+		t[i] = player(i, items)
+	end
+	return t
+end
+
+local function random_string(n)
+	local t = {}
+	for i = 1, n do
+		t[i] = string.char(math.random(0, 255))
+	end
+	return table.concat(t)
+end
+
+local function equal(a, b)
+	if type(a) ~= "table" or type(b) ~= "table" then
+		return a == b
+	end
+	for k, v in pairs(a) do
+		if not equal(v, b[k]) then
+			return false
+		end
+	end
+	for k in pairs(b) do
+		if a[k] == nil then
+			return false
+		end
+	end
+	return true
+end
+
+local function test_compress()
+	local obj = scene(10, 20)
+	local msg, sz = skynet.pack(obj, "tail")
+	local cmsg, csz = skynet.compress(msg, sz)
+	assert(cmsg and csz < sz)
+	local r, tail = skynet.unpack(cmsg, csz)
+	assert(equal(r, obj) and tail == "tail")
+	-- string version
+	local str = skynet.tostring(msg, sz)
+	local cstr = skynet.compress(str)
+	assert(#cstr == csz and equal(skynet.unpack(cstr), obj))
+	-- compressed twice
+	assert(skynet.compress(cstr, 0) == nil)
+	skynet.trash(cmsg, csz)
+	-- below the threshold
+	assert(skynet.compress(msg, sz, sz + 1) == nil)
+	skynet.trash(msg, sz)
+	-- incompressible
+	assert(skynet.compress(skynet.packstring(random_string(8192))) == nil)
+	-- bad streams
+	assert(not pcall(skynet.unpack, cstr:sub(1, -2)))
+	assert(not pcall(skynet.unpack, cstr:sub(1, 1) .. string.char(255, 255, 255, 127) .. cstr:sub(6)))
+	-- a compressed message in a compressed message (LZ4 block of literals only)
+	local n = #cstr - 15
+	local nested = string.char(cstr:byte(1)) .. string.pack("<I4", #cstr) .. "\xf0" ..
+		string.rep("\xff", n // 255) .. string.char(n % 255) .. cstr
+	assert(select(2, pcall(skynet.unpack, nested)):find "twice")
+	print("compress ok")
+end
+
+local function bench(name, obj, n)
+	local str = skynet.packstring(obj)
+	local cstr = skynet.compress(str, 0) or str
+	local start = skynet.hpc()
+	for i = 1, n do
+		skynet.compress(str, 0)
+	end
+	local t1 = (skynet.hpc() - start) / 1e9
+	start = skynet.hpc()
+	for i = 1, n do
+		skynet.unpack(cstr)
+	end
+	local t2 = (skynet.hpc() - start) / 1e9
+	start = skynet.hpc()
+	for i = 1, n do
+		skynet.unpack(str)
+	end
+	local t3 = (skynet.hpc() - start) / 1e9
+	local mb = n * #str / (1024 * 1024)
+	print(string.format("%-20s %8d -> %8d bytes (%5.1f%%) : compress %7.1f MB/s, unpack %7.1f MB/s (%7.1f MB/s uncompressed)",
+		name, #str, #cstr, #cstr * 100 / #str, mb / t1, mb / t2, mb / t3))
+end
+
+local function wire_bytes()
+	local n = 0
+	for _, s in ipairs(socket.netstat()) do
+		if s.type == "TCP" then
+			n = n + s.write
+		end
+	end
+	return n
+end
+
+local function bench_cluster(node, obj, n)
+	local w = wire_bytes()
+	local start = skynet.hpc()
+	for i = 1, n do
+		local r = cluster.call(node, "@echo", obj)
+		assert(#r == #obj)
+	end
+	local ti = (skynet.hpc() - start) / 1e9
+	w = wire_bytes() - w
+	print(string.format("cluster %-12s %5d calls : %10d bytes on the wire, %6.0f calls/sec", node, n, w, n / ti))
+	return w
+end
+
+-- the pushes in batch (cluster.batch) are compressed one by one
+local function bench_batch(node, obj, n)
+	local w = wire_bytes()
+	cluster.batch(node)
+	for i = 1, n do
+		cluster.send(node, "@echo", obj)
+	end
+	cluster.batch(node, false)
+	assert(cluster.call(node, "@echo", 1) == 1)
+	w = wire_bytes() - w
+	print(string.format("cluster %-12s %5d pushes in batch : %10d bytes on the wire", node, n, w))
+	return w
+end
+
+skynet.start(function()
+	test_compress()
+	bench("player (20 items)", player(1, 20), 10000)
+	bench("scene (50 players)", scene(50, 20), 200)
+	bench("random 64KB", random_string(65536), 2000)
+
+	local echo = skynet.newservice(SERVICE_NAME, "echo")
+	cluster.register("echo", echo)
+	local _, port = cluster.open(0)
+	local address = "127.0.0.1:" .. port
+	local obj = scene(10, 20)
+	cluster.reload { plain = address }
+	local plain = bench_cluster("plain", obj, 200)
+	cluster.reload { __compress = 1024, compressed = address }
+	local compressed = bench_cluster("compressed", obj, 200)
+	assert(compressed < plain)
+	assert(bench_batch("compressed", obj, 200) < bench_batch("plain", obj, 200))
+	skynet.exit()
+end)
+
+end
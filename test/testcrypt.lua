@@ -31,4 +31,50 @@ assert(desencode(key, "123456","pkcs7")=="ED5wLgc3Mnw=")
 assert(desencode(key, "1234567","pkcs7")=="mYo+BYIT41M=")
 assert(desencode(key, "12345678","pkcs7")=="ltACiHjVjIn+uVm31GQvyw==")
 
+-- the simd kernels should give the same results as the scalar code
+local function random_text(sz)
+	local tmp = {}
+	for i = 1, sz do
+		tmp[i] = string.char(math.random(0, 255))
+	end
+	return table.concat(tmp)
+end
+
+-- the functions of each level, and the module functions (the best level)
+local best = crypt.simd()
+local levels = { best = crypt }
+for _, level in ipairs { "none", "sse2", "avx2" } do
+	local l, funcs = crypt.simd(level)
+	assert(l == level or l == best)
+	levels[level] = funcs
+end
+assert(crypt.simd() == best)
+for _, sz in ipairs { 0, 1, 2, 3, 15, 16, 17, 31, 32, 33, 47, 48, 63, 64, 65, 100, 1000, 4099 } do
+	local text = random_text(sz)
+	local key = random_text(sz % 37 + 1)
+	local result
+	for level, c in pairs(levels) do
+		local r = {
+			c.hexencode(text),
+			c.base64encode(text),
+			c.xor_str(text, key),
+		}
+		assert(c.hexdecode(r[1]) == text)
+		assert(c.base64decode(r[2]) == text)
+		assert(c.xor_str(r[3], key) == text)
+		-- base64 text with line breaks
+		assert(c.base64decode(r[2]:gsub("(" .. string.rep(".", 76) .. ")", "%1\r\n")) == text)
+		if result then
+			for i = 1, #r do
+				assert(r[i] == result[i], level)
+			end
+		end
+		result = r
+	end
+end
+for _, c in pairs(levels) do
+	assert(not pcall(c.hexdecode, string.rep("0", 40) .. "g0" .. string.rep("0", 40)))
+	assert(not pcall(c.base64decode, string.rep("A", 60) .. "=" .. string.rep("A", 60)))
+end
+
 skynet.start(skynet.exit)
\ No newline at end of file
@@ -0,0 +1,50 @@
+local skynet = require "skynet"
+local crypt = require "skynet.crypt"
+
+-- MB/s of hexencode/hexdecode, base64encode/base64decode and xor_str with each simd level
+
+local SIZES = { 16, 64, 256, 1024, 4096, 65536, 1024 * 1024 }
+local BYTES = 16 * 1024 * 1024	-- data processed for each test
+
+local function bench(f, a, b)
+	local n = BYTES // #a + 1
+	local start = skynet.hpc()
+	for i = 1, n do
+		f(a, b)
+	end
+	local ti = (skynet.hpc() - start) / 1e9
+	return n * #a / ti / (1024 * 1024)
+end
+
+skynet.start(function()
+	-- the functions of each level
+	local levels = {}
+	local funcs = {}
+	for _, level in ipairs { "none", "sse2", "avx2" } do
+		local l, f = crypt.simd(level)
+		if l == level then
+			table.insert(levels, level)
+			table.insert(funcs, f)
+		end
+	end
+	print(string.format("%-14s %8s %10s", "function", "size", table.concat(levels, "       ")))
+	local key = "12345678"
+	for _, sz in ipairs(SIZES) do
+		local text = string.rep("skynet\\0\\255", sz // 8 + 1):sub(1, sz)
+		local tests = {
+			{ "hexencode", text },
+			{ "hexdecode", crypt.hexencode(text) },
+			{ "base64encode", text },
+			{ "base64decode", crypt.base64encode(text) },
+			{ "xor_str", text, key },
+		}
+		for _, t in ipairs(tests) do
+			local r = {}
+			for _, f in ipairs(funcs) do
+				table.insert(r, string.format("%8.1f", bench(f[t[1]], t[2], t[3])))
+			end
+			print(string.format("%-14s %8d %s MB/s", t[1], sz, table.concat(r, " ")))
+		end
+	end
+	skynet.exit()
+end)
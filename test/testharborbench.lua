@@ -0,0 +1,116 @@
+local skynet = require "skynet"
+local harbor = require "skynet.harbor"
+require "skynet.manager"	-- import skynet.name
+
+-- cross harbor messages/sec between two nodes (master/slave mode), by handle and by global name.
+-- run it in both nodes, harbor 1 (standalone) and harbor 2, for example :
+-- examples/config and examples/config_log with start = "testharborbench"
+
+local NAMES = 1000
+
+local mode, target, n, size = ...
+
+if mode == "server" then
+
+local count = 0
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_,_, cmd, ...)
+		if cmd == "push" then
+			count = count + 1
+		elseif cmd == "count" then
+			skynet.ret(skynet.pack(count))
+		else
+			skynet.ret(skynet.pack(...))
+		end
+	end)
+end)
+
+elseif mode == "client" then
+
+n = tonumber(n)
+size = tonumber(size)
+
+skynet.start(function()
+	local data = string.rep("x", size)
+	local server = tonumber(target)
+	skynet.dispatch("lua", function(_,_, cmd)
+		if cmd == "call" then
+			for i = 1, n do
+				skynet.call(server, "lua", "echo", data)
+			end
+		elseif cmd == "push" then
+			for i = 1, n do
+				skynet.send(server, "lua", "push", data)
+			end
+			-- the pushes are before the call in the same link
+			skynet.call(server, "lua", "count")
+		else
+			-- send by the global names
+			for i = 1, n do
+				skynet.send(target .. (i % NAMES + 1), "lua", "push", data)
+			end
+			skynet.call(target .. "1", "lua", "count")
+		end
+		skynet.ret()
+	end)
+end)
+
+elseif skynet.getenv "harbor" ~= "1" then
+
+skynet.start(function()
+	local server = skynet.newservice(SERVICE_NAME, "server")
+	for i = 1, NAMES do
+		harbor.globalname("hbench" .. i, server)
+	end
+	harbor.globalname("HBENCH", server)
+	print("harbor bench server", skynet.address(server))
+end)
+
+else
+
+local function bench(name, clients, cmd, target, n, size)
+	local c = {}
+	for i = 1, clients do
+		c[i] = skynet.newservice(SERVICE_NAME, "client", target, n, size)
+	end
+	local co = coroutine.running()
+	local done = 0
+	local start = skynet.hpc()
+	for i = 1, clients do
+		skynet.fork(function()
+			skynet.call(c[i], "lua", cmd)
+			done = done + 1
+			if done == clients then
+				skynet.wakeup(co)
+			end
+		end)
+	end
+	skynet.wait(co)
+	local ti = (skynet.hpc() - start) / 1e9
+	print(string.format("%-8s %2d clients %6d bytes : %8.0f messages/sec", name, clients, size, clients * n / ti))
+	for i = 1, clients do
+		skynet.send(c[i], "debug", "EXIT")
+	end
+end
+
+skynet.start(function()
+	print("wait for harbor 2")
+	harbor.connect(2)
+	local server = harbor.queryname "HBENCH"
+	print("harbor 2 connected, server is", skynet.address(server))
+	-- resolve all the names once
+	for i = 1, NAMES do
+		assert(harbor.queryname("hbench" .. i) == server)
+		skynet.call("hbench" .. i, "lua", "echo")
+	end
+	for _, size in ipairs { 16, 1024 } do
+		bench("call", 8, "call", server, 2000, size)
+		bench("push", 1, "push", server, 200000, size)
+		bench("push", 8, "push", server, 50000, size)
+		bench("by name", 8, "name", "hbench", 50000, size)
+	end
+	skynet.exit()
+end)
+
+end
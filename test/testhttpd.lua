@@ -0,0 +1,169 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+local httpd = require "http.httpd"
+local sockethelper = require "http.sockethelper"
+
+-- httpd keep-alive and pipelining, and the throughput of the request parser (lualib-src/lua-httpparser.c)
+
+local mode = ...
+
+if mode == "agent" then
+
+local socketdriver = require "skynet.socketdriver"
+
+skynet.start(function()
+	skynet.dispatch("lua", function (_,_,id)
+		socket.start(id)
+		-- don't wait for the ack of last response when the requests are pipelined
+		socketdriver.nodelay(id)
+		local readbytes = sockethelper.readfunc(id)
+		local writebytes = sockethelper.writefunc(id)
+		local rest = ""
+		repeat
+			local code, url, method, header, body
+			code, url, method, header, body, rest = httpd.read_request(readbytes, 65536, rest)
+			if code then
+				if code == 200 then
+					httpd.write_response(writebytes, 200, string.format("%s %s %s", method, url, body))
+				else
+					httpd.write_response(writebytes, code)
+				end
+			end
+		until not rest
+		socket.close(id)
+		skynet.exit()
+	end)
+end)
+
+else
+
+local internal = require "http.internal"
+local httpparser = require "skynet.httpparser"
+local httpc = require "http.httpc"
+
+local REQUEST = "GET /index.html?a=1&b=2 HTTP/1.1\r\nHost: 127.0.0.1\r\nUser-Agent: skynet\r\nAccept: */*\r\n" ..
+	"Accept-Encoding: gzip, deflate\r\nAccept-Language: en-US,en;q=0.9\r\nCookie: a=1\r\nCookie: b=2\r\n\r\n"
+
+local function read_response(fd)
+	local head = socket.readline(fd, "\r\n\r\n")
+	if not head then
+		return false
+	end
+	local header = {}
+	local code = httpparser.response(head .. "\r\n\r\n", header)
+	assert(code == 200)
+	local length = tonumber(header["content-length"])
+	return length > 0 and socket.read(fd, length) or ""
+end
+
+local function test_parser()
+	local header = {}
+	local method, url, httpver, offset = httpparser.request(REQUEST .. "body", header)
+	assert(method == "GET" and url == "/index.html?a=1&b=2" and httpver == 1.1)
+	assert(REQUEST:sub(offset) == "" and (REQUEST .. "body"):sub(offset) == "body")
+	assert(header.host == "127.0.0.1" and header["user-agent"] == "skynet")
+	assert(header.cookie[1] == "a=1" and header.cookie[2] == "b=2")
+	assert(httpparser.request(REQUEST:sub(1, -2), {}) == nil)
+	assert(httpparser.request("GET /\r\n\r\n", {}) == false)
+	assert(httpparser.request("GET / HTTP/1.1\r\nnocolon\r\n\r\n", {}) == false)
+	local code, info = httpparser.response("HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n", {})
+	assert(code == 404 and info == "Not Found")
+	assert(httpparser.chunksize("1a;ext=1\r\n") == 26)
+	assert(httpparser.chunksize("1a") == nil)
+	assert(httpparser.chunksize("xyz\r\n") == false)
+	assert(httpparser.chunksize(string.rep("1", 200)) == false)
+	print("httpparser ok")
+end
+
+local function test_pipeline(port)
+	local fd = assert(socket.open("127.0.0.1", port))
+	local chunked = "POST /chunked HTTP/1.1\r\nHost: x\r\nTransfer-Encoding: chunked\r\n\r\n" ..
+		"5\r\nhello\r\n6\r\n world\r\n0\r\nX-Trailer: 1\r\n\r\n"
+	local stream = REQUEST ..
+		"POST /post HTTP/1.1\r\nHost: x\r\nContent-Length: 4\r\n\r\nbody" ..
+		chunked ..
+		"GET /last HTTP/1.1\r\nHost: x\r\n\r\n"
+	-- byte by byte for the first requests, then the rest at once
+	for i = 1, 200 do
+		socket.write(fd, stream:sub(i, i))
+	end
+	socket.write(fd, stream:sub(201))
+	assert(read_response(fd) == "GET /index.html?a=1&b=2 ")
+	assert(read_response(fd) == "POST /post body")
+	assert(read_response(fd) == "POST /chunked hello world")
+	assert(read_response(fd) == "GET /last ")
+	-- HTTP/1.0 without keep-alive closes the connection
+	socket.write(fd, "GET /close HTTP/1.0\r\n\r\n")
+	assert(read_response(fd) == "GET /close ")
+	assert(read_response(fd) == false)
+	socket.close(fd)
+
+	local status, body = httpc.get("127.0.0.1:" .. port, "/httpc")
+	assert(status == 200 and body == "GET /httpc ")
+	print("httpd pipeline ok")
+end
+
+local function bench_parser(n)
+	local start = skynet.hpc()
+	for i = 1, n do
+		local tmpline = {}
+		internal.recvheader(nil, tmpline, REQUEST)
+		local method, url, httpver = tmpline[1]:match "^(%a+)%s+(.-)%s+HTTP/([%d%.]+)$"
+		internal.parseheader(tmpline, 2, {})
+	end
+	local t1 = (skynet.hpc() - start) / 1e9
+	start = skynet.hpc()
+	for i = 1, n do
+		httpparser.request(REQUEST, {})
+	end
+	local t2 = (skynet.hpc() - start) / 1e9
+	print(string.format("parse %d requests : lua %.3fs (%.0f/sec), httpparser %.3fs (%.0f/sec)", n, t1, n / t1, t2, n / t2))
+end
+
+local function bench(port, conns, n, window)
+	local done = 0
+	local co = coroutine.running()
+	local start = skynet.hpc()
+	for c = 1, conns do
+		skynet.fork(function()
+			local fd = assert(socket.open("127.0.0.1", port))
+			local batch = string.rep(REQUEST, window)
+			local sent = 0
+			local recv = 0
+			while recv < n do
+				if sent == recv then
+					local k = math.min(window, n - sent)
+					socket.write(fd, k == window and batch or string.rep(REQUEST, k))
+					sent = sent + k
+				end
+				read_response(fd)
+				recv = recv + 1
+			end
+			socket.close(fd)
+			done = done + 1
+			if done == conns then
+				skynet.wakeup(co)
+			end
+		end)
+	end
+	skynet.wait(co)
+	local ti = (skynet.hpc() - start) / 1e9
+	local total = conns * n
+	print(string.format("httpd %d connections, pipeline %d : %d requests in %.3fs, %.0f requests/sec", conns, window, total, ti, total / ti))
+end
+
+skynet.start(function()
+	local lid, _, port = socket.listen("127.0.0.1", 0)
+	socket.start(lid, function(id, addr)
+		local agent = skynet.newservice(SERVICE_NAME, "agent")
+		skynet.send(agent, "lua", id)
+	end)
+	test_parser()
+	test_pipeline(port)
+	bench_parser(100000)
+	bench(port, 4, 5000, 1)
+	bench(port, 4, 5000, 16)
+	socket.close(lid)
+end)
+
+end
@@ -0,0 +1,61 @@
+local skynet = require "skynet"
+local mc = require "skynet.multicast"
+
+-- publish to many subscribers : the time of publish (fan-out in multicastd), and the latency until all subscribers get it
+
+local mode, channel, publisher = ...
+
+if mode == "sub" then
+
+skynet.start(function()
+	publisher = tonumber(publisher)
+	local c = mc.new {
+		channel = tonumber(channel),
+		dispatch = function (_, _, i, msg)
+			skynet.send(publisher, "lua", "ack", i)
+		end
+	}
+	c:subscribe()
+end)
+
+else
+
+local N = 1000
+local acks = 0
+local waiting
+
+skynet.start(function()
+	skynet.dispatch("lua", function(_,_, cmd, i)
+		acks = acks + 1
+		if acks == N and waiting then
+			skynet.wakeup(waiting)
+		end
+	end)
+	local channel = mc.new()
+	local subs = {}
+	for i = 1, N do
+		subs[i] = skynet.newservice(SERVICE_NAME, "sub", channel.channel, skynet.self())
+	end
+	for _, size in ipairs { 16, 1024, 65536 } do
+		local msg = string.rep("x", size)
+		local t_publish, t_all = 0, 0
+		local n = 20
+		for i = 1, n do
+			acks = 0
+			waiting = coroutine.running()
+			local start = skynet.hpc()
+			channel:publish(i, msg)
+			t_publish = t_publish + skynet.hpc() - start
+			skynet.wait(waiting)
+			t_all = t_all + skynet.hpc() - start
+		end
+		print(string.format("publish %6d bytes to %d subscribers : %8.3f ms in multicastd, %8.3f ms until all get it",
+			size, N, t_publish / n / 1e6, t_all / n / 1e6))
+	end
+	for _, s in ipairs(subs) do
+		skynet.send(s, "debug", "EXIT")
+	end
+	skynet.exit()
+end)
+
+end
@@ -0,0 +1,224 @@
+local skynet = require "skynet"
+require "skynet.manager"
+
+-- Echo packages through a gateserver with different package header formats,
+-- and compare copy / slice mode with many small packages.
+
+local mode, format, bench = ...
+
+if mode == "gate" then
+
+local gateserver = require "snax.gateserver"
+local netpack = require "skynet.netpack"
+local socketdriver = require "skynet.socketdriver"
+
+local pack = netpack.packer(format)
+local handler = {}
+local count = 0
+local expect
+local finish
+
+function handler.open(source, conf)
+	return conf.port
+end
+
+function handler.connect(fd, addr)
+	gateserver.openclient(fd)
+end
+
+function handler.message(fd, msg, sz, slice)
+	if bench then
+		-- count only
+		count = count + 1
+		if count == expect then
+			skynet.wakeup(finish)
+		end
+	else
+		socketdriver.send(fd, pack(msg, sz))
+	end
+	if slice then
+		netpack.release(slice)
+	else
+		skynet.trash(msg, sz)
+	end
+end
+
+function handler.command(cmd, source, n)
+	assert(cmd == "wait")
+	if count < n then
+		expect = n
+		finish = coroutine.running()
+		skynet.wait(finish)
+	end
+	count = 0
+	expect = nil
+	return n
+end
+
+function handler.error(fd, msg)
+	skynet.error("gate error", fd, msg)
+	gateserver.closeclient(fd)
+end
+
+gateserver.start(handler)
+
+else
+
+local socket = require "skynet.socket"
+
+local function varint(n)
+	local tmp = {}
+	while n >= 0x80 do
+		table.insert(tmp, string.char(n & 0x7f | 0x80))
+		n = n >> 7
+	end
+	table.insert(tmp, string.char(n))
+	return table.concat(tmp)
+end
+
+local function read_varint(fd)
+	local n = 0
+	local shift = 0
+	while true do
+		local c = socket.read(fd, 1):byte()
+		n = n | (c & 0x7f) << shift
+		if c < 0x80 then
+			return n
+		end
+		shift = shift + 7
+	end
+end
+
+local FORMAT = {
+	["2be"] = ">I2",
+	["2le"] = "<I2",
+	["4be"] = ">I4",
+	["4le"] = "<I4",
+}
+
+local function codec(fmt)
+	local length, extra = fmt:match "^(%w+)%+?(%d*)$"
+	extra = tonumber(extra) or 0
+	local f = FORMAT[length]
+	local function encode(data)
+		local len = #data - extra
+		if length == "ext" then
+			if len > 0 and len <= 0xffff then
+				return string.pack(">I2", len) .. data
+			end
+			return string.pack(">I2>I4", 0, len) .. data
+		elseif f then
+			return string.pack(f, len) .. data
+		else
+			return varint(len) .. data
+		end
+	end
+	local function decode(fd)
+		local len
+		if length == "ext" then
+			len = string.unpack(">I2", socket.read(fd, 2))
+			if len == 0 then
+				len = string.unpack(">I4", socket.read(fd, 4))
+			end
+		elseif f then
+			len = string.unpack(f, socket.read(fd, string.packsize(f)))
+		else
+			len = read_varint(fd)
+		end
+		if len + extra == 0 then
+			return ""
+		end
+		return socket.read(fd, len + extra)
+	end
+	return encode, decode
+end
+
+local function test(fmt, sizes, slice)
+	local gate = skynet.newservice(SERVICE_NAME, "gate", fmt)
+	local port = skynet.call(gate, "lua", "open", { address = "127.0.0.1", port = 0, header = fmt, slice = slice })
+	local encode, decode = codec(fmt)
+	local fd = assert(socket.open("127.0.0.1", port))
+	local packages = {}
+	for i, sz in ipairs(sizes) do
+		packages[i] = string.rep(string.char(65 + i % 26), sz)
+	end
+	local stream = {}
+	for i, p in ipairs(packages) do
+		stream[i] = encode(p)
+	end
+	stream = table.concat(stream)
+	-- send the stream byte by byte at first, then in a few big chunks
+	local split = 64
+	for i = 1, split do
+		socket.write(fd, stream:sub(i, i))
+		skynet.sleep(0)
+	end
+	local pos = split + 1
+	while pos <= #stream do
+		local len = math.random(1, 70000)
+		socket.write(fd, stream:sub(pos, pos + len - 1))
+		pos = pos + len
+	end
+	for i, p in ipairs(packages) do
+		local r = decode(fd)
+		assert(r == p, string.format("%s : package %d (%d bytes) -> %s", fmt, i, #p, r and #r))
+	end
+	socket.close(fd)
+	skynet.kill(gate)
+	print("netpack", fmt, slice and "slice" or "copy", #packages, "packages ok")
+end
+
+local function bench(slice)
+	local n = 200000
+	local gate = skynet.newservice(SERVICE_NAME, "gate", "2be", "bench")
+	local port = skynet.call(gate, "lua", "open", { address = "127.0.0.1", port = 0, slice = slice })
+	local fd = assert(socket.open("127.0.0.1", port))
+	local chunk = string.rep(string.pack(">s2", string.rep("x", 16)), 1000)
+	local start = skynet.hpc()
+	for i = 1, n // 1000 do
+		socket.write(fd, chunk)
+	end
+	skynet.call(gate, "lua", "wait", n)
+	local ti = (skynet.hpc() - start) / 1e9
+	print(string.format("netpack %s : %d packages in %.3fs, %.0f packages/sec", slice and "slice" or "copy", n, ti, n / ti))
+	socket.close(fd)
+	skynet.kill(gate)
+end
+
+local function test_invalid()
+	local gate = skynet.newservice(SERVICE_NAME, "gate", "varint")
+	local port = skynet.call(gate, "lua", "open", { address = "127.0.0.1", port = 0, header = "varint", maxpackage = 1024 })
+	local fd = assert(socket.open("127.0.0.1", port))
+	socket.write(fd, varint(4096) .. "hello")
+	assert(socket.read(fd) == false)
+	socket.close(fd)
+	skynet.kill(gate)
+	print("netpack invalid size ok")
+end
+
+skynet.start(function()
+	local sizes = { 0, 1, 2, 127, 128, 300, 16383, 16384, 65535 }
+	for i = 1, 20 do
+		table.insert(sizes, math.random(0, 4096))
+	end
+	test("2be", sizes)
+	test("2le", sizes)
+	local big = { 65536, 100000, 1 }
+	for _, v in ipairs(sizes) do
+		table.insert(big, v)
+	end
+	test("4be", big)
+	test("4le", big)
+	test("varint", big)
+	test("ext", big)
+	local typed = { 2, 3, 100, 65537 }
+	test("4be+2", typed)
+	test("varint+2", typed)
+	test("2be", sizes, true)
+	test("varint+2", typed, true)
+	test_invalid()
+	bench(false)
+	bench(true)
+end)
+
+end
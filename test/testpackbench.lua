@@ -0,0 +1,148 @@
+local skynet = require "skynet"
+
+-- skynet.pack / skynet.packhint / skynet.packintern / skynet.unpack with game state tables of different sizes
+
+local function item(i)
+	return { id = 10000 + i, count = i % 99 + 1, bind = i % 3 == 0, attr = { 1.5 * i, i * 7, -i } }
+end
+
+local function player(id, items)
+	local bag = {}
+	for i = 1, items do
+		bag[i] = item(i)
+	end
+	return {
+		id = id,
+		name = "player" .. id,
+		level = 60,
+		exp = 123456789012,
+		pos = { x = 1024.5, y = 768.25, z = 0, map = "main_city" },
+		hp = 9999, mp = 1234,
+		buff = { [1001] = 30, [1002] = 60, [1003] = 90 },
+		bag = bag,
+		quest = { done = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 }, current = { id = 11, step = 2, desc = string.rep("q", 100) } },
+	}
+end
+
+local function scene(players, items)
+	local t = {}
+	for i = 1, players do
+		t[i] = player(i, items)
+	end
+	return t
+end
+
+local function equal(a, b)
+	if type(a) ~= "table" or type(b) ~= "table" then
+		return a == b
+	end
+	for k, v in pairs(a) do
+		if not equal(v, b[k]) then
+			return false
+		end
+	end
+	for k in pairs(b) do
+		if a[k] == nil then
+			return false
+		end
+	end
+	return true
+end
+
+local function bench(name, obj, n, packname)
+	local pack = skynet[packname]
+	local msg, sz = pack(obj)
+	assert(equal(skynet.unpack(msg, sz), obj))
+	local packstr = skynet.tostring(msg, sz)
+	skynet.trash(msg, sz)
+	local start = skynet.hpc()
+	for i = 1, n do
+		local msg, sz = pack(obj)
+		skynet.trash(msg, sz)
+	end
+	local ti = (skynet.hpc() - start) / 1e9
+	start = skynet.hpc()
+	for i = 1, n do
+		skynet.unpack(packstr)
+	end
+	local ti2 = (skynet.hpc() - start) / 1e9
+	print(string.format("%-10s %-24s %8d bytes : %8.0f packs/sec, %7.1f MB/s, %8.0f unpacks/sec",
+		packname, name, sz, n / ti, n * sz / ti / (1024 * 1024), n / ti2))
+end
+
+local function test_intern()
+	-- more than 30 different strings, the index follows as an integer
+	local t = {}
+	for i = 1, 1000 do
+		t[i] = { ["key" .. i % 100] = "value" .. i % 50, i = i, s = "s" }
+	end
+	local r = skynet.unpack(skynet.packintern(t, "hello", "hello", { hello = "hello" }, 1, "x", "x"))
+	assert(equal(r, t))
+	local a, b, c, d, e, f = select(2, skynet.unpack(skynet.packintern(t, "hello", "hello", { hello = "hello" }, 1, "x", "x")))
+	assert(a == "hello" and b == "hello" and c.hello == "hello" and d == 1 and e == "x" and f == "x")
+	assert(select("#", skynet.unpack(skynet.packintern())) == 0)
+	local msg, sz = skynet.packintern(t)
+	local size_intern = sz
+	skynet.trash(msg, sz)
+	msg, sz = skynet.pack(t)
+	skynet.trash(msg, sz)
+	assert(size_intern < sz)
+	-- the strings made by __pairs are collected while packing, a new string may get the address of an old one
+	local gen = setmetatable({}, { __pairs = function()
+		local i = 0
+		return function()
+			i = i + 1
+			if i <= 200 then
+				collectgarbage()
+				return string.format("k%d", i), string.format("v%d", i)
+			end
+		end
+	end })
+	local r = skynet.unpack(skynet.packintern(gen))
+	for i = 1, 200 do
+		assert(r["k" .. i] == "v" .. i)
+	end
+	print("packintern ok")
+end
+
+local function test_version()
+	-- version 0 message (without header) : { 5, a = true }, "hi"
+	local v0 = string.char(6 | 1 << 3, 2 | 1 << 3, 5, 4 | 1 << 3, string.byte "a", 1 | 1 << 3, 0, 4 | 2 << 3) .. "hi"
+	local t, s = skynet.unpack(v0)
+	assert(t[1] == 5 and t.a == true and s == "hi")
+	-- unknown flags in header
+	assert(not pcall(skynet.unpack, string.char(7 | (16 | 8) << 3)))
+	-- skynet.pack writes version 0, the same as v0 above
+	assert(skynet.packstring({ 5, a = true }, "hi") == v0)
+	-- packhint writes the header and the hash size hints
+	local m, sz = skynet.packhint({ 5, a = true }, "hi")
+	local msg = skynet.tostring(m, sz)
+	skynet.trash(m, sz)
+	assert(msg:byte(1) == 7 | (16 | 1) << 3 and #msg == #v0 + 2)
+	local t, s = skynet.unpack(msg)
+	assert(t[1] == 5 and t.a == true and s == "hi")
+	-- a bad hash size hint
+	local m, sz = skynet.packhint { a = 1 }
+	local msg = skynet.tostring(m, sz)
+	skynet.trash(m, sz)
+	assert(skynet.unpack(msg).a == 1)
+	assert(not pcall(skynet.unpack, msg:sub(1, 2) .. string.char(200) .. msg:sub(4)))
+	print("pack version ok")
+end
+
+skynet.start(function()
+	test_version()
+	test_intern()
+	for _, packname in ipairs { "pack", "packhint", "packintern" } do
+		bench("small message", { cmd = "move", x = 1, y = 2, session = 123 }, 1000000, packname)
+		bench("player (no items)", player(1, 0), 200000, packname)
+		bench("player (20 items)", player(1, 20), 50000, packname)
+		bench("player (200 items)", player(1, 200), 5000, packname)
+		bench("scene (50 players)", scene(50, 20), 1000, packname)
+		bench("array of 10000 integers", (function() local t = {} for i = 1, 10000 do t[i] = i * 1000 end return t end)(), 2000, packname)
+		bench("string 64KB", string.rep("x", 65536), 20000, packname)
+		bench("dictionary 10000 keys", (function() local t = {} for i = 1, 10000 do t["k" .. i] = i end return t end)(), 500, packname)
+		bench("1000 dictionaries", (function() local t = {} for i = 1, 1000 do t[i] = { [i] = 1, [i * 2] = 2, [i * 3] = 3, [i * 5] = 5, [i * 7] = 7 } end return t end)(), 500, packname)
+	end
+	skynet.exit()
+end)
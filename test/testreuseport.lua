@@ -0,0 +1,48 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+
+-- Many listeners share one port with SO_REUSEPORT, the kernel distributes connections among them.
+
+local mode, port = ...
+port = tonumber(port) or 8003
+
+if mode == "listener" then
+
+skynet.start(function()
+	local accepted = 0
+	local id = socket.listen("127.0.0.1", port, 128, true)
+	socket.start(id, function(fd, addr)
+		accepted = accepted + 1
+		socket.close(fd)
+	end)
+	skynet.dispatch("lua", function()
+		skynet.ret(skynet.pack(accepted))
+	end)
+end)
+
+else
+
+local listener = 4
+local client = 200
+
+skynet.start(function()
+	local l = {}
+	for i=1,listener do
+		l[i] = skynet.newservice(SERVICE_NAME, "listener", port)
+	end
+	for i=1,client do
+		local fd = assert(socket.open("127.0.0.1", port))
+		socket.close(fd)
+	end
+	skynet.sleep(50)
+	local total = 0
+	for i=1,listener do
+		local n = skynet.call(l[i], "lua")
+		print("listener", i, "accepted", n)
+		total = total + n
+	end
+	assert(total == client)
+	print("reuseport ok")
+end)
+
+end
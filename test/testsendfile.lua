@@ -0,0 +1,54 @@
+local skynet = require "skynet"
+local socket = require "skynet.socket"
+
+local filename = ...
+filename = filename or "./skynet"
+
+local function readfile(name)
+	local f = assert(io.open(name, "rb"))
+	local s = f:read "a"
+	f:close()
+	return s
+end
+
+skynet.start(function()
+	local content = readfile(filename)
+	local offset = #content // 3
+	local expect = "head" .. content .. "middle" .. content:sub(offset + 1, offset + 1000) .. "file" .. content:sub(offset + 1) .. "tail"
+
+	local lid, _, port = socket.listen("127.0.0.1", 0)
+	socket.start(lid, function(id)
+		socket.start(id)
+		socket.write(id, "head")
+		assert(socket.sendfile(id, filename))
+		socket.write(id, "middle")
+		assert(socket.sendfile(id, filename, offset, 1000))
+		socket.write(id, "file")
+		-- send from the opened file
+		local f = assert(io.open(filename, "rb"))
+		assert(socket.sendfile(id, f, offset))
+		f:close()
+		socket.write(id, "tail")
+		socket.close(id)
+		local ok, err = socket.sendfile(id, filename)
+		assert(ok == false and type(err) == "string", err)
+	end)
+
+	local fd = socket.open("127.0.0.1", port)
+	local start = skynet.hpc()
+	local tmp = {}
+	while true do
+		local s, rest = socket.read(fd)
+		if not s then
+			table.insert(tmp, rest)
+			break
+		end
+		table.insert(tmp, s)
+	end
+	local result = table.concat(tmp)
+	local ti = (skynet.hpc() - start) / 1e9
+	socket.close(fd)
+	socket.close(lid)
+	assert(result == expect, "sendfile content mismatch")
+	print(string.format("sendfile %s (%d bytes) ok, %.3fs", filename, #content, ti))
+end)
@@ -0,0 +1,65 @@
+local skynet = require "skynet"
+require "skynet.manager"
+local socket = require "skynet.socket"
+
+-- Measure ctrl commands/sec of socket server under many senders.
+-- Every socket.lwrite is queued as a ctrl command to the socket thread.
+
+local mode, id, n = ...
+
+if mode == "sender" then
+
+skynet.start(function()
+	id = tonumber(id)
+	n = tonumber(n)
+	skynet.dispatch("lua", function()
+		for i=1,n do
+			socket.lwrite(id, "x")
+		end
+		skynet.ret()
+	end)
+end)
+
+else
+
+local sender = 16
+local n = 20000
+
+skynet.start(function()
+	local total = sender * n
+	local finish
+	local lid, addr, port = socket.listen("127.0.0.1", 0)
+	socket.start(lid, function(cid)
+		socket.start(cid)
+		local recv = 0
+		while recv < total do
+			local str = socket.read(cid)
+			if not str then
+				break
+			end
+			recv = recv + #str
+		end
+		socket.close(cid)
+		skynet.wakeup(finish)
+	end)
+	local fd = socket.open("127.0.0.1", port)
+	local s = {}
+	for i=1,sender do
+		s[i] = skynet.newservice(SERVICE_NAME, "sender", fd, n)
+	end
+	finish = coroutine.running()
+	local start = skynet.hpc()
+	for i=1,sender do
+		skynet.send(s[i], "lua")
+	end
+	skynet.wait(finish)
+	local ti = (skynet.hpc() - start) / 1e9
+	print(string.format("%d senders, %d commands in %.3fs, %.0f commands/sec", sender, total, ti, total / ti))
+	socket.close(fd)
+	socket.close(lid)
+	for i=1,sender do
+		skynet.kill(s[i])
+	end
+end)
+
+end
@@ -0,0 +1,230 @@
+local skynet = require "skynet"
+local sproto = require "sproto"
+
+-- sproto encode/decode of large nested messages
+
+local SCHEMA = [[
+.Item {
+	id 0 : integer
+	count 1 : integer
+	bind 2 : boolean
+	attr 3 : *integer
+	weight 4 : integer(2)
+}
+
+.Quest {
+	id 0 : integer
+	step 1 : integer
+	desc 2 : string
+}
+
+.Player {
+	id 0 : integer
+	name 1 : string
+	level 2 : integer
+	exp 3 : integer
+	pos 4 : *double
+	bag 5 : *Item
+	quest 7 : *Quest(id)
+	flags 8 : *boolean
+	stat 9 : *integer
+	dict 10 : *Pair()
+}
+
+.Pair {
+	key 0 : string
+	value 1 : integer
+}
+
+.Scene {
+	map 0 : string
+	players 1 : *Player
+}
+
+.Move {
+	session 0 : integer
+	x 1 : integer
+	y 2 : integer
+	z 3 : integer
+	dir 4 : integer
+	speed 5 : integer
+	run 6 : boolean
+}
+
+.Sparse {
+	a 1 : integer
+	b 5 : string
+	c 20 : integer
+	d 100 : boolean
+	e 1000 : integer
+	f 1001 : integer
+}
+
+.Gap {
+	a 2 : integer
+	b 4 : string
+	c 5 : integer
+	d 9 : boolean
+	e 12 : *integer
+}
+
+.Chat {
+	from 0 : string
+	to 1 : string
+	channel 2 : string
+	text 3 : string
+	time 4 : integer
+}
+]]
+
+local function player(id, items)
+	local bag = {}
+	for i = 1, items do
+		bag[i] = { id = 10000 + i, count = i % 99 + 1, bind = i % 3 == 0, attr = { i, i * 7, -i }, weight = i / 4 }
+	end
+	local quest = {}
+	for i = 1, 10 do
+		quest[i] = { id = i, step = i % 3, desc = string.rep("q", 10 * i) }
+	end
+	local dict = {}
+	for i = 1, 10 do
+		dict["k" .. i] = i
+	end
+	return {
+		id = id,
+		name = "player" .. id,
+		level = 60,
+		exp = 123456789012,
+		pos = { 1024.5, 768.25, 0 },
+		bag = bag,
+		quest = quest,
+		flags = { true, false, true },
+		stat = { 1, 2, 3, 1 << 40 },
+		dict = dict,
+	}
+end
+
+local function scene(players, items)
+	local t = {}
+	for i = 1, players do
+		t[i] = player(i, items)
+	end
+	return { map = "main_city", players = t }
+end
+
+local function equal(a, b)
+	if type(a) ~= "table" or type(b) ~= "table" then
+		return a == b
+	end
+	for k, v in pairs(a) do
+		if not equal(v, b[k]) then
+			return false
+		end
+	end
+	for k in pairs(b) do
+		if a[k] == nil then
+			return false
+		end
+	end
+	return true
+end
+
+-- a fresh sproto.core has the initial (small) encode buffer
+local function fresh_core()
+	package.loaded["sproto.core"] = nil
+	return require "sproto.core"
+end
+
+local function test_encode(sp)
+	for _, n in ipairs { 0, 1, 2, 3, 5, 8, 13, 21, 34, 55, 89, 144 } do
+		for _, items in ipairs { 0, 1, 7, 30 } do
+			local core = fresh_core()
+			local obj = scene(n, items)
+			local code = core.encode(assert(core.querytype(sp.__cobj, "Scene")), obj)
+			assert(equal(sp:decode("Scene", code), obj))
+			-- the same result with the grown buffer
+			assert(core.encode(core.querytype(sp.__cobj, "Scene"), obj) == code)
+		end
+	end
+	-- strings near the buffer size
+	for _, from in ipairs { 2000, 16300, 65450 } do
+		for len = from, from + 100 do
+			local core = fresh_core()
+			local obj = { id = 1, desc = string.rep("x", len) }
+			local code = core.encode(core.querytype(sp.__cobj, "Quest"), obj)
+			assert(equal(sp:decode("Quest", code), obj))
+		end
+	end
+	-- integer array with int64 after many int32
+	local core = fresh_core()
+	local stat = {}
+	for i = 1, 1000 do
+		stat[i] = i
+	end
+	stat[1001] = 1 << 40
+	local code = core.encode(core.querytype(sp.__cobj, "Player"), { stat = stat })
+	assert(equal(sp:decode("Player", code).stat, stat))
+	print("sproto encode ok")
+end
+
+-- the plans of decode are cleared when a sproto object is deleted, the address of types may be reused
+local function test_plan()
+	for i = 1, 100 do
+		local name = "f" .. i
+		local sp = sproto.parse(string.format(".T { %s 0 : integer x %d : string }", name, i))
+		local t = sp:decode("T", sp:encode("T", { [name] = i, x = name }))
+		assert(t[name] == i and t.x == name)
+		sp = nil
+		collectgarbage()
+	end
+	print("sproto plan ok")
+end
+
+local function bench_cold(sp, obj, n)
+	local size
+	collectgarbage "collect"
+	collectgarbage "stop"
+	local mem = collectgarbage "count"
+	local start = skynet.hpc()
+	for i = 1, n do
+		local core = fresh_core()
+		size = #core.encode(core.querytype(sp.__cobj, "Scene"), obj)
+	end
+	local ti = (skynet.hpc() - start) / 1e9
+	mem = collectgarbage "count" - mem
+	collectgarbage "restart"
+	print(string.format("encode %8d bytes with initial buffer : %7.0f encodes/sec, %8.1f KB allocated per encode", size, n / ti, mem / n))
+end
+
+local function bench(sp, name, typename, obj, n)
+	local code = sp:encode(typename, obj)
+	assert(equal(sp:decode(typename, code), obj))
+	local start = skynet.hpc()
+	for i = 1, n do
+		sp:encode(typename, obj)
+	end
+	local t1 = (skynet.hpc() - start) / 1e9
+	start = skynet.hpc()
+	for i = 1, n do
+		sp:decode(typename, code)
+	end
+	local t2 = (skynet.hpc() - start) / 1e9
+	print(string.format("%-24s %8d bytes : %8.0f encodes/sec, %8.0f decodes/sec", name, #code, n / t1, n / t2))
+end
+
+skynet.start(function()
+	local sp = sproto.parse(SCHEMA)
+	test_encode(sp)
+	test_plan()
+	bench_cold(sp, scene(10, 10), 2000)
+	bench_cold(sp, scene(100, 20), 200)
+	bench_cold(sp, scene(1000, 20), 20)
+	bench(sp, "move", "Move", { session = 1, x = 100, y = 200, z = 0, dir = 90, speed = 5, run = true }, 500000)
+	bench(sp, "sparse tags", "Sparse", { a = 1, b = "hello", c = 3, d = true, e = 5, f = 6 }, 500000)
+	bench(sp, "gap tags", "Gap", { a = 1, b = "hello", c = 100000, d = false, e = { 1, 2 } }, 500000)
+	bench(sp, "chat", "Chat", { from = "alice", to = "bob", channel = "world", text = string.rep("hi ", 30), time = 1700000000 }, 500000)
+	bench(sp, "item", "Item", { id = 10001, count = 5, bind = true, attr = { 1, 2, 3 }, weight = 1.25 }, 200000)
+	bench(sp, "player (20 items)", "Player", player(1, 20), 10000)
+	bench(sp, "scene (100 players)", "Scene", scene(100, 20), 200)
+	skynet.exit()
+end)
@@ -0,0 +1,87 @@
+local skynet = require "skynet"
+local stm = require "skynet.stm"
+
+-- many readers poll the same stm object, the reads/sec with more readers, with or without the writer updating it
+
+local mode = ...
+
+if mode == "reader" then
+
+local reader
+
+skynet.start(function()
+	skynet.dispatch("lua", function (_,_, cmd, arg)
+		if cmd == "copy" then
+			reader = stm.newcopy(arg)
+			skynet.ret()
+		else
+			-- poll n times, yield every 1000 reads
+			local updates = 0
+			for i = 1, arg do
+				if reader(skynet.unpack) then
+					updates = updates + 1
+				end
+				if i % 1000 == 0 then
+					skynet.yield()
+				end
+			end
+			skynet.ret(skynet.pack(updates))
+		end
+	end)
+end)
+
+else
+
+local function bench(obj, readers, n, update)
+	local r = {}
+	for i = 1, readers do
+		r[i] = skynet.newservice(SERVICE_NAME, "reader")
+		skynet.call(r[i], "lua", "copy", stm.copy(obj))
+	end
+	local writing = update
+	local writes = 0
+	if update then
+		skynet.fork(function()
+			while writing do
+				writes = writes + 1
+				obj(skynet.pack { version = writes, data = string.rep("x", 100) })
+				skynet.sleep(1)
+			end
+		end)
+	end
+	local co = coroutine.running()
+	local done = 0
+	local updates = 0
+	local start = skynet.hpc()
+	for i = 1, readers do
+		skynet.fork(function()
+			local u = skynet.call(r[i], "lua", "read", n // readers)
+			updates = updates + u
+			done = done + 1
+			if done == readers then
+				skynet.wakeup(co)
+			end
+		end)
+	end
+	skynet.wait(co)
+	local ti = (skynet.hpc() - start) / 1e9
+	writing = false
+	print(string.format("%4d readers%-16s : %9.0f reads/sec, %6d updates read",
+		readers, update and " (with writer)" or "", n / ti, updates))
+	for i = 1, readers do
+		skynet.send(r[i], "debug", "EXIT")
+	end
+end
+
+skynet.start(function()
+	local obj = stm.new(skynet.pack { version = 0, data = string.rep("x", 100) })
+	for _, readers in ipairs { 1, 8, 64, 256 } do
+		bench(obj, readers, 4000000, false)
+	end
+	for _, readers in ipairs { 1, 8, 64, 256 } do
+		bench(obj, readers, 4000000, true)
+	end
+	skynet.exit()
+end)
+
+end
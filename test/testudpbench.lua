@@ -0,0 +1,72 @@
+local skynet = require "skynet"
+require "skynet.manager"
+local socket = require "skynet.socket"
+
+-- loopback udp echo benchmark : each client keeps a window of packages in flight.
+
+local mode, port = ...
+port = tonumber(port) or 8765
+
+local window = 64
+local duration = 200	-- 2s
+
+if mode == "client" then
+
+skynet.start(function()
+	local count = 0
+	local running = true
+	local package = string.rep("x", 64)
+	local c
+	c = socket.udp_dial("127.0.0.1", port, function(str, from)
+		count = count + 1
+		if running then
+			socket.write(c, package)
+		end
+	end)
+	skynet.dispatch("lua", function()
+		for i=1,window do
+			socket.write(c, package)
+		end
+		skynet.sleep(duration)
+		running = false
+		skynet.ret(skynet.pack(count))
+	end)
+end)
+
+else
+
+local client = 4
+
+skynet.start(function()
+	local server
+	server = socket.udp(function(str, from)
+		socket.sendto(server, from, str)
+	end , "127.0.0.1", port)
+	local c = {}
+	for i=1,client do
+		c[i] = skynet.newservice(SERVICE_NAME, "client", port)
+	end
+	local total = 0
+	local n = client
+	local co = coroutine.running()
+	for i=1,client do
+		skynet.fork(function()
+			local r = skynet.call(c[i], "lua")
+			total = total + r
+			n = n - 1
+			if n == 0 then
+				skynet.wakeup(co)
+			end
+		end)
+	end
+	skynet.wait(co)
+	-- each echo is a package received and a package sent by server
+	print(string.format("udp echo %d clients, window %d : %d echos in %.1fs, %.0f packets/sec",
+		client, window, total, duration / 100, total * 2 / (duration / 100)))
+	socket.close(server)
+	for i=1,client do
+		skynet.kill(c[i])
+	end
+end)
+
+end
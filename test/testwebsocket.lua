@@ -0,0 +1,107 @@
+local skynet = require "skynet"
+require "skynet.manager"
+local socket = require "skynet.socket"
+local websocket = require "http.websocket"
+local wscodec = require "skynet.websocket"
+
+-- websocket echo : frame sizes, fragments, permessage-deflate, and frame throughput.
+
+local mode = ...
+
+if mode == "agent" then
+
+local handle = {}
+
+function handle.message(id, msg, msg_type)
+	websocket.write(id, msg, msg_type)
+end
+
+skynet.start(function()
+	skynet.dispatch("lua", function (_,_, id, protocol, addr)
+		websocket.accept(id, handle, protocol, addr, { deflate = true })
+		skynet.exit()
+	end)
+end)
+
+else
+
+local KEY = 0x12345678
+
+local function test_echo(url, header)
+	local id = websocket.connect(url, header)
+	for _, sz in ipairs { 0, 1, 125, 126, 127, 1000, 65535, 65536, 200000 } do
+		local msg = string.rep(string.char(sz % 256), sz)
+		websocket.write(id, msg, "binary", KEY)
+		assert(websocket.read(id) == msg, sz)
+	end
+	local text = string.rep("hello websocket ", 1000)
+	websocket.write(id, text, "text", KEY)
+	assert(websocket.read(id) == text)
+	websocket.close(id)
+	print("websocket echo ok", header and "deflate" or "")
+end
+
+local function test_fragment(port)
+	local fd = socket.open("127.0.0.1", port)
+	socket.write(fd, "GET / HTTP/1.1\r\nHost: 127.0.0.1\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n" ..
+		"Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n")
+	local line = socket.readline(fd, "\r\n\r\n")
+	assert(line:find("101", 1, true))
+	-- a text message in 3 fragments, with a ping among them
+	socket.write(fd, wscodec.frame(1, "abc", KEY, false, false))
+	socket.write(fd, wscodec.frame(9, "ping", KEY))
+	socket.write(fd, wscodec.frame(0, string.rep("d", 300), KEY, false, false))
+	socket.write(fd, wscodec.frame(0, "end", KEY, false, true))
+	local function read_frame()
+		local head = socket.read(fd, 2)
+		local fin, op, rsv1, len, key = wscodec.header(head)
+		if fin == nil then
+			fin, op, rsv1, len, key = wscodec.header(head, socket.read(fd, op))
+		end
+		return op, len > 0 and socket.read(fd, len) or ""
+	end
+	local op, payload = read_frame()
+	assert(op == 0x0a and payload == "ping")
+	op, payload = read_frame()
+	assert(op == 0x01 and payload == "abc" .. string.rep("d", 300) .. "end")
+	socket.close(fd)
+	print("websocket fragment ok")
+end
+
+local function bench(url, n, sz)
+	local id = websocket.connect(url)
+	local msg = string.rep("x", sz)
+	local window = 64
+	local start = skynet.hpc()
+	for i = 1, window do
+		websocket.write(id, msg, "binary", KEY)
+	end
+	for i = 1, n do
+		assert(#websocket.read(id) == sz)
+		if i + window <= n then
+			websocket.write(id, msg, "binary", KEY)
+		end
+	end
+	local ti = (skynet.hpc() - start) / 1e9
+	websocket.close(id)
+	print(string.format("websocket %d frames of %d bytes in %.3fs, %.0f frames/sec", n, sz, ti, n / ti))
+end
+
+skynet.start(function()
+	local lid, _, port = socket.listen("127.0.0.1", 0)
+	socket.start(lid, function(id, addr)
+		local agent = skynet.newservice(SERVICE_NAME, "agent")
+		skynet.send(agent, "lua", id, "ws", addr)
+	end)
+	local url = string.format("ws://127.0.0.1:%d/test", port)
+	test_echo(url)
+	if pcall(require, "wsdeflate") then
+		test_echo(url, { ["Sec-WebSocket-Extensions"] = "permessage-deflate" })
+	end
+	test_fragment(port)
+	bench(url, 50000, 64)
+	bench(url, 5000, 16384)
+	socket.close(lid)
+end)
+
+end